@@ -219,7 +219,6 @@ private:
 #ifdef RTP_STREAM
       rtpstream_actinfo_t M_rtpstream_actinfo;
 #endif
-    void setSubString(char** P_target, char* P_source, int P_start, int P_stop);
 };
 
 class CActions
@@ -56,6 +56,45 @@
 #define RTCHECK_LOOSE	2
 
 
+/* Memory that lives exactly as long as one call.  Blocks are carved out of
+ * large chunks, and everything is given back at once when the call is
+ * deleted, so a short call costs a single malloc() for all of its state.
+ * Only the most recent block can be reclaimed or grown in place. */
+#define CALL_ARENA_CHUNK 16384
+
+class call_arena
+{
+public:
+    call_arena();
+    ~call_arena();
+
+    void *alloc(size_t size);
+    /* Like realloc(3): the contents are kept.  Growing a block that is not
+     * the most recent one at least doubles it, so a buffer that keeps
+     * growing wastes no more than it holds. */
+    void *grow(void *ptr, size_t size);
+    char *copy(const char *s);
+    void release(void *ptr);
+
+    /* Keep this many free chunks for the next calls, allocating them now. */
+    static void prewarm(int count);
+
+    /* How many chunks this arena used, and how many of those had to be
+     * taken from malloc() rather than from the free chunks. */
+    unsigned int chunks_used;
+    unsigned int mallocs;
+private:
+    struct chunk {
+        struct chunk *next;
+        size_t size;
+        size_t used;
+    };
+    struct chunk *chunks;
+
+    static struct chunk *free_chunks;
+    static int nb_free_chunks;
+};
+
 struct txnInstanceInfo {
     char *txnID;
     unsigned long txnResp;
@@ -70,6 +109,13 @@ public:
     call(const char *p_id, bool use_ipv6, int userId, struct sockaddr_storage *dest);
     call(const char *p_id, struct sipp_socket *socket, struct sockaddr_storage *dest);
     static call *add_call(int userId, bool ipv6, struct sockaddr_storage *dest);
+
+    /* Freed calls are kept, up to -call_pool of them, and handed out again
+     * by new, so steady call churn does not go to malloc for them. */
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+    /* Fill the pools of calls and arena chunks at startup. */
+    static void prewarm_pool();
     call(scenario * call_scenario, struct sipp_socket *socket, struct sockaddr_storage *dest, const char * p_id, int userId, bool ipv6, bool isAutomatic, bool isInitCall);
 
     virtual ~call();
@@ -106,7 +152,14 @@ public:
         return last_recv_msg;
     };
 
+    /* Render a message for this call into the caller's buffer. */
+    char* createSendingMessage(SendingMessage *src, int P_index, char *msg_buffer, int buflen, int *msgLen=NULL);
+
 private:
+    /* Call state that is freed with the call; declared first so it
+     * outlives everything that points into it. */
+    call_arena arena;
+
     /* This is the core constructor function. */
     void init(scenario * call_scenario, struct sipp_socket *socket, struct sockaddr_storage *dest, const char * p_id, int userId, bool ipv6, bool isAutomatic, bool isInitCall);
     /* This this call for initialization? */
@@ -129,7 +182,6 @@ private:
 
     int		msg_index;
     int		zombie;
-    char *    realloc_ptr;
 
     /* Last message sent from scenario step (retransmitions do not
      * change this index. Only message sent from the scenario
@@ -166,7 +218,6 @@ private:
 
 #ifdef PCAPPLAY
     int hasMediaInformation;
-    pthread_t media_thread;
     play_args_t play_args_a;
     play_args_t play_args_v;
 #endif
@@ -244,7 +295,6 @@ private:
     // P_index = -1 Add crlf to end of message
     char* createSendingMessage(SendingMessage *src, int P_index, int *msgLen=NULL);
     char* createSendingMessage(char * src, int P_index, bool skip_sanity = false);
-    char* createSendingMessage(SendingMessage *src, int P_index, char *msg_buffer, int buflen, int *msgLen=NULL);
 
     // method for the management of unexpected messages
     bool  checkInternalCmd(char* cmd);  // check of specific internal command
@@ -289,7 +339,7 @@ private:
     bool   connect_socket_if_needed();
 
     char * get_header_field_code(const char * msg, const char * code);
-    char * get_last_header(const char * name);
+    char * get_last_header(const char * name, char *buf, size_t size);
     char * get_last_request_uri();
     unsigned long hash(const char * msg);
 
@@ -34,8 +34,27 @@
 #ifndef CALLGENERATIONTASK_HPP
 #define CALLGENERATIONTASK_HPP
 
+#include <istream>
+#include <vector>
+
 #include "task.hpp"
 #define DONT_RESCHEDULE 0
+/* clock_tick follows the coarse clock, which may only move once per kernel
+ * tick (up to 10ms), so the timers can fire that late.  The task is woken
+ * this many microseconds before the next call is due and stays on the run
+ * queue from then on. */
+#define PACING_RUN_AHEAD_US 12000
+
+/* How the start times of new calls are chosen in rate mode. */
+enum arrival_process {
+    ARRIVAL_UNIFORM,
+    ARRIVAL_POISSON,
+    ARRIVAL_TRACE
+};
+
+/* Read the arrival times of a -arrival_trace CSV file, as microseconds from
+ * the first one.  Returns false and sets the line number on a bad line. */
+bool read_arrival_trace(std::istream &in, std::vector<unsigned long long> *offsets_us, int *bad_line);
 
 class CallGenerationTask : public task {
 public:
@@ -44,6 +63,8 @@ public:
     static void set_users(int new_users);
     static void set_paused(bool paused);
     static void free_user(int userId);
+    /* Is the next call due within a millisecond, too soon to sleep? */
+    static bool call_due_soon();
 
     bool run();
     void dump();
@@ -55,9 +76,24 @@ private:
     CallGenerationTask();
     virtual ~CallGenerationTask();
 
+    /* Microseconds between two call starts at the current rate. */
+    static double us_per_call();
+    /* Move next_arrival_us on to the call after it, 0 if there is none. */
+    static void advance_arrival();
+    void open_call(int userid);
+
     static class CallGenerationTask *instance;
     static unsigned long calls_since_last_rate_change;
-    static unsigned long last_rate_change_time;
+    static unsigned long long last_rate_change_us;
+    static unsigned long long last_call_start_us;
+    static unsigned long long last_call_due_us;
+    static unsigned long long next_arrival_us;
+
+    static enum arrival_process process;
+    static class CSample *inter_arrival;
+    static std::vector<unsigned long long> trace_us;
+    static unsigned long long trace_base_us;
+    static size_t trace_next;
 };
 
 #endif
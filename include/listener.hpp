@@ -35,6 +35,9 @@ public:
     listener(const char *id, bool listening);
     virtual ~listener();
     char *getId();
+    unsigned int getHash() {
+        return id_hash;
+    }
     virtual bool process_incoming(char * msg, struct sockaddr_storage *src) = 0;
     virtual bool process_twinSippCom(char * msg) = 0;
 
@@ -42,11 +45,22 @@ protected:
     void startListening();
     void stopListening();
 
-    char *id;
+    char *id; /* id_inline unless the Call-ID is longer. */
+    size_t id_len;
+    /* call_id_hash() of our id, computed once. */
+    unsigned int id_hash;
     bool listening;
+    char id_inline[64];
+
+    friend listener * get_listener(const char *id, size_t len, unsigned int hash);
 };
 
-typedef std::map<std::string, listener *> listener_map;
 listener * get_listener(const char *);
+/* Look up a Call-ID that need not be NUL terminated, given its hash. */
+listener * get_listener(const char *id, size_t len, unsigned int hash);
+
+/* Lookups and slots probed in the call tables, for the average probe length. */
+extern unsigned long listener_lookups;
+extern unsigned long listener_probes;
 
 #endif
@@ -4,8 +4,12 @@
 /************************** Trace Files ***********************/
 
 #include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
 
 #define MAX_PATH                   250
+#define DEFAULT_TRACE_BUFFER_SIZE  (4 * 1024 * 1024)
+#define LOGGER_SLEEP_US            10000
 
 #ifdef GLOBALS_FULL_DEFINITION
 #define extern
@@ -24,6 +28,7 @@ extern bool   useCallDebugf                       _DEFVAL(0);
 extern bool   useShortMessagef                    _DEFVAL(0);
 extern bool   useScreenf                          _DEFVAL(0);
 extern bool   useLogf                             _DEFVAL(0);
+extern bool   usePcapngf                          _DEFVAL(0);
 //extern bool   useTimeoutf                         _DEFVAL(0);
 extern bool   dumpInFile                          _DEFVAL(0);
 extern bool   dumpInRtt                           _DEFVAL(0);
@@ -34,6 +39,7 @@ extern char * slave_cfg_file;
 extern unsigned long long max_log_size		  _DEFVAL(0);
 extern unsigned long long ringbuffer_size	  _DEFVAL(0);
 extern int    ringbuffer_files			  _DEFVAL(0);
+extern unsigned long long trace_buffer_size	  _DEFVAL(DEFAULT_TRACE_BUFFER_SIZE);
 
 extern char   screen_last_error[32768];
 extern char   screen_logfile[MAX_PATH]            _DEFVAL("");
@@ -54,6 +60,8 @@ struct logfile_info {
     bool fixedname;
     time_t starttime;
     unsigned int count;
+    const char *extension; /* ".log" when NULL */
+    void (*header)(FILE *f); /* Written at the start of each new file. */
 };
 
 void print_header_line(FILE *f);
@@ -63,25 +71,36 @@ void print_tdm_map();
 void print_screens(void);
 
 void log_off(struct logfile_info *lfi);
+/* Stops the logger thread and writes out everything still queued, returns
+ * the number of records dropped so far. */
+unsigned long flush_logs();
+
+void pcapng_header(FILE *f);
 
 #ifdef GLOBALS_FULL_DEFINITION
 #define LOGFILE(name, s, check) \
-	struct logfile_info name = { s, check, NULL, 0, NULL, "", true, false, 0, 0};
+	struct logfile_info name = { s, check, NULL, 0, NULL, "", true, false, 0, 0, NULL, NULL};
+#define BINARY_LOGFILE(name, s, extension, header) \
+	struct logfile_info name = { s, true, NULL, 0, NULL, "", true, false, 0, 0, extension, header};
 #else
 #define LOGFILE(name, s, check) \
 	extern struct logfile_info name;
+#define BINARY_LOGFILE(name, s, extension, header) \
+	extern struct logfile_info name;
 #endif
 LOGFILE(calldebug_lfi, "calldebug", true);
 LOGFILE(message_lfi, "messages", true);
 LOGFILE(shortmessage_lfi, "shortmessages", true);
 LOGFILE(log_lfi, "logs", true);
 LOGFILE(error_lfi, "errors", false);
+BINARY_LOGFILE(pcapng_lfi, "messages", ".pcapng", pcapng_header);
 
 void rotate_logfile();
 void rotate_shortmessagef();
 void rotate_errorf();
 void rotate_messagef();
 void rotate_calldebugf();
+void rotate_pcapngf();
 
 /* Screen/Statistics Printing Functions. */
 void print_statistics(int last);
@@ -97,6 +116,14 @@ extern "C" {
     int TRACE_CALLDEBUG(const char *fmt, ...);
     int TRACE_SHORTMSG(const char *fmt, ...);
     int LOG_MSG(const char *fmt, ...);
+    /* Queue a binary record of len bytes: fill in the buffer returned by
+     * trace_reserve(), which is NULL when the record has to be dropped,
+     * then hand it to the logger thread with trace_commit(). */
+    char *trace_reserve(size_t len);
+    void trace_commit(struct logfile_info *lfi, size_t len);
+    void TRACE_PCAPNG(const struct timeval *when, const struct sockaddr_storage *from,
+                      const struct sockaddr_storage *to, bool stream, unsigned int seq,
+                      const char *msg, size_t len);
     /*
 #ifdef __cplusplus
 }
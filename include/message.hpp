@@ -108,6 +108,10 @@ public:
     bool isAck();
     bool isCancel();
 
+    /* Fold keywords whose value can no longer change into the literals. */
+    void compile();
+    bool isCompiled();
+
     static void parseAuthenticationKeyword(scenario *msg_scenario, struct MessageComponent *dst, char *keyword);
     static void freeMessageComponent(struct MessageComponent *comp);
 private:
@@ -119,9 +123,13 @@ private:
     bool ack;
     bool cancel;
     bool response;
+    bool compiled;
 
     scenario *msg_scenario;
 
+    static bool getConstantValue(struct MessageComponent *comp, char *buf, int size);
+    static void appendLiteral(struct MessageComponent *dst, const char *src, int len);
+
     // Get parameters from a [keyword]
     static void getQuotedParam(char * dest, char * src, int * len);
     static void getHexStringParam(char * dest, char * src, int * len);
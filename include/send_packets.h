@@ -111,9 +111,15 @@ inline void float2timer (float time, struct timeval *tvp);
 typedef struct {
     /* pointer to a RTP pkts container */
     pcap_pkts *pcap;
-    /* Used in send_packets thread */
+    /* Used by the media threads */
     struct sockaddr_storage to;
     struct sockaddr_storage from;
+    /* Playback state, owned by the media thread while playing */
+    struct pcap_player *player;
+    pcap_pkt *next;
+    unsigned long long due_us;
+    struct timeval last;
+    int heap_index;
 } play_args_t;
 
 #ifdef __cplusplus
@@ -121,7 +127,10 @@ extern "C"
 {
 #endif
     int parse_play_args (char *, pcap_pkts *);
-    int send_packets (play_args_t *);
+    /* Play the pcap from the start on one of the media threads. */
+    void start_packets (play_args_t *);
+    /* Stop playing; the media threads are done with play_args on return. */
+    void stop_packets (play_args_t *);
 #ifdef __cplusplus
 }
 #endif
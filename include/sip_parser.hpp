@@ -23,9 +23,67 @@
 #ifndef __SIPP_SIP_PARSER_H__
 #define __SIPP_SIP_PARSER_H__
 
+#include <stddef.h>
+
 #define MAX_HEADER_LEN 2049
 
-char * get_header_content(const char * message, const char * name);
-char * get_header(const char * message, const char * name, bool content);
-char * get_first_line(const char * message);
+/* Room for any header get_header() can return, repeated headers joined. */
+#define MAX_HEADER_BUF (MAX_HEADER_LEN * 10)
+
+/* These are reentrant: results are written to the caller's buffer of size
+ * bytes, truncated if need be, and the buffer is returned. */
+char * get_header_content(const char * message, const char * name, char *buf, size_t size);
+char * get_header(const char * message, const char * name, bool content, char *buf, size_t size);
+char * get_first_line(const char * message, char *buf, size_t size);
+char * get_call_id(const char *msg, char *call_id, size_t size);
+/* Returns NULL if the To header has no tag. */
+char * get_peer_tag(const char *msg, char *tag, size_t size);
+
+/* Headers that the message index recognizes in both long and compact form. */
+enum sip_header_id {
+    SIP_HDR_OTHER = 0,
+    SIP_HDR_CALL_ID,
+    SIP_HDR_CONTACT,
+    SIP_HDR_CONTENT_ENCODING,
+    SIP_HDR_CONTENT_LENGTH,
+    SIP_HDR_CONTENT_TYPE,
+    SIP_HDR_FROM,
+    SIP_HDR_TO,
+    SIP_HDR_VIA,
+    SIP_HDR_CSEQ,
+    SIP_HDR_COUNT
+};
+
+#define SIP_INDEX_MAX_HEADERS 64
+
+struct sip_header_ref {
+    const char *name;         /* Start of the header line. */
+    const char *end;          /* The '\n' ending it, folded lines included. */
+    unsigned short name_len;  /* Up to and including the colon. */
+    unsigned char id;
+    signed char next;         /* Next header with the same id, or -1. */
+};
+
+/* Offsets of the headers of a received message, built in a single pass so
+ * that header lookups neither rescan nor copy the whole message. */
+struct sip_msg_index {
+    const char *msg;
+    const char *body;         /* After the empty line, NULL if none. */
+    bool complete;            /* All of the headers were indexed. */
+    bool body_headers;        /* The body has header-like lines. */
+    int nb_headers;
+    signed char first[SIP_HDR_COUNT];
+    struct sip_header_ref headers[SIP_INDEX_MAX_HEADERS];
+};
+
+/* Index msg.  Returns false if it can not be fully indexed (too many
+ * headers, or a body carrying header-like lines such as a multipart or
+ * sipfrag body), in which case lookups fall back to scanning. */
+bool sip_index_message(struct sip_msg_index *index, const char *msg);
+/* Answer get_header() and get_call_id() from index when they are passed
+ * index->msg.  Returns the previous index, NULL clears it. */
+struct sip_msg_index *set_indexed_message(struct sip_msg_index *index);
+/* Content of the first header called name (colon included), without
+ * leading blanks or the line ending, as a view into the message. */
+const char *sip_index_header(const struct sip_msg_index *index, const char *name, size_t *len);
 #endif /* __SIPP_SIP_PARSER_H__ */
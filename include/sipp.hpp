@@ -142,6 +142,10 @@
 
 #define MAX_RECV_LOOPS_PER_CYCLE   1000
 #define MAX_SCHED_LOOPS_PER_CYCLE  1000
+#define MAX_RECV_BATCH             256
+#define MAX_SEND_BATCH             1024
+#define MAX_REUSEPORT_SOCKETS      64
+#define DEFAULT_CALL_POOL          256
 #define NB_UPDATE_PER_CYCLE        1
 
 #define MAX_PATH                   250
@@ -180,7 +184,11 @@ cmd messages are received */
 #define DEFAULT_MIN_RTP_PORT         8192
 #define DEFAULT_MAX_RTP_PORT         65535
 #define DEFAULT_RTP_PAYLOAD          8
-#define DEFAULT_RTP_THREADTASKS      20
+#define DEFAULT_RTP_THREADTASKS      1000
+#endif
+
+#ifdef PCAPPLAY
+#define DEFAULT_PCAP_THREADS         4
 #endif
 
 /************ User controls and command line options ***********/
@@ -212,6 +220,7 @@ extern int                compression             _DEFVAL(0);
 extern int                peripsocket             _DEFVAL(0);
 extern int                peripfield              _DEFVAL(0);
 extern bool               bind_local              _DEFVAL(false);
+extern int                reuseport_sockets       _DEFVAL(1);
 extern void             * monosocket_comp_state   _DEFVAL(0);
 extern const char       * service                 _DEFVAL(DEFAULT_SERVICE);
 extern const char       * auth_password           _DEFVAL(DEFAULT_AUTH_PASSWORD);
@@ -227,6 +236,7 @@ extern bool               timeout_error           _DEFVAL(false);
 
 extern unsigned long      report_freq_dumpRtt     _DEFVAL
 (DEFAULT_FREQ_DUMP_RTT);
+extern bool               rtt_binary              _DEFVAL(false);
 
 extern unsigned		  max_multi_socket        _DEFVAL
 (DEFAULT_MAX_MULTI_SOCKET);
@@ -235,6 +245,15 @@ extern bool		  skip_rlimit		  _DEFVAL(false);
 extern unsigned int       timer_resolution        _DEFVAL(DEFAULT_TIMER_RESOLUTION);
 extern int                max_recv_loops          _DEFVAL(MAX_RECV_LOOPS_PER_CYCLE);
 extern int                max_sched_loops         _DEFVAL(MAX_SCHED_LOOPS_PER_CYCLE);
+extern int                recv_batch              _DEFVAL(1);
+extern int                send_batch              _DEFVAL(1);
+extern int                call_pool_size          _DEFVAL(DEFAULT_CALL_POOL);
+extern int                rate_max_burst          _DEFVAL(0);
+extern char               *arrivals               _DEFVAL(NULL);
+extern char               *arrival_trace_file     _DEFVAL(NULL);
+/* Set once the sockets and media ports are final; from then on messages
+ * fold keywords such as [local_ip] into their literal text. */
+extern bool               compile_messages        _DEFVAL(false);
 
 extern unsigned int       global_t2               _DEFVAL(DEFAULT_T2_TIMER_VALUE);
 
@@ -257,6 +276,9 @@ extern int                tcp_readsize            _DEFVAL(65535);
 #if defined(PCAPPLAY) || defined(RTP_STREAM)
 extern int                hasMedia                _DEFVAL(0);
 #endif
+#ifdef PCAPPLAY
+extern int                pcap_play_threads       _DEFVAL(DEFAULT_PCAP_THREADS);
+#endif
 #ifdef RTP_STREAM
 extern int                min_rtp_port            _DEFVAL(DEFAULT_MIN_RTP_PORT);
 extern int                max_rtp_port            _DEFVAL(DEFAULT_MAX_RTP_PORT);
@@ -347,6 +369,7 @@ extern int	sipp_bind_socket(struct sipp_socket *socket, struct sockaddr_storage
 extern int	sipp_connect_socket(struct sipp_socket *socket, struct sockaddr_storage *dest);
 extern int      sipp_reconnect_socket(struct sipp_socket *socket);
 extern void	sipp_customize_socket(struct sipp_socket *socket);
+extern void	sipp_reuseport_socket(struct sipp_socket *socket);
 extern int      delete_socket(int P_socket);
 extern int      min_socket          _DEFVAL(65535);
 extern int      select_socket       _DEFVAL(0);
@@ -362,6 +385,23 @@ extern unsigned long last_report_calls            _DEFVAL(0);
 extern unsigned long nb_net_send_errors           _DEFVAL(0);
 extern unsigned long nb_net_cong                  _DEFVAL(0);
 extern unsigned long nb_net_recv_errors           _DEFVAL(0);
+extern unsigned long recv_batches                 _DEFVAL(0);
+extern unsigned long recv_batch_msgs              _DEFVAL(0);
+extern unsigned long send_batches                 _DEFVAL(0);
+extern unsigned long send_batch_msgs              _DEFVAL(0);
+extern unsigned long socketbuf_pool_hits          _DEFVAL(0);
+extern unsigned long socketbuf_pool_misses        _DEFVAL(0);
+extern unsigned long call_arena_mallocs           _DEFVAL(0);
+extern unsigned long call_arena_calls             _DEFVAL(0);
+extern unsigned long call_pool_hits               _DEFVAL(0);
+extern unsigned long call_pool_misses             _DEFVAL(0);
+/* Gaps between call starts, and how far they were from the rate's. */
+extern unsigned long pacing_intervals             _DEFVAL(0);
+extern unsigned long long pacing_jitter_sum_us    _DEFVAL(0);
+extern unsigned long long pacing_jitter_max_us    _DEFVAL(0);
+/* Calls due by the arrival process, and those actually started. */
+extern unsigned long arrivals_offered             _DEFVAL(0);
+extern unsigned long arrivals_started             _DEFVAL(0);
 extern bool          cpu_max                      _DEFVAL(false);
 extern bool          outbound_congestion          _DEFVAL(false);
 extern int           open_calls_user_setting      _DEFVAL(0);
@@ -377,9 +417,11 @@ extern unsigned long rtp2_pckts_pcap              _DEFVAL(0);
 extern unsigned long rtp2_bytes_pcap              _DEFVAL(0);
 #ifdef RTP_STREAM
 extern volatile unsigned long rtpstream_numthreads _DEFVAL(0);
-extern volatile unsigned long rtpstream_bytes_in  _DEFVAL(0);
-extern volatile unsigned long rtpstream_bytes_out _DEFVAL(0);
-extern volatile unsigned long rtpstream_pckts     _DEFVAL(0);
+extern unsigned long rtpstream_bytes_in           _DEFVAL(0);
+extern unsigned long rtpstream_bytes_out          _DEFVAL(0);
+extern unsigned long rtpstream_pckts              _DEFVAL(0);
+extern unsigned long rtpstream_pckts_in           _DEFVAL(0);
+extern unsigned long rtpstream_calls_no_rtp_in    _DEFVAL(0);
 #endif
 
 
@@ -479,7 +521,6 @@ enum E_Alter_YesNo {
 /********************* Mini-Parser Routines *******************/
 
 int get_method(char *msg);
-char * get_peer_tag(char *msg);
 unsigned long int get_cseq_value(char *msg);
 unsigned long get_reply_code(char *msg);
 
@@ -42,7 +42,7 @@ void buffer_read(struct sipp_socket *socket, struct socketbuf *newbuf);
 int read_error(struct sipp_socket *socket, int ret);
 struct socketbuf *alloc_socketbuf(char *buffer, size_t size, int copy, struct sockaddr_storage *dest);
 ssize_t read_message(struct sipp_socket *socket, char *buf, size_t len, struct sockaddr_storage *src);
-int empty_socket(struct sipp_socket *socket);
+int empty_socket(struct sipp_socket *socket, int *budget = NULL);
 
 struct sipp_socket *sipp_allocate_socket(bool use_ipv6, int transport, int fd, int accepting);
 
@@ -67,10 +67,18 @@ int send_message_tls(SSL *s, void ** comp_state, char * msg);
 #endif
 
 /* Socket Buffer Management. */
+/* recvmmsg(2) and sendmmsg(2) came with MSG_WAITFORONE. */
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_MMSG
+#endif
+
 #define NO_COPY 0
 #define DO_COPY 1
 struct socketbuf *alloc_socketbuf(char *buffer, size_t size, int copy);
 void free_socketbuf(struct socketbuf *socketbuf);
+/* Data for socketbufs, recycled for the common sizes. */
+char *alloc_socketbuf_data(size_t size, size_t *allocated);
+void free_socketbuf_data(char *buf, size_t allocated);
 
 /* These buffers lets us read past the end of the message, and then split it if
  * required.  This eliminates the need for reading a message octet by octet and
@@ -79,10 +87,27 @@ struct socketbuf {
     char *buf;
     size_t len;
     size_t offset;
+    size_t size; /* Bytes allocated for buf. */
     struct sockaddr_storage addr;
     struct socketbuf *next;
 };
 
+/* Where the search for the end of the first message in a stream socket's
+ * buffer got to, so that each read only scans the new bytes. */
+struct sip_framer {
+    size_t scanned; /* Bytes scanned, from the start of the message. */
+    size_t header_len; /* Headers and blank line, 0 until found. */
+    size_t content_length;
+    bool has_content_length;
+};
+
+/* Returned by sip_framer_scan() when the stream can not be framed: a
+ * Content-Length above SIPP_MAX_MSG_SIZE, or two that disagree. */
+#define SIP_FRAMER_ERROR ((size_t)-1)
+
+void sip_framer_reset(struct sip_framer *framer);
+size_t sip_framer_scan(struct sip_framer *framer, const char *buf, size_t len, bool control);
+
 #ifdef USE_SCTP
 #define SCTP_DOWN 0
 #define SCTP_CONNECTING 1
@@ -107,6 +132,7 @@ struct sipp_socket {
 #endif
     struct sockaddr_storage ss_remote_sockaddr; /* Who we are talking to. */
     struct sockaddr_storage ss_dest; /* Who we are talking to. */
+    char ss_server_ip[INET6_ADDRSTRLEN]; /* Our address for [server_ip], empty until needed. */
 
 
     int ss_pollidx; /* The index of this socket in our poll structures. */
@@ -115,7 +141,12 @@ struct sipp_socket {
 
     struct socketbuf *ss_in; /* Buffered input. */
     size_t ss_msglen;	/* Is there a complete SIP message waiting, and if so how big? */
+    struct sip_framer ss_framer; /* How far we looked for the message's end. */
     struct socketbuf *ss_out; /* Buffered output. */
+
+    struct sockaddr_storage ss_pcap_local; /* Our address, looked up by -trace_pcapng. */
+    struct sockaddr_storage ss_pcap_peer; /* The peer of a stream socket, likewise. */
+    unsigned int ss_pcap_seq[2]; /* Synthetic TCP sequence numbers, received and sent. */
 #ifdef USE_SCTP
     int sctpstate;
 #endif
@@ -123,6 +154,8 @@ struct sipp_socket {
 
 /* Write data to a socket. */
 int write_socket(struct sipp_socket *socket, const char *buffer, ssize_t len, int flags, struct sockaddr_storage *dest);
+/* Send the UDP datagrams queued by write_socket() with -send_batch. */
+void flush_send_queue();
 /* Mark a socket as "bad". */
 void sipp_socket_invalidate(struct sipp_socket *socket);
 /* Abort a connection - close the socket quickly. */
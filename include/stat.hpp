@@ -29,6 +29,12 @@
 #define DEFAULT_FILE_NAME (char*)"dumpFile"
 #define DEFAULT_EXTENSION (char*)".csv"
 
+#define RTT_RING_MIN_SIZE    65536
+#define RTT_RING_MAX_SIZE    (1 << 24)
+#define RTT_WRITE_BLOCK_SIZE 65536
+#define RTT_MAX_LINE_SIZE    512
+#define RTT_WRITER_SLEEP_US  10000
+
 #define MAX_CHAR_BUFFER_SIZE          1024
 
 #include <ctime>
@@ -39,6 +45,7 @@
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
+#include <pthread.h>
 
 #ifdef HAVE_GSL
 #include <gsl/gsl_rng.h>
@@ -50,6 +57,111 @@
 
 using namespace std;
 
+/*
+__________________________________________________________________________
+
+              C T h r e a d C o u n t e r s    C L A S S
+__________________________________________________________________________
+*/
+
+/**
+ * Counters that any thread may bump: the global event counters, which
+ * WARNING() and ERROR() raise from the media and writer threads too, and
+ * the RTP traffic counters. Each thread adds to its own cache line
+ * aligned block with plain stores; CStat::foldThreadCounters() collects
+ * what every block gained since the previous fold on each report.
+ */
+class CThreadCounters
+{
+public:
+    enum E_Counter {
+        TC_OUT_OF_CALL_MSGS,
+        TC_DEAD_CALL_MSGS,
+        TC_FATAL_ERRORS,
+        TC_WARNINGS,
+        TC_WATCHDOG_MAJOR,
+        TC_WATCHDOG_MINOR,
+        TC_AUTO_ANSWERED,
+        TC_RTP_PCKTS,
+        TC_RTP_BYTES,
+        TC_RTP2_PCKTS,
+        TC_RTP2_BYTES,
+        TC_RTP_PCKTS_PCAP,
+        TC_RTP_BYTES_PCAP,
+        TC_RTPSTREAM_PCKTS,
+        TC_RTPSTREAM_BYTES_OUT,
+        TC_RTPSTREAM_PCKTS_IN,
+        TC_RTPSTREAM_BYTES_IN,
+        TC_RTPSTREAM_CALLS_NO_RTP_IN,
+        TC_NB_COUNTERS
+    };
+
+    static void add(E_Counter P_counter, unsigned long long P_value = 1) {
+        CThreadCounters *L_mine = M_mine ? M_mine : attach();
+        /* Only this thread writes the block, the folding thread reads it. */
+        __atomic_store_n(&L_mine->M_counters[P_counter],
+                         L_mine->M_counters[P_counter] + P_value, __ATOMIC_RELAXED);
+    }
+
+    /* Add to P_delta what every block gained since the previous fold. */
+    static void fold(unsigned long long P_delta[TC_NB_COUNTERS]);
+
+private:
+    static CThreadCounters *attach();
+
+    static __thread CThreadCounters *M_mine;
+    static CThreadCounters *M_blocks;
+    static pthread_mutex_t M_blocksLock;
+
+    unsigned long long M_counters[TC_NB_COUNTERS];
+    unsigned long long M_folded[TC_NB_COUNTERS];
+    CThreadCounters *M_next;
+} __attribute__((aligned(64)));
+
+/*
+__________________________________________________________________________
+
+              C H i s t o g r a m    C L A S S
+__________________________________________________________________________
+*/
+
+/**
+ * A log-linear histogram in the style of HdrHistogram. Values below
+ * 2^HIST_SUB_BITS are counted exactly; above that, every power of two is
+ * split into 2^(HIST_SUB_BITS - 1) buckets, so a value is known to within
+ * 1/64th of itself. Recording is a few bit operations and a percentile
+ * query walks a fixed number of buckets, however many values were seen.
+ * Histograms of the same shape can be added together.
+ */
+#define HIST_SUB_BITS 7
+#define HIST_MAX_BITS 40 /* larger values are counted as 2^40 - 1 */
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) * HIST_HALF)
+
+class CHistogram
+{
+public:
+    CHistogram();
+
+    void record(unsigned long long value);
+    void add(const CHistogram &other);
+    void reset();
+
+    unsigned long long count() const {
+        return M_total;
+    }
+    /* The largest value, within the bucket precision, that the given
+     * percentage of the recorded values do not exceed (0 if empty). */
+    unsigned long long percentile(double percent) const;
+
+    static int bucketOf(unsigned long long value);
+    static unsigned long long highestInBucket(int bucket);
+
+private:
+    unsigned long long M_counts[HIST_BUCKETS];
+    unsigned long long M_total;
+};
+
 /*
 __________________________________________________________________________
 
@@ -78,10 +190,16 @@ public:
         unsigned long nbInThisBorder;
     } T_dynamicalRepartition;
 
+    /**
+     * One -trace_rtt sample. This is also the record layout of the
+     * binary (-rtt_binary) file, written in host byte order after a
+     * header made of the "SIPPRTT1" magic, the number of RTDs and, for
+     * each RTD, its name length followed by the name (32 bit lengths).
+     */
     typedef struct _T_value_rtt {
-        double  date ;
+        unsigned long long date_us ;
+        unsigned int  rtt_us ;
         int  rtd_no ;
-        double  rtt  ;
     } T_value_rtt, *T_pValue_rtt ;
 
     /**
@@ -303,6 +421,13 @@ public:
     /* This works for global counters and does not require an instance. */
     static int globalStat (E_Action P_action);
 
+    /* Move what CThreadCounters gathered into the global counters and the
+     * RTP totals; called before each report. Once setFoldThread() has been
+     * called, only that thread folds: a report made by another thread, as
+     * on an ERROR() from a media thread, shows the last fold. */
+    static void foldThreadCounters();
+    static void setFoldThread();
+
     /**
      * ComputeRtt Methods are used to calculate the response time
      */
@@ -354,7 +479,8 @@ public:
     /* define the file name to use to dump statistic in file */
     void setFileName                (char * name);
     void setFileName                (char * name, char * extension);
-    void initRtt             (char * name, char * extension, unsigned long P_value);
+    void initRtt             (char * name, char * extension, unsigned long P_value,
+                              bool P_binary = false);
 
     /**
      * Display data periodically updated on screen.
@@ -421,6 +547,8 @@ public:
 private:
     unsigned long long       M_counters[E_NB_COUNTER];
     static unsigned long long M_G_counters[E_NB_G_COUNTER - E_NB_COUNTER];
+    static pthread_t M_foldThread;
+    static bool M_foldThreadSet;
 
 #define GENERIC_C 0
 #define GENERIC_PD 1
@@ -443,6 +571,11 @@ private:
     str_int_map		   M_rtdMap;
     int_str_map		   M_revRtdMap;
 
+    /* Response times in microseconds, GENERIC_TYPES per RTD, and call
+     * lengths, for the percentiles. */
+    vector<CHistogram>	   M_rtdHistograms;
+    CHistogram		   M_callLengthHistograms[GENERIC_TYPES];
+
     T_dynamicalRepartition** M_ResponseTimeRepartition;
     T_dynamicalRepartition*  M_CallLengthRepartition;
     int                      M_SizeOfResponseTimeRepartition;
@@ -455,15 +588,36 @@ private:
     char*                    M_fileName;
     ofstream*                M_outputStream;
 
-    bool                     M_headerAlreadyDisplayedRtt ;
     char*                    M_fileNameRtt               ;
-    ofstream*                M_outputStreamRtt           ;
+    int                      M_fdRtt                     ;
+    bool                     M_binaryRtt                 ;
     double                   M_time_ref                  ;
-
-    T_pValue_rtt             M_dumpRespTime              ;
-    unsigned int             M_counterDumpRespTime       ;
     unsigned long            M_report_freq_dumpRtt       ;
 
+    /* The response times are queued by the scheduler in a single
+     * producer / single consumer ring and written to M_fileNameRtt in
+     * large blocks by M_rttWriter, so that -trace_rtt never blocks call
+     * processing on a write(); samples are dropped when the ring is
+     * full. */
+    T_pValue_rtt             M_rttRing                   ;
+    unsigned int             M_rttMask                   ;
+    unsigned int             M_rttHead                   ;
+    unsigned int             M_rttTail                   ;
+    int                      M_rttFlush                  ;
+    int                      M_rttStop                   ;
+    unsigned long long       M_rttDropped                ;
+    bool                     M_rttWriterStarted          ;
+    pthread_t                M_rttWriter                 ;
+    vector<string>           M_rttNames                  ;
+
+    static void* rttWriterThread(void* P_stat);
+    void runRttWriter();
+    void writeRttHeader();
+    void writeRttSamples(unsigned int P_head, unsigned int P_tail);
+    void writeRttBlock(const char* P_block, size_t P_len);
+    void startRttWriter();
+    void stopRttWriter();
+
     /**
      * initRepartition
      * This methode is used to create the repartition table with a table of
@@ -567,6 +721,14 @@ private:
     double computeRtdMean(int which, int type);
     double computeRtdStdev(int which, int type);
 
+    /**
+     * sPercentiles
+     * Formats the screen percentiles of a histogram of microseconds
+     * as milliseconds, "p50/p99/p99.9".
+     */
+    static char* sPercentiles(char *buf, const CHistogram &histogram);
+    void displayPercentiles(FILE *f, const CHistogram &histogram);
+
     /**
      * Effective C++
      *
@@ -634,6 +796,23 @@ private:
     double min, max;
 };
 
+/* Exponential distribution, also used for Poisson call arrivals.  Without
+ * GSL it is sampled by inverting its CDF. */
+class CExponential : public CSample
+{
+public:
+    CExponential(double mean);
+    double sample();
+    int textDescr(char *s, int len);
+    int timeDescr(char *s, int len);
+    double cdfInv(double percentile);
+private:
+    double mean;
+#ifdef HAVE_GSL
+    gsl_rng *rng;
+#endif
+};
+
 #ifdef HAVE_GSL
 /* Normal distribution. */
 class CNormal : public CSample
@@ -660,20 +839,6 @@ public:
     double cdfInv(double percentile);
 };
 
-/* Exponential distribution. */
-class CExponential : public CSample
-{
-public:
-    CExponential(double mean);
-    double sample();
-    int textDescr(char *s, int len);
-    int timeDescr(char *s, int len);
-    double cdfInv(double percentile);
-private:
-    double mean;
-    gsl_rng *rng;
-};
-
 /* Weibull distribution. */
 class CWeibull : public CSample
 {
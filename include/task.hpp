@@ -20,8 +20,6 @@
 #ifndef __TASK__
 #define __TASK__
 
-#include <map>
-#include <list>
 #include <sys/types.h>
 #include <string.h>
 
@@ -29,7 +27,75 @@
  * that is referenced from call. */
 class task;
 
-typedef std::list<task *> task_list;
+/* Tasks are kept on intrusive lists: each task embeds the hooks that link
+ * it into the list of all tasks and into either the run queue or a slot of
+ * the timing wheel.  Pausing, waking and expiring a task only relinks its
+ * hooks and never touches the allocator. */
+struct task_hook {
+    struct task_hook *next;
+    struct task_hook *prev;
+    task *owner;
+};
+
+/* A circular doubly-linked list of task hooks with a sentinel head. */
+class task_list
+{
+public:
+    class iterator
+    {
+    public:
+        iterator(struct task_hook *hook = NULL) : hook(hook) {}
+        task *operator*() const {
+            return hook->owner;
+        }
+        iterator &operator++() {
+            hook = hook->next;
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator old = *this;
+            hook = hook->next;
+            return old;
+        }
+        bool operator==(const iterator &other) const {
+            return hook == other.hook;
+        }
+        bool operator!=(const iterator &other) const {
+            return hook != other.hook;
+        }
+    private:
+        struct task_hook *hook;
+    };
+
+    task_list();
+
+    iterator begin() {
+        return iterator(head.next);
+    }
+    iterator end() {
+        return iterator(&head);
+    }
+    bool empty() const {
+        return head.next == &head;
+    }
+    int size() const {
+        return count;
+    }
+    void push_back(struct task_hook *hook);
+    void erase(struct task_hook *hook);
+    /* Unlink and return the first task, or NULL if we are empty. */
+    task *pop_front();
+    /* Move all of our tasks to the end of dest. */
+    void move_to(task_list *dest);
+
+private:
+    struct task_hook head;
+    int count;
+
+    /* The head is linked into the tasks, so lists can not be copied. */
+    task_list(const task_list &);
+    task_list &operator=(const task_list &);
+};
 
 /* This arrangement of wheels lets us support up to 32 bit timers.
  *
@@ -110,17 +176,20 @@ private:
     void recalculate_wheel();
 
     /* This is for our complete task list. */
-    task_list::iterator taskit;
-    /* If we are running, the iterator to remove us from the running list. */
-    task_list::iterator runit;
-    /* If we are paused, the iterator to remove us from the paused list. */
-    task_list::iterator pauseit;
+    struct task_hook taskhook;
+    /* Links us into the running list, or into a timing wheel slot when
+     * paused; a task is never on both. */
+    struct task_hook queuehook;
     /* The list that we are stored in (only when paused) . */
     task_list *pauselist;
     /* The timing wheel is our friend so that it can update our list pointer. */
     friend class timewheel;
 };
 
+/* Hash of a Call-ID, the key of the call table. */
+unsigned int call_id_hash(const char *call_id);
+unsigned int call_id_hash(const char *call_id, size_t len);
+
 task_list * get_running_tasks();
 int expire_paused_tasks();
 int paused_tasks_count();
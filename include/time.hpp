@@ -23,6 +23,7 @@
 
 extern unsigned long getmilliseconds();
 extern unsigned long long getmicroseconds();
+extern unsigned long long getprecisemicroseconds();
 void sipp_usleep(unsigned long usec);
 
 #endif /* __SIPP_TIME_H__ */
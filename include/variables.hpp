@@ -35,6 +35,8 @@ typedef std::map<int, int> int_int_map;
 
 #define BUFFER_SIZE 512
 #define MAX_MATCHING_EXPR 50
+/* Matched values up to this length are kept inside the variable. */
+#define VAR_INLINE_SIZE 64
 #define REGEXP_PARAMS REG_EXTENDED
 
 enum T_VarType {
@@ -54,9 +56,8 @@ public:
     bool isRegExp();
     bool isString();
 
-    // WARNING : setMatchingValue does't allocate the memory for the matching value
-    // but the destructor free the memory
-    void setMatchingValue(char* P_matchingValue);
+    /* Copy len bytes of a regular expression match into the variable. */
+    void setMatchingValue(const char *P_matchingValue, size_t len);
     char* getMatchingValue();
 
     /* When the variable is used for a string, these functions should be called. */
@@ -80,21 +81,29 @@ public:
     CCallVariable();
     ~CCallVariable();
 
+    /* Move the value of another variable into this unset one. */
+    void take(CCallVariable *other);
+
 private:
     T_VarType	M_type;
-    char*		M_matchingValue;
+    char*		M_matchingValue; /* M_matchingInline, or allocated with new[]. */
+    size_t	M_matchingSize; /* Bytes allocated for M_matchingValue, 0 if inline. */
     int		M_nbOfMatchingValue;
     double	M_double;
     char*		M_stringValue;
     bool		M_bool;
+    char		M_matchingInline[VAR_INLINE_SIZE];
 };
 
 class AllocVariableTable;
+class call_arena;
 
 class VariableTable
 {
 public:
-    VariableTable(VariableTable *parent, int size);
+    /* With an arena, the table lives in it and is not deleted but destroyed
+     * in place when the last reference goes. */
+    VariableTable(VariableTable *parent, int size, call_arena *arena = NULL);
     VariableTable(AllocVariableTable *src);
     VariableTable *getTable();
     void putTable();
@@ -106,8 +115,9 @@ protected:
     void expand(int size);
     int count;
     int level;
-    CCallVariable **variableTable;
+    CCallVariable *variableTable;
     VariableTable *parent;
+    call_arena *arena;
 };
 
 class AllocVariableTable : public VariableTable
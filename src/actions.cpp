@@ -401,7 +401,6 @@ int CAction::executeRegExp(char* P_string, VariableTable *P_callVarTable)
     regmatch_t pmatch[10];
     int error;
     int nbOfMatch = 0;
-    char* result = NULL ;
 
     if (!M_regExpSet) {
         ERROR("Trying to perform regular expression match on action that does not have one!");
@@ -420,8 +419,7 @@ int CAction::executeRegExp(char* P_string, VariableTable *P_callVarTable)
         for(int i = 0; i <= getNbSubVarId(); i++) {
             if(pmatch[i].rm_eo == -1) break ;
 
-            setSubString(&result, P_string, pmatch[i].rm_so, pmatch[i].rm_eo);
-            L_callVar->setMatchingValue(result);
+            L_callVar->setMatchingValue(P_string + pmatch[i].rm_so, pmatch[i].rm_eo - pmatch[i].rm_so);
 
             if (i == getNbSubVarId())
                 break ;
@@ -432,24 +430,6 @@ int CAction::executeRegExp(char* P_string, VariableTable *P_callVarTable)
     return(nbOfMatch);
 }
 
-void CAction::setSubString(char** P_target, char* P_source, int P_start, int P_stop)
-{
-    int sizeOf;
-
-    if(P_source != NULL) {
-        sizeOf = P_stop - P_start;
-        (*P_target) = new char[sizeOf + 1];
-
-        if (sizeOf > 0) {
-            memcpy((*P_target), &(P_source[P_start]), sizeOf);
-        }
-
-        (*P_target)[sizeOf] = '\0';
-    } else {
-        *P_target = NULL ;
-    }
-}
-
 
 #ifdef PCAPPLAY
 void CAction::setPcapArgs (pcap_pkts  *  P_value)
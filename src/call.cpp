@@ -39,6 +39,7 @@
  */
 
 #include <iterator>
+#include <new>
 #include <algorithm>
 #include <fstream>
 #include <iostream>
@@ -57,10 +58,6 @@
 
 extern  map<string, struct sipp_socket *>     map_perip_fd;
 
-#ifdef PCAPPLAY
-/* send_packets pthread wrapper */
-void *send_wrapper(void *);
-#endif
 int call::dynamicId       = 0;
 int call::maxDynamicId    = 10000+2000*4;      // FIXME both param to be in command line !!!!
 int call::startDynamicId  = 10000;             // FIXME both param to be in command line !!!!
@@ -379,16 +376,17 @@ unsigned long call::hash(const char * msg)
     } else if (rtcheck == RTCHECK_LOOSE) {
         /* Based on section 11.5 (bullet 2) of RFC2543 we only take into account
          * the To, From, Call-ID, and CSeq values. */
-        const char *hdr = get_header_content(msg,"To:");
+        char hdr_buf[MAX_HEADER_BUF];
+        const char *hdr = get_header_content(msg, "To:", hdr_buf, sizeof(hdr_buf));
         while ((c = *hdr++))
             hash = c + (hash << 6) + (hash << 16) - hash;
-        hdr = get_header_content(msg,"From:");
+        hdr = get_header_content(msg, "From:", hdr_buf, sizeof(hdr_buf));
         while ((c = *hdr++))
             hash = c + (hash << 6) + (hash << 16) - hash;
-        hdr = get_header_content(msg,"Call-ID:");
+        hdr = get_header_content(msg, "Call-ID:", hdr_buf, sizeof(hdr_buf));
         while ((c = *hdr++))
             hash = c + (hash << 6) + (hash << 16) - hash;
-        hdr = get_header_content(msg,"CSeq:");
+        hdr = get_header_content(msg, "CSeq:", hdr_buf, sizeof(hdr_buf));
         while ((c = *hdr++))
             hash = c + (hash << 6) + (hash << 16) - hash;
         /* For responses, we should also consider the code and body (if any),
@@ -413,7 +411,170 @@ unsigned long call::hash(const char * msg)
     return hash;
 }
 
+/******************* Per-call memory arena ********************/
+
+/* Blocks are aligned for any type and preceded by their usable size. */
+#define ARENA_ALIGN(n) (((n) + 15) & ~(size_t)15)
+#define ARENA_HEADER ARENA_ALIGN(sizeof(size_t))
+#define ARENA_CHUNK_HEADER ARENA_ALIGN(sizeof(struct chunk))
+
+struct call_arena::chunk *call_arena::free_chunks = NULL;
+int call_arena::nb_free_chunks = 0;
+
+call_arena::call_arena()
+{
+    chunks_used = 0;
+    mallocs = 0;
+    chunks = NULL;
+}
+
+call_arena::~call_arena()
+{
+    while (chunks) {
+        struct chunk *next = chunks->next;
+        if (chunks->size == CALL_ARENA_CHUNK && nb_free_chunks < call_pool_size) {
+            chunks->next = free_chunks;
+            free_chunks = chunks;
+            nb_free_chunks++;
+        } else {
+            free(chunks);
+        }
+        chunks = next;
+    }
+}
+
+void call_arena::prewarm(int count)
+{
+    while (nb_free_chunks < count) {
+        struct chunk *c = (struct chunk *)malloc(CALL_ARENA_CHUNK);
+        if (!c) {
+            ERROR("Could not allocate %d bytes for call state!", CALL_ARENA_CHUNK);
+        }
+        c->size = CALL_ARENA_CHUNK;
+        c->next = free_chunks;
+        free_chunks = c;
+        nb_free_chunks++;
+    }
+}
+
+void *call_arena::alloc(size_t size)
+{
+    size = ARENA_ALIGN(size);
+    struct chunk *c = chunks;
+
+    if (!c || c->size - c->used < ARENA_HEADER + size) {
+        size_t chunk_size = ARENA_CHUNK_HEADER + ARENA_HEADER + size;
+        if (chunk_size < CALL_ARENA_CHUNK) {
+            chunk_size = CALL_ARENA_CHUNK;
+        }
+        if (chunk_size == CALL_ARENA_CHUNK && free_chunks) {
+            c = free_chunks;
+            free_chunks = c->next;
+            nb_free_chunks--;
+        } else {
+            if (!(c = (struct chunk *)malloc(chunk_size))) {
+                ERROR("Could not allocate %zu bytes for call state!", chunk_size);
+            }
+            mallocs++;
+        }
+        c->next = chunks;
+        c->size = chunk_size;
+        c->used = ARENA_CHUNK_HEADER;
+        chunks = c;
+        chunks_used++;
+    }
+
+    char *block = (char *)c + c->used;
+    *(size_t *)block = size;
+    c->used += ARENA_HEADER + size;
+    return block + ARENA_HEADER;
+}
+
+void *call_arena::grow(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return alloc(size);
+    }
+
+    size_t *cap = (size_t *)((char *)ptr - ARENA_HEADER);
+    if (size <= *cap) {
+        return ptr;
+    }
+
+    /* The most recent block can take the rest of its chunk. */
+    struct chunk *c = chunks;
+    size = ARENA_ALIGN(size);
+    if ((char *)ptr + *cap == (char *)c + c->used && c->size - c->used >= size - *cap) {
+        c->used += size - *cap;
+        *cap = size;
+        return ptr;
+    }
+
+    void *newptr = alloc(size < 2 * *cap ? 2 * *cap : size);
+    memcpy(newptr, ptr, *cap);
+    return newptr;
+}
+
+char *call_arena::copy(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    return (char *)memcpy(alloc(len), s, len);
+}
+
+void call_arena::release(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    size_t cap = *(size_t *)((char *)ptr - ARENA_HEADER);
+    struct chunk *c = chunks;
+    if ((char *)ptr + cap == (char *)c + c->used) {
+        c->used -= ARENA_HEADER + cap;
+    }
+}
+
 /******************* Call class implementation ****************/
+
+/* Freed call objects; the first word of each links to the next. */
+static void *free_calls = NULL;
+static int nb_free_calls = 0;
+
+void *call::operator new(size_t size)
+{
+    if (size == sizeof(call) && free_calls) {
+        void *ptr = free_calls;
+        free_calls = *(void **)ptr;
+        nb_free_calls--;
+        call_pool_hits++;
+        return ptr;
+    }
+    call_pool_misses++;
+    return ::operator new(size);
+}
+
+void call::operator delete(void *ptr, size_t size)
+{
+    if (size == sizeof(call) && nb_free_calls < call_pool_size) {
+        *(void **)ptr = free_calls;
+        free_calls = ptr;
+        nb_free_calls++;
+        return;
+    }
+    ::operator delete(ptr);
+}
+
+void call::prewarm_pool()
+{
+    while (nb_free_calls < call_pool_size) {
+        void *ptr = ::operator new(sizeof(call));
+        *(void **)ptr = free_calls;
+        free_calls = ptr;
+        nb_free_calls++;
+    }
+    call_arena::prewarm(call_pool_size);
+}
+
 call::call(const char *p_id, bool use_ipv6, int userId, struct sockaddr_storage *dest) : listener(p_id, true)
 {
     init(main_scenario, NULL, dest, p_id, userId, use_ipv6, false, false);
@@ -429,36 +590,66 @@ call::call(scenario * call_scenario, struct sipp_socket *socket, struct sockaddr
     init(call_scenario, socket, dest, p_id, userId, ipv6, isAutomatic, isInitialization);
 }
 
-call *call::add_call(int userId, bool ipv6, struct sockaddr_storage *dest)
-{
-    static char call_id[MAX_HEADER_LEN];
-
-    const char * src = call_id_string;
-    int count = 0;
+/* Only %u changes from one call to the next, so the -cid_str format is
+ * expanded once into the text around each %u. */
+static std::vector<std::string> call_id_parts;
 
-    if(!next_number) {
-        next_number ++;
-    }
+static void split_call_id_string()
+{
+    const char *src = call_id_string;
+    std::string part;
+    char num[16];
 
-    while (*src && count < MAX_HEADER_LEN-1) {
+    while (*src) {
         if (*src == '%') {
             ++src;
-            switch(*src++) {
+            switch(*src) {
             case 'u':
-                count += snprintf(&call_id[count], MAX_HEADER_LEN-count-1,"%u", next_number);
+                call_id_parts.push_back(part);
+                part.clear();
                 break;
             case 'p':
-                count += snprintf(&call_id[count], MAX_HEADER_LEN-count-1,"%u", pid);
+                snprintf(num, sizeof(num), "%u", pid);
+                part += num;
                 break;
             case 's':
-                count += snprintf(&call_id[count], MAX_HEADER_LEN-count-1,"%s", local_ip);
+                part += local_ip;
                 break;
             default:      // treat all unknown sequences as %%
-                call_id[count++] = '%';
+                part += '%';
                 break;
             }
+            if (*src) {
+                src++;
+            }
         } else {
-            call_id[count++] = *src++;
+            part += *src++;
+        }
+    }
+    call_id_parts.push_back(part);
+}
+
+call *call::add_call(int userId, bool ipv6, struct sockaddr_storage *dest)
+{
+    static char call_id[MAX_HEADER_LEN];
+    int count = 0;
+
+    if(!next_number) {
+        next_number ++;
+    }
+
+    if (call_id_parts.empty()) {
+        split_call_id_string();
+    }
+    for (unsigned int i = 0; i < call_id_parts.size() && count < MAX_HEADER_LEN - 1; i++) {
+        int len = call_id_parts[i].size();
+        if (len > MAX_HEADER_LEN - 1 - count) {
+            len = MAX_HEADER_LEN - 1 - count;
+        }
+        memcpy(call_id + count, call_id_parts[i].data(), len);
+        count += len;
+        if (i + 1 < call_id_parts.size()) {
+            count += snprintf(&call_id[count], MAX_HEADER_LEN-count-1,"%u", next_number);
         }
     }
     call_id[count] = 0;
@@ -556,7 +747,8 @@ void call::init(scenario * call_scenario, struct sipp_socket *socket, struct soc
         putUserVars = true;
     }
     if (call_scenario->allocVars->size > 0) {
-        M_callVariableTable = new VariableTable(userVars, call_scenario->allocVars->size);
+        M_callVariableTable = new (arena.alloc(sizeof(VariableTable)))
+            VariableTable(userVars, call_scenario->allocVars->size, &arena);
     } else if (userVars->size > 0) {
         M_callVariableTable = userVars->getTable();
     } else if (globalVariables->size > 0) {
@@ -569,7 +761,7 @@ void call::init(scenario * call_scenario, struct sipp_socket *socket, struct soc
     }
 
     if (call_scenario->transactions.size() > 0) {
-        transactions = (struct txnInstanceInfo *)malloc(sizeof(txnInstanceInfo) * call_scenario->transactions.size());
+        transactions = (struct txnInstanceInfo *)arena.alloc(sizeof(txnInstanceInfo) * call_scenario->transactions.size());
         memset(transactions, 0, sizeof(struct txnInstanceInfo) * call_scenario->transactions.size());
     } else {
         transactions = NULL;
@@ -577,16 +769,10 @@ void call::init(scenario * call_scenario, struct sipp_socket *socket, struct soc
 
     // If not updated by a message we use the start time
     // information to compute rtd information
-    start_time_rtd = (unsigned long long *)malloc(sizeof(unsigned long long) * call_scenario->stats->nRtds());
-    if (!start_time_rtd) {
-        ERROR("Could not allocate RTD times!");
-    }
-    rtd_done = (bool *)malloc(sizeof(bool) * call_scenario->stats->nRtds());
-    if (!start_time_rtd) {
-        ERROR("Could not allocate RTD done!");
-    }
+    start_time_rtd = (unsigned long long *)arena.alloc(sizeof(unsigned long long) * call_scenario->stats->nRtds());
+    rtd_done = (bool *)arena.alloc(sizeof(bool) * call_scenario->stats->nRtds());
     for (i = 0; i < call_scenario->stats->nRtds(); i++) {
-        start_time_rtd[i] = getmicroseconds();
+        start_time_rtd[i] = getprecisemicroseconds();
         rtd_done[i] = false;
     }
 
@@ -617,7 +803,8 @@ void call::init(scenario * call_scenario, struct sipp_socket *socket, struct soc
     memset(&(play_args_a.from), 0, sizeof(struct sockaddr_storage));
     memset(&(play_args_v.from), 0, sizeof(struct sockaddr_storage));
     hasMediaInformation = 0;
-    media_thread = 0;
+    play_args_a.player = NULL;
+    play_args_v.player = NULL;
 #endif
 
     peer_tag = NULL;
@@ -666,10 +853,7 @@ int call::_callDebug(const char *fmt, ...)
     int ret = vsnprintf(NULL, 0, fmt, ap);
     va_end(ap);
 
-    debugBuffer = (char *)realloc(debugBuffer, debugLength + ret + TIME_LENGTH + 2);
-    if (!debugBuffer) {
-        ERROR("Could not allocate buffer (%d bytes) for callDebug file!", debugLength + ret + TIME_LENGTH + 2);
-    }
+    debugBuffer = (char *)arena.grow(debugBuffer, debugLength + ret + TIME_LENGTH + 2);
 
     struct timeval now;
     gettimeofday(&now, NULL);
@@ -705,54 +889,24 @@ call::~call()
         CallGenerationTask::free_user(userId);
     }
 
-    if (transactions) {
-        for (unsigned int i = 0; i < call_scenario->transactions.size(); i++) {
-            free(transactions[i].txnID);
-        }
-        free(transactions);
-    }
-
-    if(last_recv_msg) {
-        free(last_recv_msg);
-    }
-    if(last_send_msg) {
-        free(last_send_msg);
-    }
-    if(peer_tag) {
-        free(peer_tag);
-    }
-
-    if(dialog_route_set) {
-        free(dialog_route_set);
-    }
-
-    if(next_req_url) {
-        free(next_req_url);
-    }
-
 #ifdef RTP_STREAM
   rtpstream_end_call (&rtpstream_callinfo);
 #endif
 
-    if(dialog_authentication) {
-        free(dialog_authentication);
-    }
-
     if (use_tdmmap) {
         tdm_map[tdm_map_number] = false;
     }
 
 # ifdef PCAPPLAY
-    if (media_thread != 0) {
-        pthread_cancel(media_thread);
-        pthread_join(media_thread, NULL);
-    }
+    stop_packets(&play_args_a);
+    stop_packets(&play_args_v);
 #endif
 
+    free(queued_msg);
 
-    free(start_time_rtd);
-    free(rtd_done);
-    free(debugBuffer);
+    /* Messages, transactions, route set and variables all go with the arena. */
+    call_arena_mallocs += arena.mallocs;
+    call_arena_calls++;
 }
 
 void call::computeStat (CStat::E_Action P_action)
@@ -1051,13 +1205,14 @@ void call::sendBuffer(char * msg, int len)
 char * call::get_header_field_code(const char *msg, const char * name)
 {
     static char code[MAX_HEADER_LEN];
+    char header[MAX_HEADER_BUF];
     const char * last_header;
     int i;
 
     last_header = NULL;
     i = 0;
     /* If we find the field in msg */
-    last_header = get_header_content(msg, name);
+    last_header = get_header_content(msg, name, header, sizeof(header));
     if(last_header) {
         /* Extract the integer value of the field */
         while(isspace(*last_header)) last_header++;
@@ -1067,7 +1222,7 @@ char * call::get_header_field_code(const char *msg, const char * name)
     return code;
 }
 
-char * call::get_last_header(const char * name)
+char * call::get_last_header(const char * name, char *buf, size_t size)
 {
     int len;
 
@@ -1084,11 +1239,11 @@ char * call::get_last_header(const char * name)
     }
 
     if (name[len - 1] == ':') {
-        return get_header(last_recv_msg, name, false);
+        return get_header(last_recv_msg, name, false, buf, size);
     } else {
         char with_colon[MAX_HEADER_LEN];
         sprintf(with_colon, "%s:", name);
-        return get_header(last_recv_msg, with_colon, false);
+        return get_header(last_recv_msg, with_colon, false, buf, size);
     }
 }
 
@@ -1101,7 +1256,8 @@ char * call::get_last_request_uri()
     char * last_request_uri;
     int tmp_len;
 
-    char * last_To = get_last_header("To:");
+    char last_To_buf[MAX_HEADER_BUF];
+    char * last_To = get_last_header("To:", last_To_buf, sizeof(last_To_buf));
     if (!last_To) {
         return strdup("");
     }
@@ -1204,20 +1360,21 @@ void call::do_bookkeeping(message *curmsg)
 
     /* If this message can be used to compute RTD, do it now */
     if(int rtd = curmsg -> start_rtd) {
-        start_time_rtd[rtd - 1] = getmicroseconds();
+        start_time_rtd[rtd - 1] = getprecisemicroseconds();
     }
 
     if(int rtd = curmsg -> stop_rtd) {
         if (!rtd_done[rtd - 1]) {
             unsigned long long start = start_time_rtd[rtd - 1];
-            unsigned long long end = getmicroseconds();
+            unsigned long long end = getprecisemicroseconds();
 
             if(dumpInRtt) {
                 call_scenario->stats->computeRtt(start, end, rtd);
             }
 
+            /* In microseconds, for the percentiles. */
             computeStat(CStat::E_ADD_RESPONSE_TIME_DURATION,
-                        (end - start) / 1000, rtd - 1);
+                        end - start, rtd - 1);
 
             if (!curmsg -> repeat_rtd) {
                 rtd_done[rtd - 1] = true;
@@ -1455,19 +1612,12 @@ bool call::executeMessage(message *curmsg)
 
         last_send_index = curmsg->index;
         last_send_len = msgLen;
-        realloc_ptr = (char *) realloc(last_send_msg, msgLen+1);
-        if (realloc_ptr) {
-            last_send_msg = realloc_ptr;
-        } else {
-            free(last_send_msg);
-            ERROR("Out of memory!");
-            return false;
-        }
+        last_send_msg = (char *)arena.grow(last_send_msg, msgLen + 1);
         memcpy(last_send_msg, msg_snd, msgLen);
         last_send_msg[msgLen] = '\0';
 
         if (curmsg->start_txn) {
-            transactions[curmsg->start_txn - 1].txnID = (char *)realloc(transactions[curmsg->start_txn - 1].txnID, MAX_HEADER_LEN);
+            transactions[curmsg->start_txn - 1].txnID = (char *)arena.grow(transactions[curmsg->start_txn - 1].txnID, MAX_HEADER_LEN);
             extract_transaction(transactions[curmsg->start_txn - 1].txnID, last_send_msg);
         }
         if (curmsg->ack_txn) {
@@ -1856,16 +2006,7 @@ bool call::process_unexpected(char * msg)
         }
 
         // usage of last_ keywords => for call aborting
-        realloc_ptr = (char *) realloc(last_recv_msg, strlen(msg) + 1);
-        if (realloc_ptr) {
-            last_recv_msg = realloc_ptr;
-        } else {
-            free(last_recv_msg);
-            ERROR("Out of memory!");
-            return false;
-        }
-
-        strcpy(last_recv_msg, msg);
+        setLastMsg(msg);
 
         computeStat(CStat::E_CALL_FAILED);
         computeStat(CStat::E_FAILED_UNEXPECTED_MSG);
@@ -2031,6 +2172,71 @@ int call::sendCmdBuffer(char* cmd)
 }
 
 
+/* Copy a string or format an integer into the message being built, the
+ * same as snprintf(dest, left, ...) but without parsing a format. Both
+ * return the number of characters written. */
+static inline int append_string(char *dest, int left, const char *str)
+{
+    int len = strlen(str);
+
+    if (len >= left) {
+        len = left > 0 ? left - 1 : 0;
+    }
+    if (left > 0) {
+        memcpy(dest, str, len);
+        dest[len] = '\0';
+    }
+    return len;
+}
+
+static inline int append_int(char *dest, int left, long long value)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long long u = value < 0 ? -(unsigned long long)value : value;
+
+    *--p = '\0';
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (value < 0) {
+        *--p = '-';
+    }
+    return append_string(dest, left, p);
+}
+
+/* Our address on this socket, looked up once rather than per message.
+ * Until the socket is bound the answer is not cached and goes to buf. */
+static const char *get_server_ip(struct sipp_socket *socket, char *buf)
+{
+    if (socket->ss_server_ip[0]) {
+        return socket->ss_server_ip;
+    }
+
+    struct sockaddr_storage server_sockaddr;
+    sipp_socklen_t len = sizeof(server_sockaddr);
+
+    memset(&server_sockaddr, 0, sizeof(server_sockaddr));
+    getsockname(socket->ss_fd, (sockaddr *)(void *)&server_sockaddr, &len);
+
+    char *dest = socket->ss_server_ip;
+    if (server_sockaddr.ss_family == AF_INET6) {
+        struct sockaddr_in6 *in6 = _RCAST(struct sockaddr_in6 *, &server_sockaddr);
+        if (!in6->sin6_port) {
+            dest = buf;
+        }
+        inet_ntop(AF_INET6, &in6->sin6_addr, dest, INET6_ADDRSTRLEN);
+    } else {
+        struct sockaddr_in *in = _RCAST(struct sockaddr_in *, &server_sockaddr);
+        if (!in->sin_port) {
+            dest = buf;
+        }
+        snprintf(dest, INET6_ADDRSTRLEN, "%s", inet_ntoa(in->sin_addr));
+    }
+    return dest;
+}
+
 char* call::createSendingMessage(SendingMessage *src, int P_index, int *msgLen)
 {
     static char msg_buffer[SIPP_MAX_MSG_SIZE+2];
@@ -2049,6 +2255,10 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
 
     *dest = '\0';
 
+    if (compile_messages && !src->isCompiled()) {
+        src->compile();
+    }
+
     for (int i = 0; i < src->numComponents(); i++) {
         MessageComponent *comp = src->getComponent(i);
         int left = buf_len - (dest - msg_buffer);
@@ -2066,16 +2276,16 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
             }
             break;
         case E_Message_Remote_IP:
-            dest += snprintf(dest, left, "%s", remote_ip_escaped);
+            dest += append_string(dest, left, remote_ip_escaped);
             break;
         case E_Message_Remote_Host:
-            dest += snprintf(dest, left, "%s", remote_host);
+            dest += append_string(dest, left, remote_host);
             break;
         case E_Message_Remote_Port:
-            dest += snprintf(dest, left, "%d", remote_port + comp->offset);
+            dest += append_int(dest, left, remote_port + comp->offset);
             break;
         case E_Message_Local_IP:
-            dest += snprintf(dest, left, "%s", local_ip_escaped);
+            dest += append_string(dest, left, local_ip_escaped);
             break;
         case E_Message_Local_Port:
             int port;
@@ -2084,40 +2294,21 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
             } else {
                 port =  local_port;
             }
-            dest += snprintf(dest, left, "%d", port + comp->offset);
+            dest += append_int(dest, left, port + comp->offset);
             break;
         case E_Message_Transport:
-            dest += snprintf(dest, left, "%s", TRANSPORT_TO_STRING(transport));
+            dest += append_string(dest, left, TRANSPORT_TO_STRING(transport));
             break;
         case E_Message_Local_IP_Type:
             dest += snprintf(dest, left, "%s", (local_ip_is_ipv6 ? "6" : "4"));
             break;
         case E_Message_Server_IP: {
-            /* We should do this conversion once per socket creation, rather than
-             * repeating it every single time. */
-            struct sockaddr_storage server_sockaddr;
-
-            sipp_socklen_t len = SOCK_ADDR_SIZE(&server_sockaddr);
-            getsockname(call_socket->ss_fd,
-                        (sockaddr *)(void *)&server_sockaddr, &len);
-
-            if (server_sockaddr.ss_family == AF_INET6) {
-                char * temp_dest;
-                temp_dest = (char *) malloc(INET6_ADDRSTRLEN);
-                memset(temp_dest,0,INET6_ADDRSTRLEN);
-                inet_ntop(AF_INET6,
-                          &((_RCAST(struct sockaddr_in6 *,&server_sockaddr))->sin6_addr),
-                          temp_dest,
-                          INET6_ADDRSTRLEN);
-                dest += snprintf(dest, left, "%s",temp_dest);
-            } else {
-                dest += snprintf(dest, left, "%s",
-                                 inet_ntoa((_RCAST(struct sockaddr_in *,&server_sockaddr))->sin_addr));
-            }
+            char server_ip[INET6_ADDRSTRLEN];
+            dest += append_string(dest, left, get_server_ip(call_socket, server_ip));
+            break;
         }
-        break;
         case E_Message_Media_IP:
-            dest += snprintf(dest, left, "%s", media_ip_escaped);
+            dest += append_string(dest, left, media_ip_escaped);
             break;
         case E_Message_Media_Port:
         case E_Message_Auto_Media_Port: {
@@ -2181,7 +2372,7 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
             dest += snprintf(dest, left, "%s", (media_ip_is_ipv6 ? "6" : "4"));
             break;
         case E_Message_Call_Number:
-            dest += snprintf(dest, left, "%u", number);
+            dest += append_int(dest, left, number);
             break;
         case E_Message_DynamicId:
             dest += snprintf(dest, left, "%u", call::dynamicId);
@@ -2192,27 +2383,29 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
             } ;
             break;
         case E_Message_Call_ID:
-            dest += snprintf(dest, left, "%s", id);
+            dest += append_string(dest, left, id);
             break;
         case E_Message_CSEQ:
-            dest += snprintf(dest, left, "%u", cseq + comp->offset);
+            dest += append_int(dest, left, (unsigned int)(cseq + comp->offset));
             break;
         case E_Message_PID:
-            dest += snprintf(dest, left, "%d", pid);
+            dest += append_int(dest, left, pid);
             break;
         case E_Message_Service:
-            dest += snprintf(dest, left, "%s", service);
+            dest += append_string(dest, left, service);
             break;
         case E_Message_Branch:
             /* Branch is magic cookie + call number + message index in scenario */
-            if(P_index == -2) {
-                dest += snprintf(dest, left, "z9hG4bK-%u-%u-%d", pid, number, msg_index-1 + comp->offset);
-            } else {
-                dest += snprintf(dest, left, "z9hG4bK-%u-%u-%d", pid, number, P_index + comp->offset);
-            }
+            dest += append_string(dest, left, "z9hG4bK-");
+            dest += append_int(dest, buf_len - (dest - msg_buffer), (unsigned int)pid);
+            dest += append_string(dest, buf_len - (dest - msg_buffer), "-");
+            dest += append_int(dest, buf_len - (dest - msg_buffer), number);
+            dest += append_string(dest, buf_len - (dest - msg_buffer), "-");
+            dest += append_int(dest, buf_len - (dest - msg_buffer),
+                               (P_index == -2 ? msg_index - 1 : P_index) + comp->offset);
             break;
         case E_Message_Index:
-            dest += snprintf(dest, left, "%d", P_index);
+            dest += append_int(dest, left, P_index);
             break;
         case E_Message_Next_Url:
             if (next_req_url) {
@@ -2234,7 +2427,8 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
             break;
         case E_Message_Peer_Tag_Param:
             if(peer_tag) {
-                dest += snprintf(dest, left, ";tag=%s", peer_tag);
+                dest += append_string(dest, left, ";tag=");
+                dest += append_string(dest, buf_len - (dest - msg_buffer), peer_tag);
             }
             break;
         case E_Message_Routes:
@@ -2266,11 +2460,11 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
             CCallVariable *var = M_callVariableTable->getVar(varId);
             if(var->isSet()) {
                 if (var->isRegExp()) {
-                    dest += sprintf(dest, "%s", var->getMatchingValue());
+                    dest += append_string(dest, left, var->getMatchingValue());
                 } else if (var->isDouble()) {
                     dest += sprintf(dest, "%lf", var->getDouble());
                 } else if (var->isString()) {
-                    dest += sprintf(dest, "%s", var->getString());
+                    dest += append_string(dest, left, var->getString());
                 } else if (var->isBool()) {
                     dest += sprintf(dest, "true");
                 }
@@ -2344,7 +2538,8 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
             break;
         }
         case E_Message_Last_Header: {
-            char * last_header = get_last_header(comp->literal);
+            char last_header_buf[MAX_HEADER_BUF];
+            char * last_header = get_last_header(comp->literal, last_header_buf, sizeof(last_header_buf));
             if(last_header) {
                 dest += sprintf(dest, "%s", last_header);
             }
@@ -2371,7 +2566,8 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
         case E_Message_Last_CSeq_Number: {
             int last_cseq = 0;
 
-            char *last_header = get_last_header("CSeq:");
+            char last_header_buf[MAX_HEADER_LEN];
+            char *last_header = get_last_header("CSeq:", last_header_buf, sizeof(last_header_buf));
             if(last_header) {
                 last_header += 5;
                 /* Extract the integer value of the field */
@@ -2445,7 +2641,8 @@ char* call::createSendingMessage(SendingMessage *src, int P_index, char *msg_buf
 
         /* Need the Method name from the CSeq of the Challenge */
         char method[MAX_HEADER_LEN];
-        tmp = get_last_header("CSeq:");
+        char last_cseq[MAX_HEADER_LEN];
+        tmp = get_last_header("CSeq:", last_cseq, sizeof(last_cseq));
         if(!tmp) {
             ERROR("Could not extract method from cseq of challenge");
         }
@@ -2681,7 +2878,8 @@ void call::extract_cseq_method (char* method, char* msg)
 
 void call::extract_transaction (char* txn, char* msg)
 {
-    char *via = get_header_content(msg, "via:");
+    char via_buf[MAX_HEADER_BUF];
+    char *via = get_header_content(msg, "via:", via_buf, sizeof(via_buf));
     if (!via) {
         txn[0] = '\0';
         return;
@@ -2806,8 +3004,7 @@ void call::computeRouteSetAndRemoteTargetUri (char* rr, char* contact, bool bReq
     }
 
     if (strlen(actual_rr)) {
-        dialog_route_set = (char *)
-                           calloc(1, strlen(actual_rr) + 2);
+        dialog_route_set = (char *)arena.alloc(strlen(actual_rr) + 2);
         sprintf(dialog_route_set, "%s", actual_rr);
     }
 
@@ -2984,7 +3181,8 @@ bool call::process_incoming(char * msg, struct sockaddr_storage *src)
 
 #ifdef RTP_STREAM
   /* Check if message has a SDP in it; and extract media information. */
-  if (!strcmp(get_header_content(msg, (char*)"Content-Type:"),"application/sdp") &&
+  char content_type[MAX_HEADER_LEN];
+  if (!strcmp(get_header_content(msg, "Content-Type:", content_type, sizeof(content_type)),"application/sdp") &&
           (hasMedia == 1)) {
     extract_rtp_remote_addr(msg);
   }
@@ -3011,18 +3209,15 @@ bool call::process_incoming(char * msg, struct sockaddr_storage *src)
 #endif
         }
         /* It is a response: update peer_tag */
-        ptr = get_peer_tag(msg);
+        char tag[MAX_HEADER_LEN];
+        ptr = get_peer_tag(msg, tag, sizeof(tag));
         if (ptr) {
             if(strlen(ptr) > (MAX_HEADER_LEN - 1)) {
                 ERROR("Peer tag too long. Change MAX_HEADER_LEN and recompile sipp");
             }
-            if(peer_tag) {
-                free(peer_tag);
-            }
-            peer_tag = strdup(ptr);
-            if (!peer_tag) {
-                ERROR("Out of memory allocating peer tag.");
-            }
+            /* Reuse the block: every response carries the tag again. */
+            peer_tag = (char *)arena.grow(peer_tag, strlen(ptr) + 1);
+            strcpy(peer_tag, ptr);
         }
         request[0]=0;
         // extract the cseq method from the response
@@ -3273,23 +3468,16 @@ bool call::process_incoming(char * msg, struct sockaddr_storage *src)
     if (call_scenario->messages[search_index] -> bShouldRecordRoutes &&
             NULL == dialog_route_set ) {
 
-        realloc_ptr = (char*) realloc(next_req_url, MAX_HEADER_LEN);
-        if (realloc_ptr) {
-            next_req_url = realloc_ptr;
-        } else {
-            free(next_req_url);
-            ERROR("Out of memory!");
-            return false;
-        }
+        next_req_url = (char *)arena.grow(next_req_url, MAX_HEADER_LEN);
 
 
         char rr[MAX_HEADER_LEN];
         memset(rr, 0, sizeof(rr));
-        strcpy(rr, get_header_content(msg, (char*)"Record-Route:"));
+        get_header_content(msg, "Record-Route:", rr, sizeof(rr));
 
         // WARNING("rr [%s]", rr);
         char ch[MAX_HEADER_LEN];
-        strcpy(ch, get_header_content(msg, (char*)"Contact:"));
+        get_header_content(msg, "Contact:", ch, sizeof(ch));
 
         /* decorate the contact with '<' and '>' if it does not have it */
         char* contDecorator = strchr(ch, '<');
@@ -3315,22 +3503,15 @@ bool call::process_incoming(char * msg, struct sockaddr_storage *src)
         /* is a challenge */
         char auth[MAX_HEADER_LEN];
         memset(auth, 0, sizeof(auth));
-        strcpy(auth, get_header_content(msg, (char*)"Proxy-Authenticate:"));
+        get_header_content(msg, "Proxy-Authenticate:", auth, sizeof(auth));
         if (auth[0] == 0) {
-            strcpy(auth, get_header_content(msg, (char*)"WWW-Authenticate:"));
+            get_header_content(msg, "WWW-Authenticate:", auth, sizeof(auth));
         }
         if (auth[0] == 0) {
             ERROR("Couldn't find 'Proxy-Authenticate' or 'WWW-Authenticate' in 401 or 407!");
         }
 
-        realloc_ptr = (char *) realloc(dialog_authentication, strlen(auth) + 2);
-        if (realloc_ptr) {
-            dialog_authentication = realloc_ptr;
-        } else {
-            free(dialog_authentication);
-            ERROR("Out of memory!");
-            return false;
-        }
+        dialog_authentication = (char *)arena.grow(dialog_authentication, strlen(auth) + 2);
 
 
         sprintf(dialog_authentication, "%s", auth);
@@ -3350,17 +3531,7 @@ bool call::process_incoming(char * msg, struct sockaddr_storage *src)
     last_recv_index = search_index;
     last_recv_hash = cookie;
     callDebug("Set Last Recv Hash: %u (recv index %d)\n", last_recv_hash, last_recv_index);
-    realloc_ptr = (char *) realloc(last_recv_msg, strlen(msg) + 1);
-    if (realloc_ptr) {
-        last_recv_msg = realloc_ptr;
-    } else {
-        free(last_recv_msg);
-        ERROR("Out of memory!");
-        return false;
-    }
-
-
-    strcpy(last_recv_msg, msg);
+    setLastMsg(msg);
 
     /* If this was a mandatory message, or if there is an explicit next label set
      * we must update our state machine.  */
@@ -3683,7 +3854,8 @@ call::T_ActionResult call::executeAction(char * msg, message *curmsg)
             } else if (lf < end) {
                 result = false;
             } else {
-                char *auth = get_header(msg, "Authorization:", true);
+                char auth[MAX_HEADER_BUF];
+                get_header(msg, "Authorization:", true, auth, sizeof(auth));
                 char *method = (char *)malloc(end - msg + 1);
                 strncpy(method, msg, end - msg);
                 method[end - msg] = '\0';
@@ -3861,24 +4033,10 @@ call::T_ActionResult call::executeAction(char * msg, message *curmsg)
                 from->sin_family = AF_INET;
                 from->sin_addr.s_addr = inet_addr(media_ip);
             }
-            /* Create a thread to send RTP packets */
-            pthread_attr_t attr;
-            pthread_attr_init(&attr);
-#ifndef PTHREAD_STACK_MIN
-#define PTHREAD_STACK_MIN	16384
-#endif
-            //pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN);
-            if (media_thread != 0) {
-                // If a media_thread is already active, kill it before starting a new one
-                pthread_cancel(media_thread);
-                pthread_join(media_thread, NULL);
-                media_thread = 0;
-            }
-            int ret = pthread_create(&media_thread, &attr, send_wrapper,
-                                     (void *) play_args);
-            if(ret)
-                ERROR("Can't create thread to send RTP packets");
-            pthread_attr_destroy(&attr);
+            /* A call plays one pcap at a time: stop the active one first */
+            stop_packets(&(this->play_args_a));
+            stop_packets(&(this->play_args_v));
+            start_packets(play_args);
 #endif
 
 #ifdef RTP_STREAM
@@ -4002,15 +4160,7 @@ call::T_AutoMode call::checkAutomaticResponseMode(char * P_recv)
 
 void call::setLastMsg(const char *msg)
 {
-    realloc_ptr = (char *) realloc(last_recv_msg, strlen(msg) + 1);
-    if (realloc_ptr) {
-        last_recv_msg = realloc_ptr;
-    } else {
-        free(last_recv_msg);
-        ERROR("Out of memory!");
-        return;
-    }
-
+    last_recv_msg = (char *)arena.grow(last_recv_msg, strlen(msg) + 1);
     strcpy(last_recv_msg, msg);
 }
 
@@ -4024,17 +4174,7 @@ bool call::automaticResponseMode(T_AutoMode P_case, char * P_recv)
     switch (P_case) {
     case E_AM_UNEXP_BYE: // response for an unexpected BYE
         // usage of last_ keywords
-        realloc_ptr = (char *) realloc(last_recv_msg, strlen(P_recv) + 1);
-        if (realloc_ptr) {
-            last_recv_msg = realloc_ptr;
-        } else {
-            free(last_recv_msg);
-            ERROR("Out of memory!");
-            return false;
-        }
-
-
-        strcpy(last_recv_msg, P_recv);
+        setLastMsg(P_recv);
 
         // The BYE is unexpected, count it
         call_scenario->messages[msg_index] -> nb_unexp++;
@@ -4061,17 +4201,7 @@ bool call::automaticResponseMode(T_AutoMode P_case, char * P_recv)
 
     case E_AM_UNEXP_CANCEL: // response for an unexpected cancel
         // usage of last_ keywords
-        realloc_ptr = (char *) realloc(last_recv_msg, strlen(P_recv) + 1);
-        if (realloc_ptr) {
-            last_recv_msg = realloc_ptr;
-        } else {
-            free(last_recv_msg);
-            ERROR("Out of memory!");
-            return false;
-        }
-
-
-        strcpy(last_recv_msg, P_recv);
+        setLastMsg(P_recv);
 
         // The CANCEL is unexpected, count it
         call_scenario->messages[msg_index] -> nb_unexp++;
@@ -4099,17 +4229,7 @@ bool call::automaticResponseMode(T_AutoMode P_case, char * P_recv)
 
     case E_AM_PING: // response for a random ping
         // usage of last_ keywords
-        realloc_ptr = (char *) realloc(last_recv_msg, strlen(P_recv) + 1);
-        if (realloc_ptr) {
-            last_recv_msg = realloc_ptr;
-        } else {
-            free(last_recv_msg);
-            ERROR("Out of memory!");
-            return false;
-        }
-
-
-        strcpy(last_recv_msg, P_recv);
+        setLastMsg(P_recv);
 
         if (default_behaviors & DEFAULT_BEHAVIOR_PINGREPLY) {
             WARNING("Automatic response mode for an unexpected PING for call: %s", (id==NULL)?"none":id);
@@ -4142,35 +4262,14 @@ bool call::automaticResponseMode(T_AutoMode P_case, char * P_recv)
             strcpy(old_last_recv_msg,last_recv_msg);
         }
         // usage of last_ keywords
-        realloc_ptr = (char *) realloc(last_recv_msg, strlen(P_recv) + 1);
-        if (realloc_ptr) {
-            last_recv_msg = realloc_ptr;
-        } else {
-            free(last_recv_msg);
-            free(old_last_recv_msg);
-            ERROR("Out of memory!");
-            return false;
-        }
-
-
-        strcpy(last_recv_msg, P_recv);
+        setLastMsg(P_recv);
 
         WARNING("Automatic response mode for an unexpected INFO, UPDATE or NOTIFY for call: %s", (id==NULL)?"none":id);
         sendBuffer(createSendingMessage(get_default_message("200"), -1));
 
         // restore previous last msg
         if (last_recv_msg_saved == true) {
-            realloc_ptr = (char *) realloc(last_recv_msg, strlen(old_last_recv_msg) + 1);
-            if (realloc_ptr) {
-                last_recv_msg = realloc_ptr;
-            } else {
-                free(last_recv_msg);
-                ERROR("Out of memory!");
-                return false;
-            }
-
-
-            strcpy(last_recv_msg, old_last_recv_msg);
+            setLastMsg(old_last_recv_msg);
             if (old_last_recv_msg != NULL) {
                 free(old_last_recv_msg);
                 old_last_recv_msg = NULL;
@@ -4187,21 +4286,3 @@ bool call::automaticResponseMode(T_AutoMode P_case, char * P_recv)
 
     return false;
 }
-
-#ifdef PCAPPLAY
-void *send_wrapper(void *arg)
-{
-    play_args_t *s = (play_args_t *) arg;
-    //struct sched_param param;
-    //int ret;
-    //param.sched_priority = 10;
-    //ret = pthread_setschedparam(pthread_self(), SCHED_RR, &param);
-    //if(ret)
-    //  ERROR("Can't set RTP play thread realtime parameters");
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-    send_packets(s);
-    pthread_exit(NULL);
-    return NULL;
-}
-#endif
@@ -30,15 +30,86 @@
  *           Wolfgang Beck
  *           Charles P Wright from IBM Research
  */
+#include <fstream>
+
 #include "sipp.hpp"
 
 class CallGenerationTask *CallGenerationTask::instance = NULL;
 unsigned long CallGenerationTask::calls_since_last_rate_change = 0;
-unsigned long CallGenerationTask::last_rate_change_time = 0;
+unsigned long long CallGenerationTask::last_rate_change_us = 0;
+unsigned long long CallGenerationTask::last_call_start_us = 0;
+unsigned long long CallGenerationTask::last_call_due_us = 0;
+unsigned long long CallGenerationTask::next_arrival_us = 0;
+enum arrival_process CallGenerationTask::process = ARRIVAL_UNIFORM;
+class CSample *CallGenerationTask::inter_arrival = NULL;
+std::vector<unsigned long long> CallGenerationTask::trace_us;
+unsigned long long CallGenerationTask::trace_base_us = 0;
+size_t CallGenerationTask::trace_next = 0;
+
+bool read_arrival_trace(std::istream &in, std::vector<unsigned long long> *offsets_us, int *bad_line)
+{
+    std::string line;
+    double first = 0, last = 0;
+    int lineno = 0;
+
+    offsets_us->clear();
+    while (std::getline(in, line)) {
+        const char *p = line.c_str();
+        char *end;
+
+        lineno++;
+        while (isspace(*p)) {
+            p++;
+        }
+        /* Skip blank lines, comments and a column header. */
+        if (!*p || *p == '#' || (lineno == 1 && !isdigit(*p) && *p != '.')) {
+            continue;
+        }
+
+        double t = strtod(p, &end);
+        while (isspace(*end)) {
+            end++;
+        }
+        if (end == p || (*end && *end != ',' && *end != ';') ||
+                (!offsets_us->empty() && t < last)) {
+            *bad_line = lineno;
+            return false;
+        }
+        if (offsets_us->empty()) {
+            first = t;
+        }
+        last = t;
+        offsets_us->push_back((unsigned long long)((t - first) * 1000000.0 + 0.5));
+    }
+    return true;
+}
 
 void CallGenerationTask::initialize()
 {
     assert(instance == NULL);
+
+    if (arrival_trace_file) {
+        std::ifstream in(arrival_trace_file);
+        int bad_line;
+
+        if (!in) {
+            ERROR_NO("Unable to open arrival trace '%s'", arrival_trace_file);
+        }
+        if (!read_arrival_trace(in, &trace_us, &bad_line)) {
+            ERROR("Bad or decreasing arrival time on line %d of '%s'", bad_line, arrival_trace_file);
+        }
+        if (trace_us.empty()) {
+            ERROR("The arrival trace '%s' has no arrivals", arrival_trace_file);
+        }
+        process = ARRIVAL_TRACE;
+        /* The trace's average rate sets the open call limit and display. */
+        if (trace_us.back() > 0) {
+            rate = (trace_us.size() - 1) * (rate_period_ms * 1000.0) / trace_us.back();
+        }
+    } else if (arrivals && !strcmp(arrivals, "poisson")) {
+        process = ARRIVAL_POISSON;
+    }
+
     instance = new CallGenerationTask();
 }
 
@@ -54,33 +125,58 @@ CallGenerationTask::~CallGenerationTask()
 
 void CallGenerationTask::dump()
 {
-    WARNING("Uniform rate call generation task: %d", rate);
+    switch (process) {
+    case ARRIVAL_UNIFORM:
+        WARNING("Uniform rate call generation task: %d", rate);
+        break;
+    case ARRIVAL_POISSON:
+        WARNING("Poisson call generation task: %d", rate);
+        break;
+    case ARRIVAL_TRACE:
+        WARNING("Trace call generation task: %lu of %lu calls", (unsigned long)trace_next, (unsigned long)trace_us.size());
+        break;
+    }
+}
+
+double CallGenerationTask::us_per_call()
+{
+    return rate_period_ms * 1000.0 / rate;
+}
+
+void CallGenerationTask::advance_arrival()
+{
+    calls_since_last_rate_change++;
+
+    switch (process) {
+    case ARRIVAL_UNIFORM:
+        /* Computed from the rate change so rounding does not add up. */
+        next_arrival_us = last_rate_change_us + (calls_since_last_rate_change + 1) * us_per_call();
+        break;
+    case ARRIVAL_POISSON:
+        next_arrival_us += (unsigned long long)(inter_arrival->sample() + 0.5);
+        break;
+    case ARRIVAL_TRACE:
+        trace_next++;
+        next_arrival_us = trace_next < trace_us.size() ? trace_base_us + trace_us[trace_next] : 0;
+        break;
+    }
 }
 
 unsigned int CallGenerationTask::wake() {
     int retval;
-    if (paused || (users >= 0)) {
+    if (paused || (users >= 0) || !next_arrival_us) {
         // When paused or when we're doing user-based rather than
         // rate-based calls, return a sentinel value to indicate that
         // this task should wait forever before rescheduling.
         retval = DONT_RESCHEDULE;
     } else {
-        float ms_per_call = rate_period_ms/MAX(rate, 1);
-        /* We need to compute when the next call is going to be
-         * opened. The current time is the time when the rate last
-         * changed, plus the number of calls since then multiplied by
-         * the number of milliseconds between each call.
-         *
-         * We then add the number of milliseconds between each call to that
-         * figure. */
-
-        retval = (unsigned long) last_rate_change_time +
-            (calls_since_last_rate_change * ms_per_call) + ms_per_call;
-
-        /* On startup, when last_rate_change_time is 0, this
-        calculation can be 0 (if we're opening multiple calls per ms).
-        But 0 indicates that we should wait forever, so avoid that and
-        return 1 instead. */
+        /* Wake up a little before the next arrival, as the timers are
+         * only as fine as clock_tick; run() waits out the rest of it. */
+        retval = next_arrival_us > PACING_RUN_AHEAD_US ? (next_arrival_us - PACING_RUN_AHEAD_US) / 1000 : 0;
+
+        /* On startup this calculation can be 0 (if we're opening
+        multiple calls per ms). But 0 indicates that we should wait
+        forever, so avoid that and return 1 instead. */
         if (retval == 0 /* DONT_RESCHEDULE */) {
           retval = 1;
         }
@@ -90,7 +186,7 @@ unsigned int CallGenerationTask::wake() {
 
 bool CallGenerationTask::run()
 {
-    int calls_to_open = 0;
+    unsigned long long now = getprecisemicroseconds();
 
     if (quitting) {
         delete this;
@@ -104,83 +200,97 @@ bool CallGenerationTask::run()
 
     unsigned long long current_calls = main_scenario->stats->GetStat(CStat::CPT_C_CurrentCall);
     unsigned long long total_calls = main_scenario->stats->GetStat(CStat::CPT_C_IncomingCallCreated) + main_scenario->stats->GetStat(CStat::CPT_C_OutgoingCallCreated);
+    unsigned long long start_clock = now;
 
     if (users >= 0) {
-        calls_to_open = users - current_calls;
-    } else {
-        float calls_per_ms = rate/rate_period_ms;
-        unsigned int ms_since_last_rate_change = clock_tick - last_rate_change_time;
-        unsigned int expected_total_calls = ms_since_last_rate_change * calls_per_ms;
-        calls_to_open = expected_total_calls - calls_since_last_rate_change;
-    }
-
-    if (total_calls + calls_to_open > stop_after) {
-        calls_to_open = stop_after - total_calls;
-    }
+        int calls_to_open = users - current_calls;
 
-    /* We base our scheduling on the number of calls made since the last rate
-     * change, but if we reduce the number of calls we open in order to keep
-     * within the limit, that throws this calculation off and brings CPU% up to
-     * 100%. To avoid this, we increment calls_since_last_rate_change here. */
-
-    calls_since_last_rate_change += calls_to_open;
-
-    if (open_calls_allowed && (current_calls + calls_to_open > open_calls_allowed)) {
-        calls_to_open = open_calls_allowed - current_calls;
-    }
+        if (total_calls + calls_to_open > stop_after) {
+            calls_to_open = stop_after - total_calls;
+        }
 
-    if (calls_to_open <= 0) {
-        calls_to_open = 0;
-    }
+        calls_since_last_rate_change += calls_to_open;
 
-    unsigned int start_clock = getmilliseconds();
+        if (open_calls_allowed && (current_calls + calls_to_open > open_calls_allowed)) {
+            calls_to_open = open_calls_allowed - current_calls;
+        }
 
+        if (calls_to_open <= 0) {
+            calls_to_open = 0;
+        }
 
-    while(calls_to_open--) {
-        /* Associate a user with this call, if we are in users mode. */
-        int userid = 0;
-        if (users >= 0) {
-            userid = freeUsers.back();
+        while(calls_to_open--) {
+            /* Associate a user with this call. */
+            int userid = freeUsers.back();
             freeUsers.pop_back();
+            open_call(userid);
+
+            // We shouldn't run for more than 1ms, so as not to tie up the scheduler
+            if (getprecisemicroseconds() - start_clock >= 1000) {
+                break;
+            }
         }
 
-        // Adding a new outgoing call
-        main_scenario->stats->computeStat(CStat::E_CREATE_OUTGOING_CALL);
-        call* call_ptr = call::add_call(userid,
-                                         local_ip_is_ipv6,
-                                         use_remote_sending_addr ? &remote_sending_sockaddr : &remote_sockaddr);
-        if(!call_ptr) {
-            ERROR("Out of memory allocating call!");
+        if (calls_to_open <= 0) {
+            setPaused();
+        } else {
+            // We stopped before opening all the calls we needed to so as
+            // not to tie up the scheduler - don't pause this task, so
+            // that it gets rescheduled ASAP and can continue.
         }
+    } else {
+        /* The load is open loop: each arrival that is due starts a call
+         * whatever became of the earlier ones, and one that would go over
+         * the open call limit is dropped rather than delayed. */
+        int burst = 0;
+
+        while (next_arrival_us && next_arrival_us <= now && total_calls < stop_after) {
+            // Catch up on a late schedule a few calls at a time, and
+            // don't run for more than 1ms so as not to tie up the scheduler.
+            if ((rate_max_burst && burst >= rate_max_burst) || now - start_clock >= 1000) {
+                break;
+            }
 
-        outbound_congestion = false;
+            unsigned long long due = next_arrival_us;
+            advance_arrival();
+            arrivals_offered++;
+            if (open_calls_allowed && current_calls >= open_calls_allowed) {
+                continue;
+            }
 
-        if (!multisocket) {
-            switch(transport) {
-            case T_UDP:
-                call_ptr->associate_socket(main_socket);
-                main_socket->ss_count++;
-                break;
-            case T_TCP:
-            case T_SCTP:
-            case T_TLS:
-                call_ptr->associate_socket(tcp_multiplex);
-                tcp_multiplex->ss_count++;
-                break;
+            if (last_call_start_us) {
+                long long jitter = (long long)(now - last_call_start_us) - (long long)(due - last_call_due_us);
+                if (jitter < 0) {
+                    jitter = -jitter;
+                }
+                pacing_intervals++;
+                pacing_jitter_sum_us += jitter;
+                if ((unsigned long long)jitter > pacing_jitter_max_us) {
+                    pacing_jitter_max_us = jitter;
+                }
             }
+            last_call_start_us = now;
+            last_call_due_us = due;
+
+            open_call(0);
+            arrivals_started++;
+            current_calls++;
+            total_calls++;
+            burst++;
+            now = getprecisemicroseconds();
         }
-        // We shouldn't run for more than 1ms, so as not to tie up the scheduler
-        if (getmilliseconds() > start_clock) {
-            break;
+
+        /* The timers can not place the next call finer than their tick,
+         * so when it is that close we keep running. */
+        if (!next_arrival_us || next_arrival_us > now + PACING_RUN_AHEAD_US) {
+            setPaused();
         }
-    }
 
-    if (calls_to_open <= 0) {
-        setPaused();
-    } else {
-        // We stopped before opening all the calls we needed to so as
-        // not to tie up the scheduler - don't pause this task, so
-        // that it gets rescheduled ASAP and can continue.
+        // Quit once the trace has been played out
+        if (process == ARRIVAL_TRACE && !next_arrival_us) {
+            quitting = 1;
+            return false;
+        }
     }
 
     // Quit after asked number of calls is reached
@@ -192,6 +302,41 @@ bool CallGenerationTask::run()
     return true;
 }
 
+void CallGenerationTask::open_call(int userid)
+{
+    // Adding a new outgoing call
+    main_scenario->stats->computeStat(CStat::E_CREATE_OUTGOING_CALL);
+    call* call_ptr = call::add_call(userid,
+                                     local_ip_is_ipv6,
+                                     use_remote_sending_addr ? &remote_sending_sockaddr : &remote_sockaddr);
+    if(!call_ptr) {
+        ERROR("Out of memory allocating call!");
+    }
+
+    outbound_congestion = false;
+
+    if (!multisocket) {
+        switch(transport) {
+        case T_UDP:
+            call_ptr->associate_socket(main_socket);
+            main_socket->ss_count++;
+            break;
+        case T_TCP:
+        case T_SCTP:
+        case T_TLS:
+            call_ptr->associate_socket(tcp_multiplex);
+            tcp_multiplex->ss_count++;
+            break;
+        }
+    }
+}
+
+bool CallGenerationTask::call_due_soon()
+{
+    return instance && users < 0 && !paused && next_arrival_us &&
+           next_arrival_us <= getprecisemicroseconds() + 1000;
+}
+
 void CallGenerationTask::set_paused(bool new_paused)
 {
     if (!instance) {
@@ -222,9 +367,31 @@ void CallGenerationTask::set_rate(double new_rate)
         rate = 0;
     }
 
-    last_rate_change_time = getmilliseconds();
+    last_rate_change_us = getprecisemicroseconds();
+    last_call_start_us = 0;
     calls_since_last_rate_change = 0;
 
+    switch (process) {
+    case ARRIVAL_UNIFORM:
+        next_arrival_us = rate > 0 ? last_rate_change_us + us_per_call() : 0;
+        break;
+    case ARRIVAL_POISSON:
+        delete inter_arrival;
+        inter_arrival = NULL;
+        next_arrival_us = 0;
+        if (rate > 0) {
+            inter_arrival = new CExponential(us_per_call());
+            next_arrival_us = last_rate_change_us + (unsigned long long)(inter_arrival->sample() + 0.5);
+        }
+        break;
+    case ARRIVAL_TRACE:
+        /* The trace sets its own pace; carry on from where it was, as
+         * after a pause. */
+        trace_base_us = last_rate_change_us - (trace_next ? trace_us[trace_next - 1] : 0);
+        next_arrival_us = trace_next < trace_us.size() ? trace_base_us + trace_us[trace_next] : 0;
+        break;
+    }
+
     if(!open_calls_user_setting) {
 
         // Calculate the maximum number of open calls from the rate
@@ -273,7 +440,7 @@ void CallGenerationTask::set_users(int new_users)
 
     users = open_calls_allowed = new_users;
 
-    last_rate_change_time = clock_tick;
+    last_rate_change_us = getprecisemicroseconds();
     calls_since_last_rate_change = 0;
 
     assert(open_calls_user_setting);
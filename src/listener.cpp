@@ -26,11 +26,113 @@
 
 #include "sipp.hpp"
 
-listener_map listeners;
+/* The call table is an open-addressing hash table
+ * with linear probing, keyed by the Call-ID hash that every listener
+ * computes once.  Slots only hold the hash and the listener, so a lookup
+ * compares the Call-ID string once, on the slot that matches. */
+struct listener_slot {
+    unsigned int hash;
+    listener *owner;
+};
+
+struct listener_table {
+    struct listener_slot *slots;
+    unsigned int order;
+    unsigned int count;
+};
+
+#define LISTENER_TABLE_MIN_ORDER 10
+
+static struct listener_table listeners;
+
+unsigned long listener_lookups = 0;
+unsigned long listener_probes = 0;
+
+/* Fibonacci hashing spreads the table index over the high bits. */
+static inline unsigned int listener_home(struct listener_table *table, unsigned int hash)
+{
+    return (hash * 2654435761U) >> (32 - table->order);
+}
+
+static void listener_table_insert(struct listener_table *table, unsigned int hash, listener *owner);
+
+static void listener_table_resize(struct listener_table *table, unsigned int order)
+{
+    struct listener_slot *old_slots = table->slots;
+    unsigned int old_size = old_slots ? (1U << table->order) : 0;
+
+    table->slots = (struct listener_slot *)calloc(1U << order, sizeof(struct listener_slot));
+    if (!table->slots) {
+        ERROR("Out of memory allocating the call table!");
+    }
+    table->order = order;
+    table->count = 0;
+
+    for (unsigned int i = 0; i < old_size; i++) {
+        if (old_slots[i].owner) {
+            listener_table_insert(table, old_slots[i].hash, old_slots[i].owner);
+        }
+    }
+    free(old_slots);
+}
+
+static void listener_table_insert(struct listener_table *table, unsigned int hash, listener *owner)
+{
+    /* Keep the load factor under 3/4 so that probe sequences stay short. */
+    if (!table->slots) {
+        listener_table_resize(table, LISTENER_TABLE_MIN_ORDER);
+    } else if ((table->count + 1) * 4 > (3U << table->order)) {
+        listener_table_resize(table, table->order + 1);
+    }
+
+    unsigned int mask = (1U << table->order) - 1;
+    unsigned int i = listener_home(table, hash);
+    while (table->slots[i].owner) {
+        i = (i + 1) & mask;
+    }
+    table->slots[i].hash = hash;
+    table->slots[i].owner = owner;
+    table->count++;
+}
+
+static void listener_table_remove(struct listener_table *table, unsigned int hash, listener *owner)
+{
+    unsigned int mask = (1U << table->order) - 1;
+    unsigned int i = listener_home(table, hash);
+
+    while (table->slots[i].owner != owner) {
+        assert(table->slots[i].owner);
+        i = (i + 1) & mask;
+    }
+
+    /* Backward shift deletion: pull later members of the probe sequence
+     * into the hole, so that lookups never need tombstones. */
+    unsigned int j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!table->slots[j].owner) {
+            break;
+        }
+        unsigned int home = listener_home(table, table->slots[j].hash);
+        if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) {
+            continue;
+        }
+        table->slots[i] = table->slots[j];
+        i = j;
+    }
+    table->slots[i].owner = NULL;
+    table->count--;
+}
 
 listener::listener(const char *id, bool listening)
 {
-    this->id = strdup(id);
+    this->id_len = strlen(id);
+    if (id_len < sizeof(id_inline)) {
+        this->id = (char *)memcpy(id_inline, id, id_len + 1);
+    } else {
+        this->id = strdup(id);
+    }
+    this->id_hash = call_id_hash(id, id_len);
     this->listening = false;
     if (listening) {
         startListening();
@@ -40,18 +142,14 @@ listener::listener(const char *id, bool listening)
 void listener::startListening()
 {
     assert(!listening);
-    listeners.insert(pair<listener_map::key_type,listener *>(listener_map::key_type(id),this));
+    listener_table_insert(&listeners, id_hash, this);
     listening = true;
 }
 
 void listener::stopListening()
 {
     assert(listening);
-
-    listener_map::iterator listener_it;
-    listener_it = listeners.find(listener_map::key_type(id));
-    listeners.erase(listener_it);
-
+    listener_table_remove(&listeners, id_hash, this);
     listening = false;
 }
 
@@ -65,16 +163,37 @@ listener::~listener()
     if (listening) {
         stopListening();
     }
-    free(id);
+    if (id != id_inline) {
+        free(id);
+    }
     id = NULL;
 
 }
 
-listener *get_listener(const char *id)
+listener *get_listener(const char *id, size_t len, unsigned int hash)
 {
-    listener_map::iterator listener_it = listeners.find(listener_map::key_type(id));
-    if (listener_it == listeners.end()) {
+    struct listener_table *table = &listeners;
+
+    listener_lookups++;
+    if (!table->slots) {
         return NULL;
     }
-    return listener_it->second;
+
+    unsigned int mask = (1U << table->order) - 1;
+    for (unsigned int i = listener_home(table, hash); table->slots[i].owner; i = (i + 1) & mask) {
+        listener_probes++;
+        listener *owner = table->slots[i].owner;
+        if ((table->slots[i].hash == hash) &&
+                (owner->id_len == len) &&
+                !memcmp(owner->id, id, len)) {
+            return owner;
+        }
+    }
+    return NULL;
+}
+
+listener *get_listener(const char *id)
+{
+    size_t len = strlen(id);
+    return get_listener(id, len, call_id_hash(id, len));
 }
@@ -41,6 +41,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "logger.hpp"
 #include "screen.hpp"
 #include "sipp.hpp"
@@ -228,6 +229,8 @@ void print_statistics(int last)
     extern int command_mode;
     extern char *command_buffer;
 
+    CStat::foldThreadCounters();
+
     if(backgroundMode == false && display_scenario) {
         if(!last) {
             screen_clear();
@@ -294,8 +297,234 @@ void print_statistics(int last)
     }
 }
 
+/* Trace records are appended by each traffic thread to its own ring and
+ * written out by the logger thread, so that -trace_msg and friends cost a
+ * vsnprintf() on the hot path instead of a stdio call and a write(). Only
+ * the logger thread, or a thread holding logger_mutex, consumes the rings
+ * and touches the FILE pointers of the traced log files. */
+struct log_record {
+    struct logfile_info *lfi;   /* NULL pads the ring up to its end */
+    unsigned int len;
+};
+
+#define LOG_RECORD_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#define LOG_RECORD_HDR      LOG_RECORD_ALIGN(sizeof(struct log_record))
+
+struct log_ring {
+    char *buf;
+    size_t size;                /* power of two */
+    size_t head;                /* advanced by the consumer */
+    size_t tail;                /* advanced by the owning thread */
+    unsigned long dropped;
+    struct log_ring *next;
+};
+
+static pthread_once_t logger_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t logger_mutex;
+static pthread_t logger_tid;
+static int logger_started = 0;  /* 1 while running, 2 once stopped */
+static int logger_stop = 0;
+static struct log_ring *log_rings = NULL;
+static __thread struct log_ring *my_log_ring = NULL;
+
+static void _trace_write(struct logfile_info *lfi, const char *data, unsigned int len);
+
+static void drain_log_ring(struct log_ring *r)
+{
+    size_t head = r->head;
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        size_t off = head & (r->size - 1);
+        size_t contig = r->size - off;
+        struct log_record *rec = (struct log_record *)(r->buf + off);
+
+        if (contig < LOG_RECORD_HDR || !rec->lfi) {
+            head += contig;
+            continue;
+        }
+        _trace_write(rec->lfi, r->buf + off + LOG_RECORD_HDR, rec->len);
+        head += LOG_RECORD_ALIGN(LOG_RECORD_HDR + rec->len);
+    }
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+}
+
+static void drain_logs()
+{
+    for (struct log_ring *r = log_rings; r; r = r->next) {
+        drain_log_ring(r);
+    }
+    if (message_lfi.fptr) fflush(message_lfi.fptr);
+    if (shortmessage_lfi.fptr) fflush(shortmessage_lfi.fptr);
+    if (calldebug_lfi.fptr) fflush(calldebug_lfi.fptr);
+    if (log_lfi.fptr) fflush(log_lfi.fptr);
+    if (pcapng_lfi.fptr) fflush(pcapng_lfi.fptr);
+}
+
+static void *logger_thread(void *)
+{
+    while (!__atomic_load_n(&logger_stop, __ATOMIC_ACQUIRE)) {
+        usleep(LOGGER_SLEEP_US);
+        /* Never block here: the thread stopping us may hold the mutex
+         * while it waits for us to exit. */
+        if (pthread_mutex_trylock(&logger_mutex) == 0) {
+            drain_logs();
+            pthread_mutex_unlock(&logger_mutex);
+        }
+    }
+    return NULL;
+}
+
+/* Stop the logger thread for good, so that it is not writing to the log
+ * files while exit() tears stdio down. The rings are drained by the
+ * caller from then on. */
+static void stop_logger_thread()
+{
+    if (__atomic_exchange_n(&logger_started, 2, __ATOMIC_ACQ_REL) != 1) {
+        return;
+    }
+    __atomic_store_n(&logger_stop, 1, __ATOMIC_RELEASE);
+    if (!pthread_equal(pthread_self(), logger_tid)) {
+        pthread_join(logger_tid, NULL);
+    }
+}
+
+static void logger_mutex_init()
+{
+    pthread_mutexattr_t attr;
+
+    /* Recursive: an ERROR() raised while rotating ends up in flush_logs(). */
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&logger_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/* The logger thread does not survive the fork() of -bg: it is started again
+ * in the child along with its next record. */
+static void logger_atfork_child()
+{
+    logger_mutex_init();
+    logger_started = 0;
+    logger_stop = 0;
+}
+
+static void logger_init()
+{
+    logger_mutex_init();
+    pthread_atfork(NULL, NULL, logger_atfork_child);
+}
+
+static void logger_lock()
+{
+    pthread_once(&logger_once, logger_init);
+    pthread_mutex_lock(&logger_mutex);
+}
+
+static void logger_unlock()
+{
+    pthread_mutex_unlock(&logger_mutex);
+}
+
+static struct log_ring *get_log_ring()
+{
+    if (!my_log_ring) {
+        struct log_ring *r = (struct log_ring *)calloc(1, sizeof(*r));
+        r->size = 4096;
+        while (r->size < trace_buffer_size) {
+            r->size <<= 1;
+        }
+        r->buf = (char *)malloc(r->size);
+        if (!r->buf) {
+            ERROR("Unable to allocate a %lu bytes trace buffer", (unsigned long)r->size);
+        }
+        logger_lock();
+        r->next = log_rings;
+        log_rings = r;
+        logger_unlock();
+        my_log_ring = r;
+    }
+    if (!__atomic_load_n(&logger_started, __ATOMIC_RELAXED) &&
+            !__atomic_exchange_n(&logger_started, 1, __ATOMIC_ACQ_REL)) {
+        if (pthread_create(&logger_tid, NULL, logger_thread, NULL) != 0) {
+            ERROR_NO("Unable to start the logger thread");
+        }
+    }
+    return my_log_ring;
+}
+
+/* Room available at the tail of the ring without wrapping. */
+static size_t log_ring_contiguous(struct log_ring *r)
+{
+    size_t room = r->size - (r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE));
+    size_t contig = r->size - (r->tail & (r->size - 1));
+
+    return room < contig ? room : contig;
+}
+
+char *trace_reserve(size_t len)
+{
+    struct log_ring *r = get_log_ring();
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = r->size - (r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE));
+        size_t off = r->tail & (r->size - 1);
+        size_t contig = r->size - off;
+
+        if (LOG_RECORD_HDR + len <= (room < contig ? room : contig)) {
+            return r->buf + off + LOG_RECORD_HDR;
+        }
+
+        /* Wrap around when the record fits at the start of the ring. */
+        if (contig >= room || LOG_RECORD_HDR + len > room - contig) {
+            break;
+        }
+        if (contig >= LOG_RECORD_HDR) {
+            ((struct log_record *)(r->buf + off))->lfi = NULL;
+        }
+        __atomic_store_n(&r->tail, r->tail + contig, __ATOMIC_RELEASE);
+    }
+
+    if (__atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED) == 0) {
+        WARNING("The logger thread can not keep up, trace records are being dropped (see -trace_buffer_size)");
+    }
+    return NULL;
+}
+
+void trace_commit(struct logfile_info *lfi, size_t len)
+{
+    struct log_ring *r = my_log_ring;
+    struct log_record *rec = (struct log_record *)(r->buf + (r->tail & (r->size - 1)));
+
+    rec->lfi = lfi;
+    rec->len = len;
+    __atomic_store_n(&r->tail, r->tail + LOG_RECORD_ALIGN(LOG_RECORD_HDR + len),
+                     __ATOMIC_RELEASE);
+}
+
+unsigned long flush_logs()
+{
+    unsigned long dropped = 0;
+
+    stop_logger_thread();
+    logger_lock();
+    drain_logs();
+    for (struct log_ring *r = log_rings; r; r = r->next) {
+        dropped += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    }
+    logger_unlock();
+
+    if (dropped) {
+        fprintf(stderr, "%lu trace records were dropped because the trace buffer was full.\n", dropped);
+    }
+    return dropped;
+}
+
 void log_off(struct logfile_info *lfi)
 {
+    logger_lock();
+    drain_logs();
+    logger_unlock();
     if (lfi->fptr) {
         fflush(lfi->fptr);
         fclose(lfi->fptr);
@@ -394,9 +623,54 @@ void print_stats_in_file(FILE * f)
             temp_str,
             display_scenario->stats->GetStat(CStat::CPT_C_CurrentCallPeak),
             display_scenario->stats->GetStat(CStat::CPT_C_CurrentCallPeakTime));
-    fprintf(f,"  %d Running, %d Paused, %d Woken up" SIPP_ENDL,
-            last_running_calls, last_paused_calls, last_woken_calls);
+    fprintf(f,"  %d Running, %d Paused, %d Woken up, %.2f probes per lookup" SIPP_ENDL,
+            last_running_calls, last_paused_calls, last_woken_calls,
+            listener_lookups ? (double)listener_probes / listener_lookups : 0.0);
     last_woken_calls = 0;
+    listener_lookups = 0;
+    listener_probes = 0;
+    if (recv_batch > 1) {
+        fprintf(f,"  %.1f datagrams per recvmmsg() call" SIPP_ENDL,
+                recv_batches ? (double)recv_batch_msgs / recv_batches : 0.0);
+        recv_batches = 0;
+        recv_batch_msgs = 0;
+    }
+    if (send_batch > 1) {
+        fprintf(f,"  %.1f datagrams per sendmmsg() call, %lu system calls saved" SIPP_ENDL,
+                send_batches ? (double)send_batch_msgs / send_batches : 0.0,
+                send_batch_msgs - send_batches);
+        send_batches = 0;
+        send_batch_msgs = 0;
+    }
+    fprintf(f,"  %lu socket buffers reused, %lu allocated" SIPP_ENDL,
+            socketbuf_pool_hits, socketbuf_pool_misses);
+    socketbuf_pool_hits = 0;
+    socketbuf_pool_misses = 0;
+    if (call_arena_calls) {
+        fprintf(f,"  %.1f mallocs per completed call for call state" SIPP_ENDL,
+                (double)call_arena_mallocs / call_arena_calls);
+        call_arena_mallocs = 0;
+        call_arena_calls = 0;
+    }
+    fprintf(f,"  %lu calls reused from the call pool, %lu allocated" SIPP_ENDL,
+            call_pool_hits, call_pool_misses);
+    call_pool_hits = 0;
+    call_pool_misses = 0;
+    if (pacing_intervals) {
+        fprintf(f,"  Call start jitter: %.1f us average, %llu us max" SIPP_ENDL,
+                (double)pacing_jitter_sum_us / pacing_intervals, pacing_jitter_max_us);
+        pacing_intervals = 0;
+        pacing_jitter_sum_us = 0;
+        pacing_jitter_max_us = 0;
+    }
+    if (arrivals_offered && clock_tick > last_report_time) {
+        double period_s = (clock_tick - last_report_time) / 1000.0;
+        fprintf(f,"  Offered load %.1f cps, achieved %.1f cps, %lu calls dropped at the limit" SIPP_ENDL,
+                arrivals_offered / period_s, arrivals_started / period_s,
+                arrivals_offered - arrivals_started);
+        arrivals_offered = 0;
+        arrivals_started = 0;
+    }
 
     /* 3rd line dead call msgs, and optional out-of-call msg */
     sprintf(temp_str,"%llu dead call msg (discarded)",
@@ -476,6 +750,10 @@ void print_stats_in_file(FILE * f)
     sprintf(temp_str, "%lu RTP sending threads active",rtpstream_numthreads);
     fprintf(f,"  %-38s %.3f kB/s RTP IN" SIPP_ENDL,
               temp_str,last_rtpstream_rate_in);
+
+    sprintf(temp_str, "%lu Total RTP pckts received",rtpstream_pckts_in);
+    fprintf(f,"  %-38s %lu calls ended without RTP IN" SIPP_ENDL,
+              temp_str,rtpstream_calls_no_rtp_in);
   }
 #endif
 
@@ -857,8 +1135,10 @@ void rotatef(struct logfile_info *lfi)
 {
     char L_rotate_file_name [MAX_PATH];
 
+    const char *extension = lfi->extension ? lfi->extension : ".log";
+
     if (!lfi->fixedname) {
-        sprintf (lfi->file_name, "%s_%d_%s.log", scenario_file, getpid(), lfi->name);
+        sprintf (lfi->file_name, "%s_%d_%s%s", scenario_file, getpid(), lfi->name, extension);
     }
 
     if (ringbuffer_files > 0) {
@@ -868,9 +1148,9 @@ void rotatef(struct logfile_info *lfi)
         /* We need to rotate away an existing file. */
         if (lfi->nfiles == ringbuffer_files) {
             if ((lfi->ftimes)[0].n) {
-                sprintf(L_rotate_file_name, "%s_%d_%s_%lu.%d.log", scenario_file, getpid(), lfi->name, (lfi->ftimes)[0].start, (lfi->ftimes)[0].n);
+                sprintf(L_rotate_file_name, "%s_%d_%s_%lu.%d%s", scenario_file, getpid(), lfi->name, (lfi->ftimes)[0].start, (lfi->ftimes)[0].n, extension);
             } else {
-                sprintf(L_rotate_file_name, "%s_%d_%s_%lu.log", scenario_file, getpid(), lfi->name, (lfi->ftimes)[0].start);
+                sprintf(L_rotate_file_name, "%s_%d_%s_%lu%s", scenario_file, getpid(), lfi->name, (lfi->ftimes)[0].start, extension);
             }
             unlink(L_rotate_file_name);
             lfi->nfiles--;
@@ -884,9 +1164,9 @@ void rotatef(struct logfile_info *lfi)
                 (lfi->ftimes)[lfi->nfiles].n = (lfi->ftimes)[lfi->nfiles - 1].n + 1;
             }
             if ((lfi->ftimes)[lfi->nfiles].n) {
-                sprintf(L_rotate_file_name, "%s_%d_%s_%lu.%d.log", scenario_file, getpid(), lfi->name, (lfi->ftimes)[lfi->nfiles].start, (lfi->ftimes)[lfi->nfiles].n);
+                sprintf(L_rotate_file_name, "%s_%d_%s_%lu.%d%s", scenario_file, getpid(), lfi->name, (lfi->ftimes)[lfi->nfiles].start, (lfi->ftimes)[lfi->nfiles].n, extension);
             } else {
-                sprintf(L_rotate_file_name, "%s_%d_%s_%lu.log", scenario_file, getpid(), lfi->name, (lfi->ftimes)[lfi->nfiles].start);
+                sprintf(L_rotate_file_name, "%s_%d_%s_%lu%s", scenario_file, getpid(), lfi->name, (lfi->ftimes)[lfi->nfiles].start, extension);
             }
             lfi->nfiles++;
             fflush(lfi->fptr);
@@ -907,28 +1187,76 @@ void rotatef(struct logfile_info *lfi)
         /* We can not use the error functions from this function, as we may be rotating the error log itself! */
         ERROR("Unable to create '%s'", lfi->file_name);
     }
+    if (lfi->fptr && lfi->header) {
+        lfi->header(lfi->fptr);
+        fflush(lfi->fptr);
+    }
+}
+
+/* The traced log files are also rotated by the logger thread, and records
+ * already queued belong in the file being rotated away. */
+static void rotatef_locked(struct logfile_info *lfi)
+{
+    logger_lock();
+    drain_logs();
+    rotatef(lfi);
+    logger_unlock();
 }
 
 void rotate_calldebugf()
 {
-    rotatef(&calldebug_lfi);
+    rotatef_locked(&calldebug_lfi);
 }
 
 void rotate_messagef()
 {
-    rotatef(&message_lfi);
+    rotatef_locked(&message_lfi);
 }
 
 
 void rotate_shortmessagef()
 {
-    rotatef(&shortmessage_lfi);
+    rotatef_locked(&shortmessage_lfi);
 }
 
 
 void rotate_logfile()
 {
-    rotatef(&log_lfi);
+    rotatef_locked(&log_lfi);
+}
+
+void rotate_pcapngf()
+{
+    rotatef_locked(&pcapng_lfi);
+}
+
+/* -trace_pcapng files hold one pcapng section per file, with a single
+ * raw IP interface whose timestamps are in microseconds. */
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+#define PCAPNG_LINKTYPE_RAW 101
+#define PCAPNG_EPB_LEN      32
+#define PCAPNG_PAD4(n)      (((n) + 3) & ~(size_t)3)
+
+void pcapng_header(FILE *f)
+{
+    uint32_t shb[3] = { PCAPNG_SHB, 28, PCAPNG_BYTE_ORDER };
+    uint16_t version[2] = { 1, 0 };
+    uint64_t section_len = ~0ULL;
+    uint32_t shb_len = 28;
+    uint32_t idb[2] = { PCAPNG_IDB, 20 };
+    uint16_t linktype[2] = { PCAPNG_LINKTYPE_RAW, 0 };
+    uint32_t idb_tail[2] = { 0, 20 };
+
+    fwrite(shb, sizeof(shb), 1, f);
+    fwrite(version, sizeof(version), 1, f);
+    fwrite(&section_len, sizeof(section_len), 1, f);
+    fwrite(&shb_len, sizeof(shb_len), 1, f);
+    fwrite(idb, sizeof(idb), 1, f);
+    fwrite(linktype, sizeof(linktype), 1, f);
+    fwrite(idb_tail, sizeof(idb_tail), 1, f);
 }
 
 void rotate_errorf()
@@ -943,14 +1271,12 @@ extern "C" {
 #endif
  * w
 */
-    int _trace (struct logfile_info *lfi, const char *fmt, va_list ap)
+    static void _trace_write(struct logfile_info *lfi, const char *data, unsigned int len)
     {
-        int ret = 0;
         if(lfi->fptr) {
-            ret = vfprintf(lfi->fptr, fmt, ap);
-            fflush(lfi->fptr);
+            fwrite(data, 1, len, lfi->fptr);
 
-            lfi->count += ret;
+            lfi->count += len;
 
             if (max_log_size && lfi->count > max_log_size) {
                 fclose(lfi->fptr);
@@ -962,6 +1288,42 @@ extern "C" {
                 lfi->count = 0;
             }
         }
+    }
+
+    int _trace (struct logfile_info *lfi, const char *fmt, va_list ap)
+    {
+        struct log_ring *r;
+        char *p;
+        va_list aq;
+        int ret;
+
+        if(!lfi->fptr) {
+            return 0;
+        }
+
+        /* Format in place when the record fits before the end of the ring,
+         * which is nearly always the case. */
+        r = get_log_ring();
+        size_t avail = log_ring_contiguous(r);
+        va_copy(aq, ap);
+        if (avail > LOG_RECORD_HDR) {
+            ret = vsnprintf(r->buf + (r->tail & (r->size - 1)) + LOG_RECORD_HDR,
+                            avail - LOG_RECORD_HDR, fmt, aq);
+        } else {
+            ret = vsnprintf(NULL, 0, fmt, aq);
+        }
+        va_end(aq);
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (LOG_RECORD_HDR + ret >= avail) {
+            if (!(p = trace_reserve(ret + 1))) {
+                return 0;
+            }
+            vsnprintf(p, ret + 1, fmt, ap);
+        }
+        trace_commit(lfi, ret);
         return ret;
     }
 
@@ -1013,6 +1375,113 @@ extern "C" {
 
         return ret;
     }
+    static unsigned char *put16(unsigned char *p, uint16_t v)
+    {
+        v = htons(v);
+        memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    }
+
+    static unsigned char *put32(unsigned char *p, uint32_t v)
+    {
+        v = htonl(v);
+        memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    }
+
+    /* Queue msg as a synthetic IPv4 or IPv6, UDP or TCP packet. */
+    void TRACE_PCAPNG(const struct timeval *when, const struct sockaddr_storage *from,
+                      const struct sockaddr_storage *to, bool stream, unsigned int seq,
+                      const char *msg, size_t len)
+    {
+        bool ipv6 = from->ss_family == AF_INET6 || to->ss_family == AF_INET6;
+        size_t ip_len = ipv6 ? 40 : 20;
+        size_t l4_len = stream ? 20 : 8;
+        unsigned long long ts;
+        uint32_t block_len;
+        uint16_t sport, dport;
+        unsigned char *p, *ip;
+        static const char any[16] = { 0 };
+        char *block;
+
+        if (!pcapng_lfi.fptr) {
+            return;
+        }
+        if (len > 65535 - ip_len - l4_len) {
+            len = 65535 - ip_len - l4_len;
+        }
+        size_t pkt_len = ip_len + l4_len + len;
+        block_len = PCAPNG_EPB_LEN + PCAPNG_PAD4(pkt_len);
+        if (!(block = trace_reserve(block_len))) {
+            return;
+        }
+
+        /* Enhanced packet block, in host byte order. */
+        ts = (unsigned long long)when->tv_sec * 1000000 + when->tv_usec;
+        uint32_t epb[7] = { PCAPNG_EPB, block_len, 0, (uint32_t)(ts >> 32), (uint32_t)ts,
+                            (uint32_t)pkt_len, (uint32_t)pkt_len
+                          };
+        memcpy(block, epb, sizeof(epb));
+        memcpy(block + block_len - 4, &block_len, 4);
+        memset(block + block_len - 4 - (PCAPNG_PAD4(pkt_len) - pkt_len), 0,
+               PCAPNG_PAD4(pkt_len) - pkt_len);
+
+        ip = p = (unsigned char *)block + sizeof(epb);
+        if (ipv6) {
+            const struct sockaddr_in6 *s6 = (const struct sockaddr_in6 *)from;
+            const struct sockaddr_in6 *d6 = (const struct sockaddr_in6 *)to;
+
+            p = put32(p, 6 << 28);
+            p = put16(p, l4_len + len);
+            *p++ = stream ? IPPROTO_TCP : IPPROTO_UDP;
+            *p++ = 64;
+            memcpy(p, from->ss_family == AF_INET6 ? &s6->sin6_addr : (const void *)any, 16);
+            memcpy(p + 16, to->ss_family == AF_INET6 ? &d6->sin6_addr : (const void *)any, 16);
+            p += 32;
+            sport = from->ss_family == AF_INET6 ? ntohs(s6->sin6_port) : 0;
+            dport = to->ss_family == AF_INET6 ? ntohs(d6->sin6_port) : 0;
+        } else {
+            const struct sockaddr_in *s4 = (const struct sockaddr_in *)from;
+            const struct sockaddr_in *d4 = (const struct sockaddr_in *)to;
+            uint32_t sum = 0;
+
+            *p++ = 0x45;
+            *p++ = 0;
+            p = put16(p, pkt_len);
+            p = put32(p, 0x4000); /* DF */
+            *p++ = 64;
+            *p++ = stream ? IPPROTO_TCP : IPPROTO_UDP;
+            p = put16(p, 0);
+            memcpy(p, from->ss_family == AF_INET ? &s4->sin_addr : (const void *)any, 4);
+            memcpy(p + 4, to->ss_family == AF_INET ? &d4->sin_addr : (const void *)any, 4);
+            p += 8;
+            for (int i = 0; i < 20; i += 2) {
+                sum += (ip[i] << 8) | ip[i + 1];
+            }
+            sum = (sum & 0xffff) + (sum >> 16);
+            sum = (sum & 0xffff) + (sum >> 16);
+            put16(ip + 10, ~sum);
+            sport = from->ss_family == AF_INET ? ntohs(s4->sin_port) : 0;
+            dport = to->ss_family == AF_INET ? ntohs(d4->sin_port) : 0;
+        }
+
+        p = put16(p, sport);
+        p = put16(p, dport);
+        if (stream) {
+            p = put32(p, seq);
+            p = put32(p, 0);
+            *p++ = 5 << 4;
+            *p++ = 0x18; /* PSH, ACK */
+            p = put16(p, 65535);
+            p = put32(p, 0); /* checksum, urgent pointer */
+        } else {
+            p = put16(p, l4_len + len);
+            p = put16(p, 0); /* no checksum */
+        }
+        memcpy(p, msg, len);
+
+        trace_commit(&pcapng_lfi, block_len);
+    }
 /*
 #ifdef __cplusplus
 }
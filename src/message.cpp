@@ -106,6 +106,7 @@ SendingMessage::SendingMessage(scenario *msg_scenario, char *const_src, bool ski
     int    num_cr = get_cr_number(src);
 
     this->msg_scenario = msg_scenario;
+    this->compiled = false;
 
     dest = literal = (char *)malloc(strlen(src) + num_cr + 1);
     literalLen = 0;
@@ -609,6 +610,151 @@ void SendingMessage::freeMessageComponent(struct MessageComponent *comp)
     free(comp);
 }
 
+/* Keywords that depend only on the command line and the sockets opened
+ * at startup render the same text for every call. Returns false for
+ * anything that has to be computed when the message is sent. */
+bool SendingMessage::getConstantValue(struct MessageComponent *comp, char *buf, int size)
+{
+    switch(comp->type) {
+    case E_Message_Remote_IP:
+        snprintf(buf, size, "%s", remote_ip_escaped);
+        return true;
+    case E_Message_Remote_Host:
+        snprintf(buf, size, "%s", remote_host);
+        return true;
+    case E_Message_Remote_Port:
+        snprintf(buf, size, "%d", remote_port + comp->offset);
+        return true;
+    case E_Message_Transport:
+        snprintf(buf, size, "%s", TRANSPORT_TO_STRING(transport));
+        return true;
+    case E_Message_Local_IP:
+        snprintf(buf, size, "%s", local_ip_escaped);
+        return true;
+    case E_Message_Local_IP_Type:
+        snprintf(buf, size, "%s", (local_ip_is_ipv6 ? "6" : "4"));
+        return true;
+    case E_Message_Local_Port:
+        /* Each UDP client call has its own port with -t un. */
+        if ((transport == T_UDP) && (multisocket) && (sendMode != MODE_SERVER)) {
+            return false;
+        }
+        snprintf(buf, size, "%d", local_port + comp->offset);
+        return true;
+    case E_Message_Media_IP:
+        snprintf(buf, size, "%s", media_ip_escaped);
+        return true;
+    case E_Message_Media_IP_Type:
+        snprintf(buf, size, "%s", (media_ip_is_ipv6 ? "6" : "4"));
+        return true;
+#ifndef PCAPPLAY
+    /* With PCAPPLAY the port is also recorded for the play_pcap actions. */
+    case E_Message_Media_Port:
+        snprintf(buf, size, "%u", media_port + comp->offset);
+        return true;
+#endif
+    case E_Message_PID:
+        snprintf(buf, size, "%d", pid);
+        return true;
+    case E_Message_Service:
+        snprintf(buf, size, "%s", service);
+        return true;
+    case E_Message_SippVersion:
+        snprintf(buf, size, "%s", SIPP_VERSION);
+        return true;
+    default:
+        return false;
+    }
+}
+
+void SendingMessage::appendLiteral(struct MessageComponent *dst, const char *src, int len)
+{
+    dst->literal = (char *)realloc(dst->literal, dst->literalLen + len + 1);
+    if (!dst->literal) {
+        ERROR("Out of memory!");
+    }
+    memcpy(dst->literal + dst->literalLen, src, len);
+    dst->literalLen += len;
+    dst->literal[dst->literalLen] = '\0';
+}
+
+static bool is_blank(const char *str)
+{
+    while (isspace(*str)) {
+        str++;
+    }
+    return !*str;
+}
+
+/* Called on the first send once the sockets are open, so that rendering
+ * is left with one memcpy per run of static text. The keywords that
+ * swallow the following CRLF ([routes], [last_*], variables and
+ * injections) only do so for the first literal after them, so nothing
+ * is folded while that is pending and a blank literal is not merged with
+ * one that starts with whitespace. */
+void SendingMessage::compile()
+{
+    std::vector <struct MessageComponent *> folded;
+    struct MessageComponent *last = NULL; /* Literal we may append to. */
+    bool crlf_pending = false;
+    bool keep_apart = false;
+
+    if (compiled) {
+        return;
+    }
+    compiled = true;
+
+    for (unsigned int i = 0; i < messageComponents.size(); i++) {
+        MessageComponent *comp = messageComponents[i];
+        char value[MAX_HEADER_LEN];
+
+        switch (comp->type) {
+        case E_Message_Literal:
+            if (last && (!keep_apart || !isspace(*comp->literal) || !is_blank(last->literal))) {
+                appendLiteral(last, comp->literal, comp->literalLen);
+                freeMessageComponent(comp);
+                continue;
+            }
+            folded.push_back(comp);
+            last = comp;
+            keep_apart = crlf_pending;
+            crlf_pending = false;
+            continue;
+        case E_Message_Routes:
+        case E_Message_Variable:
+        case E_Message_Injection:
+        case E_Message_Last_Header:
+            crlf_pending = true;
+            break;
+        default:
+            if (!crlf_pending && getConstantValue(comp, value, sizeof(value))) {
+                if (last) {
+                    appendLiteral(last, value, strlen(value));
+                    freeMessageComponent(comp);
+                } else {
+                    comp->type = E_Message_Literal;
+                    comp->offset = 0;
+                    comp->literalLen = 0;
+                    appendLiteral(comp, value, strlen(value));
+                    folded.push_back(comp);
+                    last = comp;
+                    keep_apart = false;
+                }
+                continue;
+            }
+            break;
+        }
+        folded.push_back(comp);
+        last = NULL;
+    }
+    messageComponents.swap(folded);
+}
+
+bool SendingMessage::isCompiled()
+{
+    return compiled;
+}
+
 int SendingMessage::numComponents()
 {
     return messageComponents.size();
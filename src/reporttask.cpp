@@ -90,6 +90,8 @@ unsigned int screentask::wake()
 
 void stattask::report()
 {
+    CStat::foldThreadCounters();
+
     if(dumpInFile) {
         main_scenario->stats->dumpData();
     }
@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <pthread.h>
+#include <sched.h>
 #include "rtpstream.hpp"
 
 /* stub to add extra debugging/logging... */
@@ -37,6 +38,11 @@ void debugprint (const char *Format,...)
 #define BIND_MAX_TRIES                100
 #define RTPSTREAM_THREADBLOCKSIZE     16
 #define MAX_UDP_RECV_BUFFER           8192
+#define RTPSTREAM_WHEEL_SLOTS         256   /* 1ms slots, a power of 2 */
+#define RTPSTREAM_MAX_SLEEP_MS        10    /* how long new work may wait */
+#define RTPSTREAM_IDLE_MS             100   /* how often idle tasks are run */
+#define RTPSTREAM_EPOLL_EVENTS        64    /* ready sockets read per wakeup */
+#define RTPSTREAM_SEND_BATCH          8     /* packets sent per system call */
 
 #define TI_NULL_AUDIOIP               0x01
 #define TI_NULL_VIDEOIP               0x02
@@ -48,6 +54,13 @@ void debugprint (const char *Format,...)
 #define TI_PLAYFILE                   0x40
 #define TI_CONFIGFLAGS                (TI_KILLTASK|TI_RECONNECTSOCKET|TI_PLAYFILE)
 
+/* the sockets of a task, also the low bits of its epoll event data */
+#define TS_AUDIO_RTP                  0
+#define TS_AUDIO_RTCP                 1
+#define TS_VIDEO_RTP                  2
+#define TS_VIDEO_RTCP                 3
+#define TS_NUM_SOCKETS                4
+
 struct rtp_header_t
 {
  uint16_t         flags;
@@ -60,7 +73,15 @@ struct taskentry_t
 {
   threaddata_t         *parent_thread;
   unsigned long        nextwake_ms;
+#ifndef HAVE_EPOLL
+  unsigned long        nextdrain_ms;
+#endif
   volatile int         flags;
+  /* timer wheel slot list, only used by the playback thread */
+  taskentry_t          *wheel_next;
+  taskentry_t          **wheel_prev;
+  /* set while the task is waiting on its thread's queue */
+  int                  queued;
 
   /* rtp stream information */
   unsigned long long   last_timestamp;
@@ -100,6 +121,10 @@ struct taskentry_t
   struct sockaddr_storage    remote_video_rtp_addr;
   struct sockaddr_storage    remote_video_rtcp_addr;
 
+  /* what came in on each socket, only written by the playback thread */
+  unsigned long        pckts_in[TS_NUM_SOCKETS];
+  unsigned long        bytes_in[TS_NUM_SOCKETS];
+
   /* we will have a mutex per call. should we consider refactoring to */
   /* share mutexes across calls? makes the per-call code more complex */
 
@@ -109,13 +134,22 @@ struct taskentry_t
 
 struct threaddata_t
 {
-  pthread_mutex_t tasklist_mutex;
   int             busy_list_index;
   int             max_tasks;
-  volatile int    num_tasks;
-  volatile int    del_pending;
+  int             num_tasks;   /* only used by the call thread */
   volatile int    exit_flag;
-  taskentry_t     *tasklist;
+#ifdef HAVE_EPOLL
+  int             epollfd;     /* the sockets of all the thread's tasks */
+#endif
+  /* tasks that need the thread's attention are passed from the call  */
+  /* thread through a single producer, single consumer ring; no locks */
+  unsigned int    queue_head;  /* only written by the playback thread */
+  unsigned int    queue_tail;  /* only written by the call thread */
+  unsigned int    queue_mask;
+  /* timer wheel of tasks keyed by the time they are next due */
+  unsigned long   wheel_ms;    /* slots up to this time have been run */
+  taskentry_t     *wheel[RTPSTREAM_WHEEL_SLOTS];
+  taskentry_t     *queue[1];
 };
 
 struct cached_file_t
@@ -140,6 +174,74 @@ unsigned int  global_ssrc_id= 0xCA110000;
 
 //===================================================================================================
 
+/* the playback threads keep their own time: the coarse clock behind */
+/* getmilliseconds() is too rough for packet pacing and also moves   */
+/* clock_tick, which belongs to the main thread.                     */
+unsigned long rtpstream_now_ms (void)
+{
+  return getprecisemicroseconds()/1000;
+}
+
+/* code checked */
+void rtpstream_wheel_add (threaddata_t *threaddata, taskentry_t *taskinfo)
+{
+  unsigned long  due= taskinfo->nextwake_ms;
+  taskentry_t    **slot;
+
+  /* overdue tasks run on the next slot, far away ones a lap early */
+  if (due<=threaddata->wheel_ms) {
+    due= threaddata->wheel_ms+1;
+  } else if (due-threaddata->wheel_ms>=RTPSTREAM_WHEEL_SLOTS) {
+    due= threaddata->wheel_ms+RTPSTREAM_WHEEL_SLOTS-1;
+  }
+
+  slot= &(threaddata->wheel[due&(RTPSTREAM_WHEEL_SLOTS-1)]);
+  taskinfo->wheel_next= *slot;
+  if (*slot) {
+    (*slot)->wheel_prev= &(taskinfo->wheel_next);
+  }
+  taskinfo->wheel_prev= slot;
+  *slot= taskinfo;
+}
+
+/* code checked */
+void rtpstream_wheel_remove (taskentry_t *taskinfo)
+{
+  if (taskinfo->wheel_prev) {
+    *(taskinfo->wheel_prev)= taskinfo->wheel_next;
+    if (taskinfo->wheel_next) {
+      taskinfo->wheel_next->wheel_prev= taskinfo->wheel_prev;
+    }
+    taskinfo->wheel_next= NULL;
+    taskinfo->wheel_prev= NULL;
+  }
+}
+
+/* code checked */
+/* Ask the playback thread to look at a task's flags. Call thread only. */
+void rtpstream_signal_task (taskentry_t *taskinfo)
+{
+  threaddata_t   *threaddata= taskinfo->parent_thread;
+  unsigned int   tail;
+
+  if (!threaddata) {
+    return;
+  }
+  /* one queue entry per task is enough, the thread reads all the flags */
+  if (__atomic_exchange_n(&(taskinfo->queued),1,__ATOMIC_SEQ_CST)) {
+    return;
+  }
+
+  tail= threaddata->queue_tail;
+  /* the ring has room for two entries per task so this should not */
+  /* happen, but if it does the playback thread will soon make room */
+  while (tail-__atomic_load_n(&(threaddata->queue_head),__ATOMIC_ACQUIRE)>threaddata->queue_mask) {
+    sched_yield();
+  }
+  threaddata->queue[tail&threaddata->queue_mask]= taskinfo;
+  __atomic_store_n(&(threaddata->queue_tail),tail+1,__ATOMIC_RELEASE);
+}
+
 /* code checked */
 void rtpstream_free_taskinfo (taskentry_t *taskinfo)
 {
@@ -245,15 +347,211 @@ void rtpstream_process_task_flags (taskentry_t *taskinfo)
     taskinfo->timeticks_per_packet= taskinfo->new_timeticks_per_packet;
     taskinfo->timeticks_per_ms= taskinfo->timeticks_per_packet/taskinfo->ms_per_packet;
 
-    taskinfo->last_timestamp= getmilliseconds()*taskinfo->timeticks_per_ms;
+    taskinfo->last_timestamp= rtpstream_now_ms()*taskinfo->timeticks_per_ms;
     taskinfo->flags&= ~TI_PLAYFILE;
   }
 }
 
+/* code checked */
+int *rtpstream_task_socket (taskentry_t *taskinfo, int which)
+{
+  switch (which) {
+    case TS_AUDIO_RTP:
+      return &(taskinfo->audio_rtp_socket);
+    case TS_AUDIO_RTCP:
+      return &(taskinfo->audio_rtcp_socket);
+    case TS_VIDEO_RTP:
+      return &(taskinfo->video_rtp_socket);
+    default:
+      return &(taskinfo->video_rtcp_socket);
+  }
+}
+
+/* code checked */
+/* Read everything waiting on one of the task's sockets. The data is only */
+/* counted and thrown away; RTP echo would need a separate code path.     */
+void rtpstream_read_socket (taskentry_t *taskinfo, int which)
+{
+  char            udp_buffer[MAX_UDP_RECV_BUFFER];
+  int             sock= *rtpstream_task_socket (taskinfo,which);
+  int             rc;
+  unsigned long   pckts= 0;
+  unsigned long   bytes= 0;
+
+  if (sock==-1) {
+    return;
+  }
+  /* ignore any receive errors, the socket is non-blocking */
+  while ((rc= recv (sock,udp_buffer,sizeof(udp_buffer),0))>=0) {
+    pckts++;
+    bytes+= rc;
+  }
+  if (!pckts) {
+    return;
+  }
+
+  /* the call thread reads these when the call ends */
+  __atomic_fetch_add (&(taskinfo->pckts_in[which]),pckts,__ATOMIC_RELAXED);
+  __atomic_fetch_add (&(taskinfo->bytes_in[which]),bytes,__ATOMIC_RELAXED);
+  if ((which==TS_AUDIO_RTP)||(which==TS_VIDEO_RTP)) {
+    CThreadCounters::add (CThreadCounters::TC_RTPSTREAM_BYTES_IN,bytes);
+    CThreadCounters::add (CThreadCounters::TC_RTPSTREAM_PCKTS_IN,pckts);
+  }
+}
+
+#ifdef HAVE_EPOLL
+/* code checked */
+/* Add the task's sockets to its thread's epoll set. Sockets that are */
+/* closed drop out of the set by themselves and the ones that are     */
+/* already in it are left as they are.                                */
+void rtpstream_watch_sockets (threaddata_t *threaddata, taskentry_t *taskinfo)
+{
+  struct epoll_event   event;
+  int                  which;
+  int                  sock;
+
+  for (which=0;which<TS_NUM_SOCKETS;which++) {
+    sock= *rtpstream_task_socket (taskinfo,which);
+    if (sock==-1) {
+      continue;
+    }
+    memset (&event,0,sizeof(event));
+    event.events= EPOLLIN;
+    /* task entries are malloc()ed, so the low bits are free */
+    event.data.u64= ((uintptr_t)taskinfo)|which;
+    if (epoll_ctl (threaddata->epollfd,EPOLL_CTL_ADD,sock,&event)&&(errno!=EEXIST)) {
+      /* incoming data will pile up in the socket buffer - not fatal */
+      debugprint ("could not watch socket %d due to error %d taskinfo=%p\n",
+                  sock, errno, taskinfo);
+    }
+  }
+}
+#endif
+
+/* code checked */
+/* Point iov at the payload of the task's next packet, straight in the */
+/* cached file bytes, and move the playback position past it. Returns  */
+/* the number of iovecs used.                                          */
+int rtpstream_next_payload (taskentry_t *taskinfo, struct iovec *iov)
+{
+  int   count= 1;
+
+  iov[0].iov_base= taskinfo->current_file_bytes;
+  if (taskinfo->file_bytes_left>=taskinfo->bytes_per_packet) {
+    /* no need for fancy acrobatics */
+    iov[0].iov_len= taskinfo->bytes_per_packet;
+  } else {
+    /* end and then begining of file. does not handle the */
+    /* case where file is shorter than the packet length!! */
+    iov[0].iov_len= taskinfo->file_bytes_left;
+    iov[1].iov_base= taskinfo->file_bytes_start;
+    iov[1].iov_len= taskinfo->bytes_per_packet-taskinfo->file_bytes_left;
+    count= 2;
+  }
+
+  /* advance playback pointer to next packet */
+  taskinfo->seq++;
+  /* must change if timer ticks per packet can be fractional */
+  taskinfo->last_timestamp+= taskinfo->timeticks_per_packet;
+  taskinfo->file_bytes_left-= taskinfo->bytes_per_packet;
+  if (taskinfo->file_bytes_left>0) {
+    taskinfo->current_file_bytes+= taskinfo->bytes_per_packet;
+  } else {
+    taskinfo->current_file_bytes= taskinfo->file_bytes_start-taskinfo->file_bytes_left;
+    taskinfo->file_bytes_left+= taskinfo->file_num_bytes;
+    if (taskinfo->loop_count>0) {
+      /* one less loop to play. -1 (infinite loops) will stay as is */
+      taskinfo->loop_count--;
+    }
+  }
+  return count;
+}
+
+/* code checked */
+/* Send the packets due up to target_timestamp, at most a batch of them, */
+/* with a single system call. Returns the number sent or -1 with errno.  */
+int rtpstream_send_packets (taskentry_t *taskinfo, unsigned long long target_timestamp)
+{
+  rtp_header_t         headers[RTPSTREAM_SEND_BATCH];
+  struct iovec         iov[RTPSTREAM_SEND_BATCH][3];
+  struct msghdr        *msg;
+  int                  count;
+  int                  sent;
+  /* playback position, wound back if not every packet goes out */
+  unsigned short       seq= taskinfo->seq;
+  unsigned long long   last_timestamp= taskinfo->last_timestamp;
+  char                 *current_file_bytes= taskinfo->current_file_bytes;
+  int                  file_bytes_left= taskinfo->file_bytes_left;
+  int                  loop_count= taskinfo->loop_count;
+#ifdef HAVE_MMSG
+  struct mmsghdr       msgs[RTPSTREAM_SEND_BATCH];
+#else
+  struct msghdr        msgs[RTPSTREAM_SEND_BATCH];
+#endif
+
+  memset (msgs,0,sizeof(msgs));
+  for (count=0;count<RTPSTREAM_SEND_BATCH;count++) {
+    if ((taskinfo->last_timestamp>=target_timestamp)||(!taskinfo->loop_count)) {
+      break;
+    }
+    /* build rtp packet header... */
+    headers[count].flags= htons(0x8000|taskinfo->payload_type);
+    headers[count].seq= htons(taskinfo->seq);
+    headers[count].timestamp= htonl((uint32_t) (taskinfo->last_timestamp & 0XFFFFFFFF));
+    headers[count].ssrc_id= htonl(taskinfo->ssrc_id);
+    iov[count][0].iov_base= &(headers[count]);
+    iov[count][0].iov_len= sizeof(rtp_header_t);
+    /* ...followed by the payload, without copying it */
+#ifdef HAVE_MMSG
+    msg= &(msgs[count].msg_hdr);
+#else
+    msg= &(msgs[count]);
+#endif
+    msg->msg_iov= iov[count];
+    msg->msg_iovlen= 1+rtpstream_next_payload (taskinfo,&(iov[count][1]));
+  }
+
+  /* now send the actual packets */
+#ifdef HAVE_MMSG
+  sent= sendmmsg (taskinfo->audio_rtp_socket,msgs,count,0);
+#else
+  for (sent=0;sent<count;sent++) {
+    if (sendmsg (taskinfo->audio_rtp_socket,&(msgs[sent]),0)<0) {
+      break;
+    }
+  }
+  if (!sent&&count) {
+    sent= -1;
+  }
+#endif
+
+  if (sent<count) {
+    /* play the unsent packets again next time */
+    int   saved_errno= errno;
+
+    taskinfo->seq= seq;
+    taskinfo->last_timestamp= last_timestamp;
+    taskinfo->current_file_bytes= current_file_bytes;
+    taskinfo->file_bytes_left= file_bytes_left;
+    taskinfo->loop_count= loop_count;
+    for (count=0;count<sent;count++) {
+      rtpstream_next_payload (taskinfo,iov[count]);
+    }
+    errno= saved_errno;
+  }
+
+  if (sent>0) {
+    /* statistics - only count successful sends */
+    CThreadCounters::add (CThreadCounters::TC_RTPSTREAM_BYTES_OUT,
+                          sent*(taskinfo->bytes_per_packet+sizeof(rtp_header_t)));
+    CThreadCounters::add (CThreadCounters::TC_RTPSTREAM_PCKTS,sent);
+  }
+  return sent;
+}
+
 /**** todo - check code ****/
 unsigned long rtpstream_playrtptask (taskentry_t *taskinfo, unsigned long  timenow_ms)
 {
-  char                 udp_buffer[MAX_UDP_RECV_BUFFER];
   int                  rc;
   unsigned long        next_wake;
   unsigned long long   target_timestamp;
@@ -261,43 +559,22 @@ unsigned long rtpstream_playrtptask (taskentry_t *taskinfo, unsigned long  timen
   /* OK, now to play - sockets are supposed to be non-blocking */
   /* no support for video stream at this stage. will need some work */
 
-  next_wake= timenow_ms+100; /* default next wakeup time */
+  next_wake= timenow_ms+RTPSTREAM_IDLE_MS; /* default next wakeup time */
 
-  if (taskinfo->audio_rtcp_socket!=-1) {
-    /* just keep listening on rtcp socket (is this really required?) - ignore any errors */
-    while ((rc= recv (taskinfo->audio_rtcp_socket,udp_buffer,sizeof(udp_buffer),0))>=0) {
-      /*
-       * rtpstream_bytes_in+= rc;
-       */
-    }
-  }
+#ifndef HAVE_EPOLL
+  /* incoming packets are only counted and thrown away, so there is no */
+  /* need to look for them more often than the socket buffers require */
+  if (timenow_ms>=taskinfo->nextdrain_ms) {
+    int   which;
 
-  if (taskinfo->video_rtp_socket!=-1) {
-    /* just keep listening on rtp socket (is this really required?) - ignore any errors */
-    while ((rc= recv (taskinfo->video_rtp_socket,udp_buffer,sizeof(udp_buffer),0))>=0) {
-      /*
-       * rtpstream_bytes_in+= rc;
-       */
-    }
-  }
-
-  if (taskinfo->video_rtcp_socket!=-1) {
-    /* just keep listening on rtcp socket (is this really required?) - ignore any errors */
-    while ((rc= recv (taskinfo->video_rtcp_socket,udp_buffer,sizeof(udp_buffer),0))>=0) {
-      /*
-       * rtpstream_bytes_in+= rc;
-       */
+    taskinfo->nextdrain_ms= timenow_ms+RTPSTREAM_IDLE_MS;
+    for (which=0;which<TS_NUM_SOCKETS;which++) {
+      rtpstream_read_socket (taskinfo,which);
     }
   }
+#endif
 
   if (taskinfo->audio_rtp_socket!=-1) {
-    /* this is temp code - will have to reorganize if/when we include echo functionality */
-    /* just keep listening on rtcp socket (is this really required?) - ignore any errors */
-    while ((rc= recv (taskinfo->audio_rtp_socket,udp_buffer,sizeof(udp_buffer),0))>=0) {
-      /* for now we will just ignore any received data or receive errors */
-      /* separate code path for RTP echo */
-      rtpstream_bytes_in+= rc;
-    }
     /* are we playing back an audio file? */
     if (taskinfo->loop_count) {
       target_timestamp= timenow_ms*taskinfo->timeticks_per_ms;
@@ -307,24 +584,8 @@ unsigned long rtpstream_playrtptask (taskentry_t *taskinfo, unsigned long  timen
         taskinfo->last_timestamp= target_timestamp;
 	  }     
       if (taskinfo->last_timestamp<target_timestamp) {
-        /* need to send rtp payload - build rtp packet header... */
-        ((rtp_header_t*)udp_buffer)->flags= htons(0x8000|taskinfo->payload_type);
-        ((rtp_header_t*)udp_buffer)->seq= htons(taskinfo->seq);
-        ((rtp_header_t*)udp_buffer)->timestamp= htonl((uint32_t) (taskinfo->last_timestamp & 0XFFFFFFFF));
-        ((rtp_header_t*)udp_buffer)->ssrc_id= htonl(taskinfo->ssrc_id);
-        /* add payload data to the packet - handle buffer wraparound */
-        if (taskinfo->file_bytes_left>=taskinfo->bytes_per_packet) {
-          /* no need for fancy acrobatics */ 
-          memcpy (udp_buffer+sizeof(rtp_header_t),taskinfo->current_file_bytes,taskinfo->bytes_per_packet);
-        } else {
-          /* copy from end and then begining of file. does not handle the */
-          /* case where file is shorter than the packet length!! */
-          memcpy (udp_buffer+sizeof(rtp_header_t),taskinfo->current_file_bytes,taskinfo->file_bytes_left); 
-          memcpy (udp_buffer+sizeof(rtp_header_t)+taskinfo->file_bytes_left,
-                  taskinfo->file_bytes_start,taskinfo->bytes_per_packet-taskinfo->file_bytes_left); 
-        }
-        /* now send the actual packet */
-		rc= send (taskinfo->audio_rtp_socket,udp_buffer,taskinfo->bytes_per_packet+sizeof(rtp_header_t),0);
+        /* need to send rtp payload - send every packet we owe in one go */
+        rc= rtpstream_send_packets (taskinfo,target_timestamp);
         if (rc<0) {
           /* handle sending errors */
           if ((errno==EAGAIN)||(errno==EWOULDBLOCK)||(errno==EINTR)) {
@@ -336,29 +597,9 @@ unsigned long rtpstream_playrtptask (taskentry_t *taskinfo, unsigned long  timen
             close (taskinfo->audio_rtp_socket);
             taskinfo->audio_rtp_socket= -1;
 		  }
-        } else {
-          /* statistics - only count successful sends */
-          rtpstream_bytes_out+= taskinfo->bytes_per_packet+sizeof(rtp_header_t);
-		  rtpstream_pckts++;
-          /* advance playback pointer to next packet */
-          taskinfo->seq++;
-          /* must change if timer ticks per packet can be fractional */
-          taskinfo->last_timestamp+= taskinfo->timeticks_per_packet;
-          taskinfo->file_bytes_left-= taskinfo->bytes_per_packet;
-          if (taskinfo->file_bytes_left>0) {
-            taskinfo->current_file_bytes+= taskinfo->bytes_per_packet;
-          } else {
-            taskinfo->current_file_bytes= taskinfo->file_bytes_start-taskinfo->file_bytes_left;
-            taskinfo->file_bytes_left+= taskinfo->file_num_bytes;
-            if (taskinfo->loop_count>0) {
-              /* one less loop to play. -1 (infinite loops) will stay as is */
-              taskinfo->loop_count--;
-            }
-          }
-          if (taskinfo->last_timestamp<target_timestamp) {
-            /* no sleep if we are behind */
-            next_wake= timenow_ms;
-		  }
+        } else if (taskinfo->loop_count&&(taskinfo->last_timestamp<target_timestamp)) {
+          /* no sleep if we are behind */
+          next_wake= timenow_ms;
         }
       }
     } else {
@@ -376,68 +617,131 @@ unsigned long rtpstream_playrtptask (taskentry_t *taskinfo, unsigned long  timen
 /*********************************************************************************/
 
 
+/* code checked */
+/* Take in the tasks queued by the call thread: new ones, ones with new */
+/* configuration and ones to be deleted.                                */
+void rtpstream_process_queue (threaddata_t *threaddata)
+{
+  taskentry_t    *taskinfo;
+  unsigned int   head= threaddata->queue_head;
+  unsigned int   tail= __atomic_load_n(&(threaddata->queue_tail),__ATOMIC_ACQUIRE);
+
+  while (head!=tail) {
+    taskinfo= threaddata->queue[(head++)&threaddata->queue_mask];
+    /* clear before reading the flags so later changes queue it again */
+    __atomic_store_n(&(taskinfo->queued),0,__ATOMIC_SEQ_CST);
+    rtpstream_wheel_remove (taskinfo);
+    if (taskinfo->flags&TI_KILLTASK) {
+      /* remove this task entry and release its resources */
+      rtpstream_free_taskinfo (taskinfo);
+      continue;
+    }
+    /* handle any other config related flags */
+    if (taskinfo->flags&TI_CONFIGFLAGS) {
+#ifdef HAVE_EPOLL
+      /* sockets only change when they are (re)connected */
+      int   reconnect= taskinfo->flags&TI_RECONNECTSOCKET;
+
+      rtpstream_process_task_flags (taskinfo);
+      if (reconnect) {
+        rtpstream_watch_sockets (threaddata,taskinfo);
+      }
+#else
+      rtpstream_process_task_flags (taskinfo);
+#endif
+    }
+    /* and let the task run on the next slot */
+    taskinfo->nextwake_ms= 0;
+    rtpstream_wheel_add (threaddata,taskinfo);
+  }
+  __atomic_store_n(&(threaddata->queue_head),head,__ATOMIC_RELEASE);
+}
+
 /* code checked */
 void *rtpstream_playback_thread (void *params)
 {
   threaddata_t   *threaddata= (threaddata_t *) params;
   taskentry_t    *taskinfo;
-  int            taskindex;
+  taskentry_t    *nexttask;
+  taskentry_t    **slot;
+  int            slotindex;
 
   unsigned long  timenow_ms;
   unsigned long  waketime_ms;
-  int            sleeptime_us;
+  unsigned long  slot_ms;
+  long long      sleeptime_us;
+#ifdef HAVE_EPOLL
+  struct epoll_event   events[RTPSTREAM_EPOLL_EVENTS];
+  int                  nevents;
+  int                  eventindex;
+#endif
  
   rtpstream_numthreads++; /* perhaps wrap this in a mutex? */
 
   while (!threaddata->exit_flag) {
-    timenow_ms= getmilliseconds();
-    waketime_ms= timenow_ms+ 100; /* default sleep 100ms */
-
-    /* iterate through tasks and handle playback and other actions */
-    for (taskindex=0;taskindex<threaddata->num_tasks;taskindex++) {
-      taskinfo= (&threaddata->tasklist)[taskindex];
-      if (taskinfo->flags&TI_CONFIGFLAGS) {
-        if (taskinfo->flags&TI_KILLTASK) {
-          /* remove this task entry and release its resources */
-          pthread_mutex_lock (&(threaddata->tasklist_mutex));
-          (&threaddata->tasklist)[taskindex--]= (&threaddata->tasklist)[--threaddata->num_tasks];
-          threaddata->del_pending--;   /* must decrease del_pending after num_tasks */
-          pthread_mutex_unlock (&(threaddata->tasklist_mutex));
-          rtpstream_free_taskinfo (taskinfo);
-          continue;
-        }
-        /* handle any other config related flags */
-        rtpstream_process_task_flags (taskinfo);
+    rtpstream_process_queue (threaddata);
+
+    /* run the tasks of every slot that came due since the last pass; */
+    /* tasks that are not due are not touched at all                  */
+    timenow_ms= rtpstream_now_ms();
+    while (threaddata->wheel_ms<timenow_ms) {
+      threaddata->wheel_ms++;
+      slot= &(threaddata->wheel[threaddata->wheel_ms&(RTPSTREAM_WHEEL_SLOTS-1)]);
+      taskinfo= *slot;
+      *slot= NULL;
+      while (taskinfo) {
+        nexttask= taskinfo->wheel_next;
+        taskinfo->wheel_next= NULL;
+        taskinfo->wheel_prev= NULL;
+        taskinfo->nextwake_ms= rtpstream_playrtptask (taskinfo,timenow_ms);
+        rtpstream_wheel_add (threaddata,taskinfo);
+        taskinfo= nexttask;
       }
+    }
 
-      /* should we update current time inbetween tasks? */
-	  if (taskinfo->nextwake_ms<=timenow_ms) {
-        /* task needs to execute now */	  
-        taskinfo->nextwake_ms= rtpstream_playrtptask (taskinfo,timenow_ms);
-	  }
-      if (waketime_ms>taskinfo->nextwake_ms) {
-        waketime_ms= taskinfo->nextwake_ms;
-	  }
+    /* sleep until the next busy slot, but look at the queue regularly */
+    waketime_ms= timenow_ms+RTPSTREAM_MAX_SLEEP_MS;
+    for (slot_ms=timenow_ms+1;slot_ms<waketime_ms;slot_ms++) {
+      if (threaddata->wheel[slot_ms&(RTPSTREAM_WHEEL_SLOTS-1)]) {
+        waketime_ms= slot_ms;
+        break;
+      }
+    }
+    sleeptime_us= (long long)(waketime_ms*1000)-(long long)getprecisemicroseconds();
+#ifdef HAVE_EPOLL
+    /* and read the sockets that have data while we wait */
+    nevents= epoll_wait (threaddata->epollfd,events,RTPSTREAM_EPOLL_EVENTS,
+                         sleeptime_us>0?sleeptime_us/1000:0);
+    for (eventindex=0;eventindex<nevents;eventindex++) {
+      taskinfo= (taskentry_t *)(uintptr_t)(events[eventindex].data.u64&~(uint64_t)(TS_NUM_SOCKETS-1));
+      rtpstream_read_socket (taskinfo,(int)(events[eventindex].data.u64&(TS_NUM_SOCKETS-1)));
     }
-	/* sleep until next iteration of playback loop */
-    sleeptime_us= (waketime_ms-getmilliseconds())*1000;
+    /* epoll_wait() cannot sleep for less than a millisecond */
+    if ((nevents<=0)&&(sleeptime_us>0)&&(sleeptime_us<1000)) {
+      usleep (sleeptime_us);
+    }
+#else
     if (sleeptime_us>0) {
       usleep (sleeptime_us);
 	}
+#endif
   }
 
   /* Free all task and thread resources and exit the thread */ 
-  for (taskindex=0;taskindex<threaddata->num_tasks;taskindex++) {
-    /* check if we should delete this thread, else let owner call clear it */
+  rtpstream_process_queue (threaddata);
+  for (slotindex=0;slotindex<RTPSTREAM_WHEEL_SLOTS;slotindex++) {
+    /* tasks deleted from here on are freed by their owner instead */
     /* small chance of race condition in this code */
-    taskinfo= (&threaddata->tasklist)[taskindex];
-	if (taskinfo->flags&TI_KILLTASK) {
-      rtpstream_free_taskinfo (taskinfo);
-	} else {
+    for (taskinfo=threaddata->wheel[slotindex];taskinfo;taskinfo=nexttask) {
+      nexttask= taskinfo->wheel_next;
+      taskinfo->wheel_next= NULL;
+      taskinfo->wheel_prev= NULL;
       taskinfo->parent_thread= NULL; /* no longer associated with a thread */
-	}
+    }
   }
-  pthread_mutex_destroy(&(threaddata->tasklist_mutex));
+#ifdef HAVE_EPOLL
+  close (threaddata->epollfd);
+#endif
   free (threaddata);
   rtpstream_numthreads--; /* perhaps wrap this in a mutex? */
 
@@ -449,6 +753,7 @@ int rtpstream_start_task (rtpstream_callinfo_t *callinfo)
 {
   int           ready_index;
   int           allocsize;
+  unsigned int  queue_size;
   threaddata_t  **threadlist;
   threaddata_t  *threaddata;
   pthread_t     newthread;
@@ -482,8 +787,10 @@ int rtpstream_start_task (rtpstream_callinfo_t *callinfo)
       }
       ready_threads= threadlist;
     }
-    /* create and initialise data structure for new thread */
-    allocsize= sizeof(*threaddata)+sizeof(threaddata->tasklist)*(rtp_tasks_per_thread-1);
+    /* create and initialise data structure for new thread. the queue */
+    /* holds at most one entry per task, plus the ones being deleted.  */
+    for (queue_size=1;queue_size<2*(unsigned int)rtp_tasks_per_thread;queue_size<<=1);
+    allocsize= sizeof(*threaddata)+sizeof(threaddata->queue[0])*(queue_size-1);
     threaddata= (threaddata_t *) malloc (allocsize);
     if (!threaddata) {
       return 0;
@@ -491,10 +798,21 @@ int rtpstream_start_task (rtpstream_callinfo_t *callinfo)
     memset (threaddata,0,allocsize);
     threaddata->max_tasks= rtp_tasks_per_thread;
     threaddata->busy_list_index= -1;
-    pthread_mutex_init(&(threaddata->tasklist_mutex),NULL);
+    threaddata->queue_mask= queue_size-1;
+    threaddata->wheel_ms= rtpstream_now_ms();
+#ifdef HAVE_EPOLL
+    threaddata->epollfd= epoll_create (rtp_tasks_per_thread);
+    if (threaddata->epollfd==-1) {
+      free (threaddata);
+      return 0;
+    }
+#endif
     /* create the thread itself */
     if (pthread_create(&newthread,NULL,rtpstream_playback_thread,threaddata)) {
       /* error creating the thread */
+#ifdef HAVE_EPOLL
+      close (threaddata->epollfd);
+#endif
       free (threaddata);
       return 0;
     }
@@ -502,16 +820,13 @@ int rtpstream_start_task (rtpstream_callinfo_t *callinfo)
     ready_threads[num_ready_threads++]= threaddata;
   }
 
-  /* now add new task to a spare slot in our thread tasklist */
+  /* now hand the new task over to the thread */
   threaddata= ready_threads[ready_index];
   callinfo->taskinfo->parent_thread= threaddata;
-  pthread_mutex_lock (&(threaddata->tasklist_mutex));
-  (&threaddata->tasklist)[threaddata->num_tasks++]= callinfo->taskinfo;
-  pthread_mutex_unlock (&(threaddata->tasklist_mutex));
+  threaddata->num_tasks++;
+  rtpstream_signal_task (callinfo->taskinfo);
 
-  /* this check relies on playback thread to decrement num_tasks before */
-  /* decrementing del_pending -- else we need to lock before this test  */
-  if ((threaddata->del_pending==0)&&(threaddata->num_tasks>=threaddata->max_tasks)) {
+  if (threaddata->num_tasks>=threaddata->max_tasks) {
     /* move this thread to the busy list - no free task slots */
     /* first check if the busy list is big enough to hold new thread */
     if (num_busy_threads>=busy_threads_max) {
@@ -575,10 +890,9 @@ void rtpstream_stop_task (rtpstream_callinfo_t *callinfo)
         }
       }
       /* then ask the thread to destory this task (and its memory) */
-      pthread_mutex_lock (&(taskinfo->parent_thread->tasklist_mutex));
-      taskinfo->parent_thread->del_pending++;
+      taskinfo->parent_thread->num_tasks--;
       taskinfo->flags|= TI_KILLTASK;
-      pthread_mutex_unlock (&(taskinfo->parent_thread->tasklist_mutex));
+      rtpstream_signal_task (taskinfo);
     } else {
       /* no playback thread owner, just free it */
       rtpstream_free_taskinfo (taskinfo);
@@ -624,6 +938,12 @@ void rtpstream_end_call (rtpstream_callinfo_t *callinfo)
 {
   debugprint ("rtpstream_end_call callinfo=%p\n",callinfo);
 
+  /* a call with an audio port that never got any rtp is one-way audio */
+  if (callinfo->taskinfo&&callinfo->audioport&&
+      !__atomic_load_n(&(callinfo->taskinfo->pckts_in[TS_AUDIO_RTP]),__ATOMIC_RELAXED)) {
+    CThreadCounters::add (CThreadCounters::TC_RTPSTREAM_CALLS_NO_RTP_IN);
+  }
+
   /* stop playback thread(s) for this call */
   rtpstream_stop_task (callinfo);
 }
@@ -842,6 +1162,7 @@ int rtpstream_get_audioport (rtpstream_callinfo_t *callinfo)
 
   /* make sure the new socket gets bound to destination address (if any) */   
   callinfo->taskinfo->flags|= TI_RECONNECTSOCKET;
+  rtpstream_signal_task (callinfo->taskinfo);
 
   return callinfo->audioport;
 }
@@ -881,6 +1202,7 @@ int rtpstream_get_videoport (rtpstream_callinfo_t *callinfo)
 
   /* make sure the new socket gets bound to destination address (if any) */   
   callinfo->taskinfo->flags|= TI_RECONNECTSOCKET;
+  rtpstream_signal_task (callinfo->taskinfo);
 
   return callinfo->videoport;
 }
@@ -992,6 +1314,7 @@ void rtpstream_set_remote (rtpstream_callinfo_t *callinfo, int ip_ver, char *ip_
   pthread_mutex_unlock (&(taskinfo->mutex));
 
   taskinfo->flags|= TI_RECONNECTSOCKET;
+  rtpstream_signal_task (taskinfo);
 
   /* may want to start a playback (listen) task here if no task running? */
   /* only makes sense if we decide to send 0-filled packets on idle */
@@ -1027,6 +1350,7 @@ void rtpstream_play (rtpstream_callinfo_t *callinfo, rtpstream_actinfo_t *action
 
   /* set flag that we have a new file to play */
   taskinfo->flags|= TI_PLAYFILE;
+  rtpstream_signal_task (taskinfo);
 }
 
 /* code checked */
@@ -1132,6 +1132,9 @@ CSample *parse_distribution(bool oldstyle = false)
         double min = xp_get_double("min", "Uniform distribution");
         double max = xp_get_double("max", "Uniform distribution");
         distribution = new CUniform(min, max);
+    } else if (!strcmp(distname, "exponential")) {
+        double mean = xp_get_double("mean", "Exponential distribution");
+        distribution = new CExponential(mean);
 #ifdef HAVE_GSL
     } else if (!strcmp(distname, "normal")) {
         double mean = xp_get_double("mean", "Normal distribution");
@@ -1141,9 +1144,6 @@ CSample *parse_distribution(bool oldstyle = false)
         double mean = xp_get_double("mean", "Lognormal distribution");
         double stdev = xp_get_double("stdev", "Lognormal distribution");
         distribution = new CLogNormal(mean, stdev);
-    } else if (!strcmp(distname, "exponential")) {
-        double mean = xp_get_double("mean", "Exponential distribution");
-        distribution = new CExponential(mean);
     } else if (!strcmp(distname, "weibull")) {
         double lambda = xp_get_double("lambda", "Weibull distribution");
         double k = xp_get_double("k", "Weibull distribution");
@@ -1168,7 +1168,6 @@ CSample *parse_distribution(bool oldstyle = false)
 #else
     } else if (!strcmp(distname, "normal")
                || !strcmp(distname, "lognormal")
-               || !strcmp(distname, "exponential")
                || !strcmp(distname, "pareto")
                || !strcmp(distname, "gamma")
                || !strcmp(distname, "negbin")
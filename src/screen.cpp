@@ -124,6 +124,10 @@ void screen_exit(int rc)
         screen_exit_handler();
     }
 
+    /* Stop the logger thread and write out the trace records it still has
+     * queued, before exit() closes the log files under its feet. */
+    flush_logs();
+
     if(screen_errors) {
         fprintf(stderr, "%s", screen_last_error);
         if(screen_errors > 1) {
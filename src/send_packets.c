@@ -60,9 +60,9 @@
 #include "prepare_pcap.h"
 #include "screen.hpp"
 
-extern volatile unsigned long rtp_pckts_pcap;
-extern volatile unsigned long rtp_bytes_pcap;
+extern void count_pcap_rtp(unsigned long bytes);
 extern int media_ip_is_ipv6;
+extern int pcap_play_threads;
 
 inline void
 timerdiv (struct timeval *tvp, float div)
@@ -111,191 +111,352 @@ void hexdump(char *p, int s)
     fprintf(stderr, "\n");
 }
 
-/*Safe threaded version*/
-void do_sleep (struct timeval *, struct timeval *,
-               struct timeval *, struct timeval *);
-void send_packets_cleanup(void *arg)
+/*
+ * PCAP plays are not given a thread each: a small pool of media threads
+ * shares them out, each thread sending the packets of all its plays in
+ * the order they come due, through one raw socket.
+ */
+struct pcap_player {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    /* signalled when the plays being sent are back in the heap */
+    pthread_cond_t sent;
+    int sock;
+    /* plays that have packets left, as a heap on due time */
+    play_args_t **heap;
+    int count;
+    int size;
+};
+
+static struct pcap_player *players;
+static int num_players;
+
+/* heap_index of a play taken out of the heap while its packet is sent */
+#define PLAY_SENDING -2
+/* most plays a media thread sends between two visits to its heap */
+#define PCAP_SEND_BATCH 64
+
+static unsigned long long pcap_now_us(void)
 {
-    int * sock = (int *) arg;
+    struct timespec ts;
 
-    // Close send socket
-    close(*sock);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
 }
 
-int send_packets (play_args_t * play_args)
+static void heap_swap(struct pcap_player *player, int i, int j)
 {
-    int ret, sock, port_diff;
-    pcap_pkt *pkt_index, *pkt_max;
-    uint16_t *from_port, *to_port;
-    struct timeval didsleep = { 0, 0 };
-    struct timeval start = { 0, 0 };
-    struct timeval last = { 0, 0 };
-    pcap_pkts *pkts = play_args->pcap;
-    /* to and from are pointers in case play_args (call sticky) gets modified! */
-    struct sockaddr_storage *to = &(play_args->to);
-    struct sockaddr_storage *from = &(play_args->from);
-    struct udphdr *udp;
-    struct sockaddr_in6 to6, from6;
-    char buffer[PCAP_MAXPACKET];
-    int temp_sum;
-    int len;
+    play_args_t *tmp = player->heap[i];
 
-#ifndef MSG_DONTWAIT
-    int fd_flags;
-#endif
+    player->heap[i] = player->heap[j];
+    player->heap[j] = tmp;
+    player->heap[i]->heap_index = i;
+    player->heap[j]->heap_index = j;
+}
 
-    if (media_ip_is_ipv6) {
-        sock = socket(PF_INET6, SOCK_RAW, IPPROTO_UDP);
-        if (sock < 0) {
-            ERROR("Can't create raw IPv6 socket (need to run as root?): %s", strerror(errno));
+static void heap_fix(struct pcap_player *player, int i)
+{
+    int child;
+
+    while (i > 0 && player->heap[i]->due_us < player->heap[(i - 1) / 2]->due_us) {
+        heap_swap(player, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while ((child = 2 * i + 1) < player->count) {
+        if (child + 1 < player->count && player->heap[child + 1]->due_us < player->heap[child]->due_us) {
+            child++;
         }
-        from_port = &(((struct sockaddr_in6 *)(void *) from )->sin6_port);
-        len = sizeof(struct sockaddr_in6);
-        to_port = &(((struct sockaddr_in6 *)(void *) to )->sin6_port);
-    } else {
-        sock = socket(PF_INET, SOCK_RAW, IPPROTO_UDP);
-        from_port = &(((struct sockaddr_in *)(void *) from )->sin_port);
-        len = sizeof(struct sockaddr_in);
-        to_port = &(((struct sockaddr_in *)(void *) to )->sin_port);
-        if (sock < 0) {
-            ERROR("Can't create raw IPv4 socket (need to run as root?): %s", strerror(errno));
-            return ret;
+        if (player->heap[i]->due_us <= player->heap[child]->due_us) {
+            break;
         }
+        heap_swap(player, i, child);
+        i = child;
     }
+}
 
+static void heap_insert(struct pcap_player *player, play_args_t *play_args)
+{
+    play_args_t **heap;
 
-    if ((ret = bind(sock, (struct sockaddr *)(void *)from, len))) {
-        ERROR("Can't bind media raw socket");
-        return ret;
+    if (player->count == player->size) {
+        player->size = player->size ? player->size * 2 : 64;
+        heap = (play_args_t **) realloc(player->heap, player->size * sizeof(*heap));
+        if (!heap) {
+            ERROR("Can't allocate memory to play a PCAP file");
+        }
+        player->heap = heap;
     }
+    play_args->heap_index = player->count;
+    player->heap[player->count++] = play_args;
+    heap_fix(player, play_args->heap_index);
+}
 
-#ifndef MSG_DONTWAIT
-    fd_flags = fcntl(sock, F_GETFL , NULL);
-    fd_flags |= O_NONBLOCK;
-    fcntl(sock, F_SETFL , fd_flags);
-#endif
-    udp = (struct udphdr *)buffer;
+static void heap_remove(struct pcap_player *player, play_args_t *play_args)
+{
+    int i = play_args->heap_index;
 
-    pkt_index = pkts->pkts;
-    pkt_max = pkts->max;
+    player->count--;
+    if (i != player->count) {
+        player->heap[i] = player->heap[player->count];
+        player->heap[i]->heap_index = i;
+        heap_fix(player, i);
+    }
+    play_args->heap_index = -1;
+}
+
+/* Send the next packet of a play. Returns the sendto() result. */
+static int send_packet(int sock, play_args_t *play_args)
+{
+    pcap_pkt *pkt_index = play_args->next;
+    pcap_pkts *pkts = play_args->pcap;
+    struct sockaddr_storage *to = &(play_args->to);
+    struct sockaddr_storage *from = &(play_args->from);
+    uint16_t from_port, to_port;
+    struct udphdr *udp;
+    struct sockaddr_in6 to6, from6;
+    char buffer[PCAP_MAXPACKET];
+    int temp_sum;
+    int port_diff;
+    int flags = 0;
+
+#ifdef MSG_DONTWAIT
+    flags = MSG_DONTWAIT;
+#endif
 
     if (media_ip_is_ipv6) {
+        from_port = ((struct sockaddr_in6 *)(void *) from)->sin6_port;
+        to_port = ((struct sockaddr_in6 *)(void *) to)->sin6_port;
         memset(&to6, 0, sizeof(to6));
         memset(&from6, 0, sizeof(from6));
         to6.sin6_family = AF_INET6;
         from6.sin6_family = AF_INET6;
         memcpy(&(to6.sin6_addr.s6_addr), &(((struct sockaddr_in6 *)(void *) to)->sin6_addr.s6_addr), sizeof(to6.sin6_addr.s6_addr));
         memcpy(&(from6.sin6_addr.s6_addr), &(((struct sockaddr_in6 *)(void *) from)->sin6_addr.s6_addr), sizeof(from6.sin6_addr.s6_addr));
+    } else {
+        from_port = ((struct sockaddr_in *)(void *) from)->sin_port;
+        to_port = ((struct sockaddr_in *)(void *) to)->sin_port;
     }
 
-
-    /* Ensure the sender socket is closed when the thread exits - this
-     * allows the thread to be cancelled cleanly.
-     */
-    pthread_cleanup_push(send_packets_cleanup, ((void *) &sock));
-
-
-    while (pkt_index < pkt_max) {
-        memcpy(udp, pkt_index->data, pkt_index->pktlen);
-        port_diff = ntohs (udp->uh_dport) - pkts->base;
-        // modify UDP ports
-        udp->uh_sport = htons(port_diff + *from_port);
-        udp->uh_dport = htons(port_diff + *to_port);
-
-        if (!media_ip_is_ipv6) {
-            temp_sum = checksum_carry(pkt_index->partial_check + check((u_int16_t *) &(((struct sockaddr_in *)(void *) from)->sin_addr.s_addr), 4) + check((u_int16_t *) &(((struct sockaddr_in *)(void *) to)->sin_addr.s_addr), 4) + check((u_int16_t *) &udp->uh_sport, 4));
-        } else {
-            temp_sum = checksum_carry(pkt_index->partial_check + check((u_int16_t *) &(from6.sin6_addr.s6_addr), 16) + check((u_int16_t *) &(to6.sin6_addr.s6_addr), 16) + check((u_int16_t *) &udp->uh_sport, 4));
-        }
+    udp = (struct udphdr *)buffer;
+    memcpy(udp, pkt_index->data, pkt_index->pktlen);
+    port_diff = ntohs (udp->uh_dport) - pkts->base;
+    // modify UDP ports
+    udp->uh_sport = htons(port_diff + from_port);
+    udp->uh_dport = htons(port_diff + to_port);
+
+    if (!media_ip_is_ipv6) {
+        temp_sum = checksum_carry(pkt_index->partial_check + check((u_int16_t *) &(((struct sockaddr_in *)(void *) from)->sin_addr.s_addr), 4) + check((u_int16_t *) &(((struct sockaddr_in *)(void *) to)->sin_addr.s_addr), 4) + check((u_int16_t *) &udp->uh_sport, 4));
+    } else {
+        temp_sum = checksum_carry(pkt_index->partial_check + check((u_int16_t *) &(from6.sin6_addr.s6_addr), 16) + check((u_int16_t *) &(to6.sin6_addr.s6_addr), 16) + check((u_int16_t *) &udp->uh_sport, 4));
+    }
 
 #ifndef _HPUX_LI
 #ifdef __HPUX
-        udp->uh_sum = (temp_sum>>16)+((temp_sum & 0xffff)<<16);
-#else
-        udp->uh_sum = temp_sum;
-#endif
+    udp->uh_sum = (temp_sum>>16)+((temp_sum & 0xffff)<<16);
 #else
-        udp->uh_sum = temp_sum;
+    udp->uh_sum = temp_sum;
 #endif
-
-        do_sleep ((struct timeval *) &pkt_index->ts, &last, &didsleep,
-                  &start);
-#ifdef MSG_DONTWAIT
-        if (!media_ip_is_ipv6) {
-            ret = sendto(sock, buffer, pkt_index->pktlen, MSG_DONTWAIT,
-                         (struct sockaddr *)(void *) to, sizeof(struct sockaddr_in));
-        } else {
-            ret = sendto(sock, buffer, pkt_index->pktlen, MSG_DONTWAIT,
-                         (struct sockaddr *)(void *) &to6, sizeof(struct sockaddr_in6));
-        }
 #else
-        if (!media_ip_is_ipv6) {
-            ret = sendto(sock, buffer, pkt_index->pktlen, 0,
-                         (struct sockaddr *)(void *) to, sizeof(struct sockaddr_in));
-        } else {
-            ret = sendto(sock, buffer, pkt_index->pktlen, 0,
-                         (struct sockaddr *)(void *) &to6, sizeof(struct sockaddr_in6));
-        }
+    udp->uh_sum = temp_sum;
 #endif
-        if (ret < 0) {
-            close(sock);
-            WARNING("send_packets.c: sendto failed with error: %s", strerror(errno));
-            return( -1);
-        }
 
-        rtp_pckts_pcap++;
-        rtp_bytes_pcap += pkt_index->pktlen - sizeof(*udp);
-        memcpy (&last, &(pkt_index->ts), sizeof (struct timeval));
-        pkt_index++;
+    if (!media_ip_is_ipv6) {
+        return sendto(sock, buffer, pkt_index->pktlen, flags,
+                      (struct sockaddr *)(void *) to, sizeof(struct sockaddr_in));
     }
+    return sendto(sock, buffer, pkt_index->pktlen, flags,
+                  (struct sockaddr *)(void *) &to6, sizeof(struct sockaddr_in6));
+}
+
+/*
+ * Move a play on to its next packet, which is due as long after the
+ * previous one as it was captured after it. Packets that appear to have
+ * been captured out of order are sent straight away.
+ */
+static void advance_play(play_args_t *play_args)
+{
+    struct timeval *ts = &(play_args->next->ts);
+    struct timeval nap;
 
-    /* Closing the socket is handled by pthread_cleanup_push()/pthread_cleanup_pop() */
-    pthread_cleanup_pop(1);
-    return 0;
+    if (timercmp(ts, &(play_args->last), >)) {
+        timersub(ts, &(play_args->last), &nap);
+        play_args->due_us += nap.tv_sec * 1000000ULL + nap.tv_usec;
+    }
+    memcpy(&(play_args->last), ts, sizeof(struct timeval));
 }
 
 /*
- * Given the timestamp on the current packet and the last packet sent,
- * calculate the appropriate amount of time to sleep and do so.
+ * Send the packet a play is due and move it on. Called without the player
+ * lock: the play is out of the heap, and stop_packets() waits for it to be
+ * put back. Clears play_args->next once the play is over.
  */
-void do_sleep (struct timeval *time, struct timeval *last,
-               struct timeval *didsleep, struct timeval *start)
+static void send_play(struct pcap_player *player, play_args_t *play_args,
+                      unsigned long long now)
 {
-    struct timeval nap, now, delta;
-    struct timespec sleep;
+    int ret = send_packet(player->sock, play_args);
 
-    if (gettimeofday (&now, NULL) < 0) {
-        fprintf (stderr, "Error gettimeofday: %s\n", strerror (errno));
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+        /* the socket buffer is full, try again shortly */
+        play_args->due_us = now + 1000;
+        return;
+    }
+    if (ret < 0) {
+        WARNING("send_packets.c: sendto failed with error: %s", strerror(errno));
+        play_args->next = NULL;
+        return;
     }
 
-    /* First time through for this file */
-    if (!timerisset (last)) {
-        *start = now;
-        timerclear (&delta);
-        timerclear (didsleep);
+    count_pcap_rtp(play_args->next->pktlen - sizeof(struct udphdr));
+    play_args->next++;
+    if (play_args->next < play_args->pcap->max) {
+        advance_play(play_args);
     } else {
-        timersub (&now, start, &delta);
+        play_args->next = NULL;
     }
+}
 
-    if (timerisset (last) && timercmp (time, last, >)) {
-        timersub (time, last, &nap);
-    } else {
-        /*
-         * Don't sleep if this is our first packet, or if the
-         * this packet appears to have been sent before the
-         * last packet.
-         */
-        timerclear (&nap);
+static void *pcap_player_thread(void *arg)
+{
+    struct pcap_player *player = (struct pcap_player *) arg;
+    play_args_t *batch[PCAP_SEND_BATCH];
+    unsigned long long now;
+    struct timespec wake;
+    int n, i;
+
+    pthread_mutex_lock(&player->mutex);
+    for (;;) {
+        now = pcap_now_us();
+        while (player->count && player->heap[0]->due_us <= now) {
+            /* take the due plays out of the heap and send with the lock
+             * released, so that the SIP scheduler does not wait on us */
+            for (n = 0; n < PCAP_SEND_BATCH && player->count &&
+                    player->heap[0]->due_us <= now; n++) {
+                batch[n] = player->heap[0];
+                heap_remove(player, batch[n]);
+                batch[n]->heap_index = PLAY_SENDING;
+            }
+            pthread_mutex_unlock(&player->mutex);
+            for (i = 0; i < n; i++) {
+                send_play(player, batch[i], now);
+            }
+            pthread_mutex_lock(&player->mutex);
+            for (i = 0; i < n; i++) {
+                if (batch[i]->next) {
+                    heap_insert(player, batch[i]);
+                } else {
+                    batch[i]->heap_index = -1;
+                }
+            }
+            pthread_cond_broadcast(&player->sent);
+            now = pcap_now_us();
+        }
+
+        /* sleep until the next packet is due or a play comes or goes */
+        if (!player->count) {
+            pthread_cond_wait(&player->cond, &player->mutex);
+        } else {
+            wake.tv_sec = player->heap[0]->due_us / 1000000;
+            wake.tv_nsec = (player->heap[0]->due_us % 1000000) * 1000;
+            pthread_cond_timedwait(&player->cond, &player->mutex, &wake);
+        }
+    }
+    return NULL;
+}
+
+static void start_players(play_args_t *play_args)
+{
+    pthread_condattr_t attr;
+    struct pcap_player *player;
+    int len;
+    int i;
+
+    num_players = pcap_play_threads;
+    players = (struct pcap_player *) calloc(num_players, sizeof(*players));
+    if (!players) {
+        ERROR("Can't allocate the PCAP media threads");
+    }
+    len = media_ip_is_ipv6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for (i = 0; i < num_players; i++) {
+        player = &players[i];
+        if (media_ip_is_ipv6) {
+            player->sock = socket(PF_INET6, SOCK_RAW, IPPROTO_UDP);
+            if (player->sock < 0) {
+                ERROR("Can't create raw IPv6 socket (need to run as root?): %s", strerror(errno));
+            }
+        } else {
+            player->sock = socket(PF_INET, SOCK_RAW, IPPROTO_UDP);
+            if (player->sock < 0) {
+                ERROR("Can't create raw IPv4 socket (need to run as root?): %s", strerror(errno));
+            }
+        }
+        /* every play sends from the media IP, so all can share the socket */
+        if (bind(player->sock, (struct sockaddr *)(void *) &(play_args->from), len)) {
+            ERROR("Can't bind media raw socket");
+        }
+#ifndef MSG_DONTWAIT
+        fcntl(player->sock, F_SETFL, fcntl(player->sock, F_GETFL, NULL) | O_NONBLOCK);
+#endif
+        pthread_mutex_init(&player->mutex, NULL);
+        pthread_cond_init(&player->cond, &attr);
+        pthread_cond_init(&player->sent, NULL);
+        if (pthread_create(&player->thread, NULL, pcap_player_thread, player)) {
+            ERROR("Can't create thread to send RTP packets");
+        }
+    }
+    pthread_condattr_destroy(&attr);
+}
+
+void start_packets(play_args_t *play_args)
+{
+    struct pcap_player *player;
+    int i;
+
+    stop_packets(play_args);
+    if (play_args->pcap->pkts >= play_args->pcap->max) {
+        return;
+    }
+    if (!players) {
+        start_players(play_args);
     }
 
-    timeradd (didsleep, &nap, didsleep);
+    /* give the play to the least busy thread */
+    player = &players[0];
+    for (i = 1; i < num_players; i++) {
+        if (players[i].count < player->count) {
+            player = &players[i];
+        }
+    }
 
-    if (timercmp (didsleep, &delta, >)) {
-        timersub (didsleep, &delta, &nap);
+    pthread_mutex_lock(&player->mutex);
+    play_args->player = player;
+    play_args->next = play_args->pcap->pkts;
+    play_args->due_us = pcap_now_us();
+    memcpy(&(play_args->last), &(play_args->next->ts), sizeof(struct timeval));
+    heap_insert(player, play_args);
+    pthread_cond_signal(&player->cond);
+    pthread_mutex_unlock(&player->mutex);
+}
 
-        sleep.tv_sec = nap.tv_sec;
-        sleep.tv_nsec = nap.tv_usec * 1000;	/* convert ms to ns */
+void stop_packets(play_args_t *play_args)
+{
+    struct pcap_player *player = play_args->player;
 
-        while ((nanosleep (&sleep, &sleep) == -1) && (errno == -EINTR));
+    if (!player) {
+        return;
+    }
+    /* once this returns the media thread no longer looks at play_args */
+    pthread_mutex_lock(&player->mutex);
+    while (play_args->heap_index == PLAY_SENDING) {
+        pthread_cond_wait(&player->sent, &player->mutex);
+    }
+    if (play_args->heap_index >= 0) {
+        heap_remove(player, play_args);
     }
+    play_args->next = NULL;
+    play_args->player = NULL;
+    pthread_mutex_unlock(&player->mutex);
 }
@@ -38,19 +38,219 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "screen.hpp"
 #include "strings.hpp"
 #include "sip_parser.hpp"
 
 /*************************** Mini SIP parser ***************************/
 
-char * get_peer_tag(char *msg)
+struct sip_header_name {
+    const char *name;
+    size_t len;
+    const char *compact;
+};
+
+static const struct sip_header_name sip_header_names[SIP_HDR_COUNT] = {
+    { NULL, 0, NULL },
+    { "call-id:", 8, "i:" },
+    { "contact:", 8, "m:" },
+    { "content-encoding:", 17, "e:" },
+    { "content-length:", 15, "l:" },
+    { "content-type:", 13, "c:" },
+    { "from:", 5, "f:" },
+    { "to:", 3, "t:" },
+    { "via:", 4, "v:" },
+    { "cseq:", 5, NULL },
+};
+
+/* Per thread, like the messages being processed. */
+static __thread struct sip_msg_index *indexed_message = NULL;
+
+static int sip_header_name_id(const char *name, size_t len)
 {
-    char        * to_hdr;
-    char        * ptr;
-    char        * end_ptr;
-    static char   tag[MAX_HEADER_LEN];
-    int           tag_i = 0;
+    for (int id = 1; id < SIP_HDR_COUNT; id++) {
+        const struct sip_header_name *hdr = &sip_header_names[id];
+        if (len == 2) {
+            if (hdr->compact && !strncasecmp(hdr->compact, name, 2)) {
+                return id;
+            }
+        } else if (len == hdr->len && !strncasecmp(hdr->name, name, len)) {
+            return id;
+        }
+    }
+    return SIP_HDR_OTHER;
+}
+
+/* Does this body line look like "token:"? */
+static bool sip_is_header_line(const char *line)
+{
+    const char *ptr = line;
+
+    while (isalnum((unsigned char)*ptr) || (*ptr && strchr("-_.!%*+`'~", *ptr))) {
+        ptr++;
+    }
+    return (ptr != line) && (*ptr == ':');
+}
+
+bool sip_index_message(struct sip_msg_index *index, const char *msg)
+{
+    signed char last_of[SIP_HDR_COUNT];
+    const char *line;
+    const char *eol;
+    int last = -1;
+
+    index->msg = msg;
+    index->body = NULL;
+    index->complete = true;
+    index->body_headers = false;
+    index->nb_headers = 0;
+    memset(index->first, -1, sizeof(index->first));
+    memset(last_of, -1, sizeof(last_of));
+
+    /* Skip the request or status line. */
+    for (line = strchr(msg, '\n'); line; line = eol) {
+        line++;
+        eol = strchr(line, '\n');
+
+        if ((*line == '\n') || ((*line == '\r') && (line[1] == '\n'))) {
+            index->body = eol + 1;
+            break;
+        }
+        if (!*line) {
+            break;
+        }
+
+        const char *end = eol ? eol : line + strlen(line);
+
+        if ((*line == ' ') || (*line == '\t')) {
+            /* A folded line continues the header before it. */
+            if (last >= 0) {
+                index->headers[last].end = end;
+            }
+            continue;
+        }
+
+        const char *colon = (const char *)memchr(line, ':', end - line);
+        if (!colon) {
+            last = -1;
+            continue;
+        }
+        if ((index->nb_headers == SIP_INDEX_MAX_HEADERS) || (colon - line >= 0xffff)) {
+            index->complete = false;
+            return false;
+        }
+
+        struct sip_header_ref *ref = &index->headers[index->nb_headers];
+        ref->name = line;
+        ref->end = end;
+        ref->name_len = colon - line + 1;
+        ref->id = sip_header_name_id(line, ref->name_len);
+        ref->next = -1;
+        if (last_of[ref->id] >= 0) {
+            index->headers[(int)last_of[ref->id]].next = index->nb_headers;
+        } else {
+            index->first[ref->id] = index->nb_headers;
+        }
+        last_of[ref->id] = index->nb_headers;
+        last = index->nb_headers++;
+    }
+
+    /* get_header() also matches lines of the body, so leave multipart and
+     * sipfrag bodies to the scanning path. */
+    for (line = index->body; line && *line; line = eol ? eol + 1 : NULL) {
+        if (sip_is_header_line(line)) {
+            index->body_headers = true;
+            return false;
+        }
+        eol = strchr(line, '\n');
+    }
+
+    return true;
+}
+
+struct sip_msg_index *set_indexed_message(struct sip_msg_index *index)
+{
+    struct sip_msg_index *previous = indexed_message;
+    indexed_message = index;
+    return previous;
+}
+
+static int sip_index_next_other(const struct sip_msg_index *index, int i)
+{
+    for (i++; i < index->nb_headers; i++) {
+        if (index->headers[i].id == SIP_HDR_OTHER) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* The next header after i (-1 to start) whose name is exactly name. */
+static int sip_index_next(const struct sip_msg_index *index, const char *name, size_t len, int i)
+{
+    int id = sip_header_name_id(name, len);
+
+    do {
+        if (id == SIP_HDR_OTHER) {
+            i = sip_index_next_other(index, i);
+        } else {
+            i = (i < 0) ? index->first[id] : index->headers[i].next;
+        }
+    } while ((i >= 0) &&
+             ((index->headers[i].name_len != len) ||
+              strncasecmp(index->headers[i].name, name, len)));
+    return i;
+}
+
+/* Find the first header called name, or the compact form of name if there
+ * is none, the same way get_header() does.  *found is set to the name that
+ * matched. */
+static int sip_index_find(const struct sip_msg_index *index, const char *name, const char **found)
+{
+    size_t len = strlen(name);
+    int i = sip_index_next(index, name, len, -1);
+
+    *found = name;
+    if ((i < 0) && (len != 2)) {
+        int id = sip_header_name_id(name, len);
+        if (sip_header_names[id].compact) {
+            *found = sip_header_names[id].compact;
+            i = sip_index_next(index, *found, 2, -1);
+        }
+    }
+    return i;
+}
+
+const char *sip_index_header(const struct sip_msg_index *index, const char *name, size_t *len)
+{
+    const char *found;
+    int i = sip_index_find(index, name, &found);
+
+    if (i < 0) {
+        *len = 0;
+        return NULL;
+    }
+
+    const struct sip_header_ref *ref = &index->headers[i];
+    const char *value = ref->name + ref->name_len;
+    const char *end = ref->end;
+    while ((value < end) && ((*value == ' ') || (*value == '\t'))) {
+        value++;
+    }
+    while ((end > value) && ((end[-1] == '\r') || (end[-1] == ' ') || (end[-1] == '\t'))) {
+        end--;
+    }
+    *len = end - value;
+    return value;
+}
+
+char * get_peer_tag(const char *msg, char *tag, size_t size)
+{
+    const char  * to_hdr;
+    const char  * ptr;
+    const char  * end_ptr;
+    size_t        tag_i = 0;
 
     to_hdr = strstr(msg, "\r\nTo:");
     if(!to_hdr) to_hdr = strstr(msg, "\r\nto:");
@@ -107,7 +307,8 @@ char * get_peer_tag(char *msg)
             (*ptr != '\t') &&
             (*ptr != '\r') &&
             (*ptr != '\n') &&
-            (*ptr)) {
+            (*ptr) &&
+            (tag_i < size - 1)) {
         tag[tag_i++] = *(ptr++);
     }
     tag[tag_i] = 0;
@@ -115,46 +316,141 @@ char * get_peer_tag(char *msg)
     return tag;
 }
 
-char * get_header_content(const char* message, const char * name)
+char * get_header_content(const char* message, const char * name, char *buf, size_t size)
+{
+    return get_header(message, name, true, buf, size);
+}
+
+/* Trim what get_header() collected in last_header, up to dest, and move it
+ * to the start of last_header. */
+static void clean_header(char *last_header, char *dest)
+{
+    char *start, *ptr;
+
+    *(dest--) = 0;
+
+    /* Remove trailing whitespaces, tabs, and CRs */
+    while ((dest > last_header) &&
+            ((*dest == ' ') || (*dest == '\r')|| (*dest == '\t'))) {
+        *(dest--) = 0;
+    }
+
+    /* Remove leading whitespaces */
+    for (start = last_header; *start == ' '; start++);
+
+    /* remove enclosed CRs in multilines */
+    /* don't remove enclosed CRs for multiple headers (e.g. Via) (Rhys) */
+    while((ptr = strstr(last_header, "\r\n")) != NULL
+            && (   *(ptr + 2) == ' '
+                   || *(ptr + 2) == '\r'
+                   || *(ptr + 2) == '\t') ) {
+        /* Use strlen(ptr) to include trailing zero */
+        memmove(ptr, ptr+1, strlen(ptr));
+    }
+
+    /* Remove illegal double CR characters */
+    while((ptr = strstr(last_header, "\r\r")) != NULL) {
+        memmove(ptr, ptr+1, strlen(ptr));
+    }
+    /* Remove illegal double Newline characters */
+    while((ptr = strstr(last_header, "\n\n")) != NULL) {
+        memmove(ptr, ptr+1, strlen(ptr));
+    }
+
+    if (start != last_header) {
+        memmove(last_header, start, strlen(start) + 1);
+    }
+}
+
+/* get_header() for an indexed message: the same result, gathered from the
+ * header offsets rather than by copying and scanning the message. */
+static char *get_indexed_header(const struct sip_msg_index *index, char *buf, size_t size,
+                                const char *name, bool content)
 {
-    return get_header(message, name, true);
+    const char *found;
+    char *dest = buf;
+    int i = sip_index_find(index, name, &found);
+    size_t found_len = strlen(found);
+    bool first_time = true;
+
+    for (; i >= 0; i = sip_index_next(index, found, found_len, i)) {
+        const char *src = index->headers[i].name;
+        if (content || !first_time) {
+            src += found_len;
+        }
+        first_time = false;
+
+        // Add "," when several headers are present
+        if (dest != buf) {
+            /* Remove trailing whitespaces, tabs, and CRs */
+            while ((dest > buf) &&
+                    ((*(dest-1) == ' ')  ||
+                     (*(dest-1) == '\r') ||
+                     (*(dest-1) == '\n') ||
+                     (*(dest-1) == '\t'))) {
+                *(--dest) = 0;
+            }
+            if (dest < buf + size - 1) {
+                *dest++ = ',';
+            }
+        }
+
+        size_t len = index->headers[i].end - src;
+        if (len > size - (dest - buf) - 1) {
+            len = size - (dest - buf) - 1;
+        }
+        memcpy(dest, src, len);
+        dest += len;
+        *dest = 0;
+    }
+
+    if (dest != buf) {
+        clean_header(buf, dest);
+    }
+    return buf;
 }
 
-/* If content is true, we only return the header's contents. */
-char * get_header(const char* message, const char * name, bool content)
+/* If content is true, we only return the header's contents. The result is
+ * written to buf, truncated to size bytes; it is empty if there is no such
+ * header. */
+char * get_header(const char* message, const char * name, bool content, char *buf, size_t size)
 {
-    /* non reentrant. consider accepting char buffer as param */
-    static char last_header[MAX_HEADER_LEN * 10];
-    char *src, *src_orig, *dest, *start, *ptr;
+    const char *src, *ptr;
+    char *dest;
     /* Are we searching for a short form header? */
     bool short_form = false;
     bool first_time = true;
     char header_with_newline[MAX_HEADER_LEN + 1];
 
     /* returns empty string in case of error */
-    last_header[0] = '\0';
+    buf[0] = '\0';
 
-    if((!message) || (!strlen(message))) {
-        return last_header;
+    if((!message) || (!*message)) {
+        return buf;
     }
 
     /* for safety's sake */
     if (NULL == name || NULL == strrchr(name, ':')) {
         WARNING("Can not search for header (no colon): %s", name ? name : "(null)");
-        return last_header;
+        return buf;
     }
 
-    src_orig = strdup(message);
+    /* Received messages are indexed once, so most lookups need not scan. */
+    if (indexed_message && (indexed_message->msg == message) &&
+            indexed_message->complete && !indexed_message->body_headers &&
+            (strchr(name, ':') == name + strlen(name) - 1)) {
+        return get_indexed_header(indexed_message, buf, size, name, content);
+    }
 
     do {
         /* We want to start from the beginning of the message each time
          * through this loop, because we may be searching for a short form. */
-        src = src_orig;
+        src = message;
 
         snprintf(header_with_newline, MAX_HEADER_LEN, "\n%s", name);
-        dest = last_header;
+        dest = buf;
 
-        while((src = strcasestr2(src, header_with_newline))) {
+        while((src = strcasestr2((char *)src, header_with_newline))) {
             if (content || !first_time) {
                 /* Just want the header's content, so skip over the header
                  * and newline */
@@ -174,13 +470,10 @@ char * get_header(const char* message, const char * name, bool content)
                 ptr = strchr(ptr + 1, '\n');
             }
 
-            if(ptr) {
-                *ptr = 0;
-            }
             // Add "," when several headers are present
-            if (dest != last_header) {
+            if (dest != buf) {
                 /* Remove trailing whitespaces, tabs, and CRs */
-                while ((dest > last_header) &&
+                while ((dest > buf) &&
                         ((*(dest-1) == ' ')  ||
                          (*(dest-1) == '\r') ||
                          (*(dest-1) == '\n') ||
@@ -188,23 +481,28 @@ char * get_header(const char* message, const char * name, bool content)
                     *(--dest) = 0;
                 }
 
-                dest += sprintf(dest, ",");
+                if (dest < buf + size - 1) {
+                    *dest++ = ',';
+                }
             }
-            dest += sprintf(dest, "%s", src);
-            if(ptr) {
-                *ptr = '\n';
+
+            size_t len = ptr ? (size_t)(ptr - src) : strlen(src);
+            if (len > size - (dest - buf) - 1) {
+                len = size - (dest - buf) - 1;
             }
+            memcpy(dest, src, len);
+            dest += len;
+            *dest = 0;
 
             src++;
         }
         /* We found the header. */
-        if(dest != last_header) {
+        if(dest != buf) {
             break;
         }
         /* We didn't find the header, even in its short form. */
         if (short_form) {
-            free(src_orig);
-            return last_header;
+            return buf;
         }
 
         /* We should retry with the short form. */
@@ -227,83 +525,44 @@ char * get_header(const char* message, const char * name, bool content)
             name = "v:";
         } else {
             /* There is no short form to try. */
-            free(src_orig);
-            return last_header;
+            return buf;
         }
     } while (1);
 
-    *(dest--) = 0;
-
-    /* Remove trailing whitespaces, tabs, and CRs */
-    while ((dest > last_header) &&
-            ((*dest == ' ') || (*dest == '\r')|| (*dest == '\t'))) {
-        *(dest--) = 0;
-    }
-
-    /* Remove leading whitespaces */
-    for (start = last_header; *start == ' '; start++);
-
-    /* remove enclosed CRs in multilines */
-    /* don't remove enclosed CRs for multiple headers (e.g. Via) (Rhys) */
-    while((ptr = strstr(last_header, "\r\n")) != NULL
-            && (   *(ptr + 2) == ' '
-                   || *(ptr + 2) == '\r'
-                   || *(ptr + 2) == '\t') ) {
-        /* Use strlen(ptr) to include trailing zero */
-        memmove(ptr, ptr+1, strlen(ptr));
-    }
-
-    /* Remove illegal double CR characters */
-    while((ptr = strstr(last_header, "\r\r")) != NULL) {
-        memmove(ptr, ptr+1, strlen(ptr));
-    }
-    /* Remove illegal double Newline characters */
-    while((ptr = strstr(last_header, "\n\n")) != NULL) {
-        memmove(ptr, ptr+1, strlen(ptr));
-    }
-
-    free(src_orig);
-    return start;
+    clean_header(buf, dest);
+    return buf;
 }
 
-char * get_first_line(const char * message)
+char * get_first_line(const char * message, char *buf, size_t size)
 {
-    /* non reentrant. consider accepting char buffer as param */
-    static char last_header[MAX_HEADER_LEN * 10];
-    const char * src;
+    size_t i = 0;
 
     /* returns empty string in case of error */
-    memset(last_header, 0, sizeof(last_header));
-
-    if((!message) || (!strlen(message))) {
-        return last_header;
-    }
-
-    src = message;
-
-    int i=0;
-    while (*src) {
-        if((*src=='\n')||(*src=='\r')) {
-            break;
-        } else {
-            last_header[i]=*src;
+    if (message) {
+        while (message[i] && (message[i] != '\n') && (message[i] != '\r') && (i < size - 1)) {
+            buf[i] = message[i];
+            i++;
         }
-        i++;
-        src++;
     }
+    buf[i] = '\0';
 
-    return last_header;
+    return buf;
 }
 
-char * get_call_id(char *msg)
+/* Find the start of the Call-ID header's content, or NULL. */
+static const char * find_call_id(const char *msg)
 {
-    static char call_id[MAX_HEADER_LEN];
-    char * ptr1, * ptr2, * ptr3, backup;
-    bool short_form;
-
-    call_id[0] = '\0';
+    const char * ptr1;
+    bool short_form = false;
 
-    short_form = false;
+    if (indexed_message && (indexed_message->msg == msg) && indexed_message->complete) {
+        const char *found;
+        int i = sip_index_find(indexed_message, "Call-ID:", &found);
+        if (i < 0) {
+            return NULL;
+        }
+        return indexed_message->headers[i].name + indexed_message->headers[i].name_len;
+    }
 
     ptr1 = strstr(msg, "Call-ID:");
     if(!ptr1) {
@@ -328,8 +587,7 @@ char * get_call_id(char *msg)
         short_form = true;
     }
     if(!ptr1) {
-        WARNING("(1) No valid Call-ID: header in reply '%s'", msg);
-        return call_id;
+        return NULL;
     }
 
     if (short_form) {
@@ -337,6 +595,20 @@ char * get_call_id(char *msg)
     } else {
         ptr1 += 8;
     }
+    return ptr1;
+}
+
+char * get_call_id(const char *msg, char *call_id, size_t size)
+{
+    const char * ptr1, * ptr2, * ptr3;
+
+    call_id[0] = '\0';
+
+    ptr1 = find_call_id(msg);
+    if(!ptr1) {
+        WARNING("(1) No valid Call-ID: header in reply '%s'", msg);
+        return call_id;
+    }
 
     while((*ptr1 == ' ') || (*ptr1 == '\t')) {
         ptr1++;
@@ -362,12 +634,20 @@ char * get_call_id(char *msg)
         return call_id;
     }
 
-    backup = *ptr2;
-    *ptr2 = 0;
-    if ((ptr3 = strstr(ptr1, "///")) != 0) ptr1 = ptr3+3;
-    strcpy(call_id, ptr1);
-    *ptr2 = backup;
-    return (char *) call_id;
+    for (ptr3 = ptr1; ptr3 + 3 <= ptr2; ptr3++) {
+        if ((ptr3[0] == '/') && (ptr3[1] == '/') && (ptr3[2] == '/')) {
+            ptr1 = ptr3 + 3;
+            break;
+        }
+    }
+
+    size_t len = ptr2 - ptr1;
+    if (len > size - 1) {
+        len = size - 1;
+    }
+    memcpy(call_id, ptr1, len);
+    call_id[len] = '\0';
+    return call_id;
 }
 
 unsigned long int get_cseq_value(char *msg)
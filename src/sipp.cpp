@@ -151,6 +151,7 @@ struct sipp_option options_table[] = {
     {"i", "Set the local IP address for 'Contact:','Via:', and 'From:' headers. Default is primary host IP address.\n", SIPP_OPTION_IP, local_ip, 1},
     {"p", "Set the local port number.  Default is a random free port chosen by the system.", SIPP_OPTION_INT, &user_port, 1},
     {"bind_local", "Bind socket to local IP address, i.e. the local IP address is used as the source IP address.  If SIPp runs in server mode it will only listen on the local IP address instead of all IP addresses.", SIPP_OPTION_SETFLAG, &bind_local, 1},
+    {"reuseport", "In UDP server mode, open this many sockets on the local port with SO_REUSEPORT so that the kernel spreads incoming calls over several receive queues by source address and port.  Requires -p.  Default is 1.", SIPP_OPTION_INT, &reuseport_sockets, 1},
     {"ci", "Set the local control IP address", SIPP_OPTION_IP, control_ip, 1},
     {"cp", "Set the local control port number. Default is 8888.", SIPP_OPTION_INT, &control_port, 1},
     {"max_socket", "Set the max number of sockets to open simultaneously. This option is significant if you use one socket per call. Once this limit is reached, traffic is distributed over the sockets already opened. Default value is 50000", SIPP_OPTION_MAX_SOCKET, NULL, 1},
@@ -209,6 +210,7 @@ struct sipp_option options_table[] = {
     {"", "Call behavior options:", SIPP_HELP_TEXT_HEADER, NULL, 0},
     {"aa", "Enable automatic 200 OK answer for INFO, UPDATE and NOTIFY messages.", SIPP_OPTION_SETFLAG, &auto_answer, 1},
     {"base_cseq", "Start value of [cseq] for each call.", SIPP_OPTION_CSEQ, NULL, 1},
+    {"call_pool", "Keep up to this many freed call objects, with their memory for call state, for reuse by new calls.  They are allocated at startup.  Default is 256.", SIPP_OPTION_INT, &call_pool_size, 1},
     {"cid_str", "Call ID string (default %u-%p@%s).  %u=call_number, %s=ip_address, %p=process_number, %%=% (in any order).", SIPP_OPTION_STRING, &call_id_string, 1},
     {"d", "Controls the length of calls. More precisely, this controls the duration of 'pause' instructions in the scenario, if they do not have a 'milliseconds' section. Default value is 0 and default unit is milliseconds.", SIPP_OPTION_TIME_MS, &duration, 1},
     {"deadcall_wait", "How long the Call-ID and final status of calls should be kept to improve message and error logs (default unit is ms).", SIPP_OPTION_TIME_MS, &deadcall_wait, 1},
@@ -253,6 +255,9 @@ struct sipp_option options_table[] = {
      SIPP_OPTION_SETFLAG, &rtp_echo_enabled, 1},
     {"mb", "Set the RTP echo buffer size (default: 2048).", SIPP_OPTION_INT, &media_bufsize, 1},
     {"mp", "Set the local RTP echo port number. Default is 6000.", SIPP_OPTION_INT, &user_media_port, 1},
+#ifdef PCAPPLAY
+    {"pcap_threads", "Set the number of threads that share out the play_pcap_audio/video actions. Default is 4.", SIPP_OPTION_INT, &pcap_play_threads, 1},
+#endif
 #ifdef RTP_STREAM
 	{"min_rtp_port", "Minimum port number for RTP socket range.", SIPP_OPTION_INT, &min_rtp_port, 1},
 	{"max_rtp_port", "Maximum port number for RTP socket range.", SIPP_OPTION_INT, &max_rtp_port, 1},
@@ -271,6 +276,12 @@ struct sipp_option options_table[] = {
      SIPP_OPTION_FLOAT, &rate, 1},
     {"rp", "Specify the rate period for the call rate.  Default is 1 second and default unit is milliseconds.  This allows you to have n calls every m milliseconds (by using -r n -rp m).\n"
      "Example: -r 7 -rp 2000 ==> 7 calls every 2 seconds.\n         -r 10 -rp 5s => 10 calls every 5 seconds.", SIPP_OPTION_TIME_MS, &rate_period_ms, 1},
+    {"rate_max_burst", "Open at most this many calls back to back when the call generator has fallen behind its schedule; the others follow on the next passes.  Default is 0, no limit.", SIPP_OPTION_INT, &rate_max_burst, 1},
+    {"arrivals", "Set how the start times of new calls are spread with -r:\n"
+     "- uniform: one call every rate period / rate (default),\n"
+     "- poisson: exponentially distributed gaps with the same mean, as from independent callers.\n"
+     "Calls start on schedule whether or not earlier calls got their responses.", SIPP_OPTION_STRING, &arrivals, 1},
+    {"arrival_trace", "Start calls at the times read from this CSV file, instead of from -r.  The first field of each line is an arrival time in seconds; times are taken relative to the first line and must not decrease.  SIPp stops creating calls at the end of the trace.", SIPP_OPTION_STRING, &arrival_trace_file, 1},
     {"rate_scale", "Control the units for the '+', '-', '*', and '/' keys.", SIPP_OPTION_FLOAT, &rate_scale, 1},
 
     {"rate_increase", "Specify the rate increase every -fd units (default is seconds).  This allows you to increase the load for each independent logging period.\n"
@@ -315,6 +326,8 @@ struct sipp_option options_table[] = {
      "Small values allow more precise scheduling but impacts CPU usage."
      "If the compression is on, the value is set to 50ms. The default value is 10ms.", SIPP_OPTION_TIME_MS, &timer_resolution, 1},
     {"max_recv_loops", "Set the maximum number of messages received read per cycle. Increase this value for high traffic level.  The default value is 1000.", SIPP_OPTION_INT, &max_recv_loops, 1},
+    {"recv_batch", "Set the maximum number of UDP datagrams read per recvmmsg() call. Datagrams are processed straight from preallocated receive buffers. The default value is 1, which reads one datagram per recvfrom().", SIPP_OPTION_INT, &recv_batch, 1},
+    {"send_batch", "Queue up to this many outgoing UDP datagrams per scheduler pass and send them with one sendmmsg() call before polling for input. The default value is 1, which sends each message as it is built.", SIPP_OPTION_INT, &send_batch, 1},
     {"max_sched_loops", "Set the maximum number of calls run per event loop. Increase this value for high traffic level.  The default value is 1000.", SIPP_OPTION_INT, &max_sched_loops, 1},
 
     {"watchdog_interval", "Set gap between watchdog timer firings.  Default is 400.", SIPP_OPTION_TIME_MS, &watchdog_interval, 1},
@@ -342,6 +355,10 @@ struct sipp_option options_table[] = {
     {"shortmessage_file", "Set the name of the short message log file.", SIPP_OPTION_LFNAME, &shortmessage_lfi, 1},
     {"shortmessage_overwrite", "Overwrite the short message log file (default true).", SIPP_OPTION_LFOVERWRITE, &shortmessage_lfi, 1},
 
+    {"trace_pcapng", "Capture sent and received SIP messages as synthetic UDP or TCP packets in <scenario file name>_<pid>_messages.pcapng", SIPP_OPTION_SETFLAG, &usePcapngf, 1},
+    {"pcapng_file", "Set the name of the pcapng capture file.", SIPP_OPTION_LFNAME, &pcapng_lfi, 1},
+    {"pcapng_overwrite", "Overwrite the pcapng capture file (default true).", SIPP_OPTION_LFOVERWRITE, &pcapng_lfi, 1},
+
     {"trace_counts", "Dumps individual message counts in a CSV file.", SIPP_OPTION_SETFLAG, &useCountf, 1},
 
     {"trace_err", "Trace all unexpected messages in <scenario file name>_<pid>_errors.log.", SIPP_OPTION_SETFLAG, &print_all_responses, 1},
@@ -358,8 +375,9 @@ struct sipp_option options_table[] = {
     {"trace_screen", "Dump statistic screens in the <scenario_name>_<pid>_screens.log file when quitting SIPp. Useful to get a final status report in background mode (-bg option).", SIPP_OPTION_SETFLAG, &useScreenf, 1},
 
     {"trace_rtt", "Allow tracing of all response times in <scenario file name>_<pid>_rtt.csv.", SIPP_OPTION_SETFLAG, &dumpInRtt, 1},
-    {"rtt_freq", "freq is mandatory. Dump response times every freq calls in the log file defined by -trace_rtt. Default value is 200.",
+    {"rtt_freq", "freq is mandatory. Write the response times to the log file defined by -trace_rtt as soon as freq of them are pending. Default value is 200.",
      SIPP_OPTION_LONG, &report_freq_dumpRtt, 1},
+    {"rtt_binary", "Write the -trace_rtt response times as 16 byte binary records (date and response time in microseconds, RTD number) to <scenario file name>_<pid>_rtt.bin instead of CSV.", SIPP_OPTION_SETFLAG, &rtt_binary, 1},
 
 
     {"trace_logs", "Allow tracing of <log> actions in <scenario file name>_<pid>_logs.log.", SIPP_OPTION_SETFLAG, &useLogf, 1},
@@ -369,6 +387,7 @@ struct sipp_option options_table[] = {
     {"ringbuffer_files", "How many error, message, shortmessage and calldebug files should be kept after rotation?", SIPP_OPTION_INT, &ringbuffer_files, 1},
     {"ringbuffer_size", "How large should error, message, shortmessage and calldebug files be before they get rotated?", SIPP_OPTION_LONG_LONG, &ringbuffer_size, 1},
     {"max_log_size", "What is the limit for error, message, shortmessage and calldebug file sizes.", SIPP_OPTION_LONG_LONG, &max_log_size, 1},
+    {"trace_buffer_size", "Size in bytes of the per-thread buffer where message, shortmessage, calldebug and log records wait to be written by the logger thread (default 4 MB). Records are dropped while it is full.", SIPP_OPTION_LONG_LONG, &trace_buffer_size, 1},
 
 };
 
@@ -469,7 +488,7 @@ void pollset_process(int wait)
 #ifdef HAVE_EPOLL
     /* Ignore the wait parameter and always wait - when establishing TCP
      * connections, the alternative is that we tight-loop. */
-    rs = epoll_wait(epollfd, epollevents, max_recv_loops, 1);
+    rs = epoll_wait(epollfd, epollevents, max_recv_loops, CallGenerationTask::call_due_soon() ? 0 : 1);
     // If we're receiving as many epollevents as possible, flag CPU congestion
     cpu_max = (rs > (max_recv_loops - 2));
 #else
@@ -489,6 +508,11 @@ void pollset_process(int wait)
         struct sipp_socket *sock = sockets[poll_idx];
         int events = 0;
         int ret = 0;
+#ifdef HAVE_EPOLL
+        /* Taken before reading: batched UDP messages are processed by
+         * empty_socket() and may already change the socket table. */
+        int old_pollnfds = pollnfds;
+#endif
 
         assert(sock);
 
@@ -560,7 +584,8 @@ void pollset_process(int wait)
                     }
                 }
             } else {
-                if ((ret = empty_socket(sock)) <= 0) {
+                /* Only recvmmsg() batches are taken off the budget. */
+                if ((ret = empty_socket(sock, &loops)) <= 0) {
 #ifdef USE_SCTP
                     if (sock->ss_transport==T_SCTP && ret==-2) ;
                     else
@@ -596,7 +621,6 @@ void pollset_process(int wait)
      * pending_messages queue again. */
 
 #ifdef HAVE_EPOLL
-    int old_pollnfds = pollnfds;
     getmilliseconds();
     /* Keep processing messages until this socket is freed (changing the number of file descriptors) or we run out of messages. */
     while ((pollnfds == old_pollnfds) &&
@@ -679,6 +703,9 @@ void traffic_thread()
     char         L_file_name [MAX_PATH];
     sprintf (L_file_name, "%s_%d_screen.log", scenario_file, getpid());
 
+    /* The thread counters are only folded from here from now on. */
+    CStat::setFoldThread();
+
     getmilliseconds();
 
     /* Arm the global timer if needed */
@@ -739,6 +766,7 @@ void traffic_thread()
 #ifdef RTP_STREAM
                 rtpstream_shutdown();
 #endif
+                flush_send_queue();
                 for (int i = 0; i < pollnfds; i++) {
                     sipp_close_socket(sockets[i]);
                 }
@@ -806,6 +834,9 @@ void traffic_thread()
             sockets_pending_reset.erase(sockets_pending_reset.begin());
         }
 
+        /* Send what this pass queued before waiting for input. */
+        flush_send_queue();
+
         /* Update the clock. */
         getmilliseconds();
         /* Receive incoming messages */
@@ -859,12 +890,12 @@ void rtp_echo_thread (void * param)
         }
 
         if (*(int *)param==media_socket) {
-            rtp_pckts++;
-            rtp_bytes += ns;
+            CThreadCounters::add(CThreadCounters::TC_RTP_PCKTS);
+            CThreadCounters::add(CThreadCounters::TC_RTP_BYTES, ns);
         } else {
             /* packets on the second RTP stream */
-            rtp2_pckts++;
-            rtp2_bytes += ns;
+            CThreadCounters::add(CThreadCounters::TC_RTP2_PCKTS);
+            CThreadCounters::add(CThreadCounters::TC_RTP2_BYTES, ns);
         }
     }
 }
@@ -1773,6 +1804,10 @@ int main(int argc, char *argv[])
         ERROR("Ring Buffer options and maximum log size are mutually exclusive.");
     }
 
+    if (trace_buffer_size < 4096) {
+        ERROR("The trace buffer size must be at least 4096 bytes");
+    }
+
     if (global_lost) {
         lose_packets = 1;
     }
@@ -1803,6 +1838,10 @@ int main(int argc, char *argv[])
         rotate_calldebugf();
     }
 
+    if (usePcapngf == 1) {
+        rotate_pcapngf();
+    }
+
     if (useScreenf == 1) {
         char L_file_name [MAX_PATH];
         sprintf (L_file_name, "%s_%d_screen.log", scenario_file, getpid());
@@ -1844,8 +1883,9 @@ int main(int argc, char *argv[])
 
 
     if (dumpInRtt == 1) {
-        main_scenario->stats->initRtt((char*)scenario_file, (char*)".csv",
-                                      report_freq_dumpRtt);
+        main_scenario->stats->initRtt((char*)scenario_file,
+                                      (char*)(rtt_binary ? ".bin" : ".csv"),
+                                      report_freq_dumpRtt, rtt_binary);
     }
 
     // Check the soft limit on the number of open files,
@@ -1902,6 +1942,41 @@ int main(int argc, char *argv[])
     call::stepDynamicId  = stepDynamicId;
 
 
+    if (recv_batch < 1 || recv_batch > MAX_RECV_BATCH) {
+        ERROR("The receive batch size must be between 1 and %d", MAX_RECV_BATCH);
+    }
+    if (send_batch < 1 || send_batch > MAX_SEND_BATCH) {
+        ERROR("The send batch size must be between 1 and %d", MAX_SEND_BATCH);
+    }
+#ifndef HAVE_MMSG
+    if (recv_batch > 1 || send_batch > 1) {
+        WARNING("recvmmsg() and sendmmsg() are not available, using one datagram per system call");
+    }
+#endif
+
+    if (rate_max_burst < 0) {
+        ERROR("The maximum call burst can not be negative");
+    }
+    if (arrivals && strcmp(arrivals, "uniform") && strcmp(arrivals, "poisson")) {
+        ERROR("Unknown arrival process '%s', use uniform or poisson", arrivals);
+    }
+    if (arrivals && arrival_trace_file) {
+        ERROR("-arrivals and -arrival_trace can not be used together");
+    }
+    if ((arrivals || arrival_trace_file) && users >= 0) {
+        ERROR("-arrivals and -arrival_trace pace calls by rate, they can not be used with -users");
+    }
+    if (call_pool_size < 0) {
+        ERROR("The call pool size can not be negative");
+    }
+#ifdef PCAPPLAY
+    if (pcap_play_threads < 1) {
+        ERROR("At least one PCAP media thread is needed");
+    }
+#endif
+
+    call::prewarm_pool();
+
     /* Now Initialize the scenarios. */
     main_scenario->runInit();
     if(ooc_scenario) {
@@ -2090,6 +2165,9 @@ int main(int argc, char *argv[])
         /* Second socket bound */
     }
 
+    /* Keyword values such as [local_ip] and [media_port] are now known. */
+    compile_messages = true;
+
     /* Creating the remote control socket thread */
     setup_ctrl_socket();
     if (!nostdin) {
@@ -239,3 +239,978 @@ TEST(xp_parser, set_xml_buffer_from_string__bad) {
         EXPECT_STREQ("Some Scenario", prop);
     }
 }
+
+TEST(CallIdHash, StringAndLength) {
+    const char *ids[] = { "1-1234@127.0.0.1", "2-1234@127.0.0.1", "///main-init", NULL };
+
+    /* FNV-1a offset basis. */
+    EXPECT_EQ(2166136261U, call_id_hash(""));
+    for (int i = 0; ids[i]; ++i) {
+        EXPECT_EQ(call_id_hash(ids[i]), call_id_hash(ids[i], strlen(ids[i])));
+    }
+    EXPECT_NE(call_id_hash(ids[0]), call_id_hash(ids[1]));
+}
+
+class wheel_test_task : public task
+{
+public:
+    wheel_test_task() : wakeup(0) {}
+    bool run() {
+        return true;
+    }
+    void dump() {}
+    void pause(unsigned int at) {
+        wakeup = at;
+        setPaused();
+    }
+    bool isRunning() {
+        return running;
+    }
+protected:
+    unsigned int wake() {
+        return wakeup;
+    }
+private:
+    unsigned int wakeup;
+};
+
+TEST(TimeWheel, ExpireAcrossWheels) {
+    clock_tick = 1000;
+
+    wheel_test_task *soon = new wheel_test_task();
+    wheel_test_task *later = new wheel_test_task();
+    wheel_test_task *never = new wheel_test_task();
+    EXPECT_EQ(3, (int)get_running_tasks()->size());
+
+    soon->pause(1005);
+    later->pause(6000); /* Beyond the first wheel. */
+    never->pause(0);
+    EXPECT_EQ(0, (int)get_running_tasks()->size());
+    EXPECT_EQ(3, paused_tasks_count());
+
+    clock_tick = 1006;
+    EXPECT_EQ(1, expire_paused_tasks());
+    EXPECT_TRUE(soon->isRunning());
+    EXPECT_FALSE(later->isRunning());
+
+    clock_tick = 7000;
+    EXPECT_EQ(1, expire_paused_tasks());
+    EXPECT_TRUE(later->isRunning());
+    EXPECT_FALSE(never->isRunning());
+    EXPECT_EQ(2, (int)get_running_tasks()->size());
+    EXPECT_EQ(1, paused_tasks_count());
+
+    delete soon;
+    delete later;
+    delete never;
+    EXPECT_EQ(0, (int)get_running_tasks()->size());
+    EXPECT_EQ(0, paused_tasks_count());
+    clock_tick = 0;
+}
+
+static unsigned long long bench_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Run with --gtest_also_run_disabled_tests to get per task costs. */
+TEST(TimeWheel, DISABLED_Benchmark1MTasks) {
+    const int nb_tasks = 1000000;
+    const unsigned int spread = 10000;
+    wheel_test_task **tasks = new wheel_test_task*[nb_tasks];
+
+    /* The timing wheel never goes back in time: start past the ticks of
+     * the other tests. */
+    const unsigned int base = 100000;
+    clock_tick = base;
+    for (int i = 0; i < nb_tasks; i++) {
+        tasks[i] = new wheel_test_task();
+    }
+
+    unsigned long long start = bench_usec();
+    for (int i = 0; i < nb_tasks; i++) {
+        tasks[i]->pause(base + 1 + (i * 7919U) % spread);
+    }
+    unsigned long long insert = bench_usec() - start;
+
+    start = bench_usec();
+    int woken = 0;
+    while (clock_tick <= base + spread + 1) {
+        clock_tick++;
+        woken += expire_paused_tasks();
+    }
+    unsigned long long expire = bench_usec() - start;
+    EXPECT_EQ(nb_tasks, woken);
+
+    printf("timewheel: %d tasks, insert %.1f ns/task, expire %.1f ns/task\n",
+           nb_tasks, insert * 1000.0 / nb_tasks, expire * 1000.0 / nb_tasks);
+
+    for (int i = 0; i < nb_tasks; i++) {
+        delete tasks[i];
+    }
+    delete [] tasks;
+    clock_tick = 0;
+}
+
+class table_test_listener : public listener
+{
+public:
+    table_test_listener(const char *id) : listener(id, true) {}
+    bool process_incoming(char *, struct sockaddr_storage *) {
+        return true;
+    }
+    bool process_twinSippCom(char *) {
+        return true;
+    }
+};
+
+TEST(ListenerTable, InsertLookupRemove) {
+    const int nb_listeners = 5000;
+    table_test_listener **table = new table_test_listener*[nb_listeners];
+    char id[64];
+    int i;
+
+    for (i = 0; i < nb_listeners; i++) {
+        sprintf(id, "%d-4242@192.168.1.1", i);
+        table[i] = new table_test_listener(id);
+    }
+    for (i = 0; i < nb_listeners; i++) {
+        sprintf(id, "%d-4242@192.168.1.1", i);
+        EXPECT_EQ(table[i], get_listener(id));
+    }
+
+    /* Removing every other entry shifts probe sequences back. */
+    for (i = 0; i < nb_listeners; i += 2) {
+        delete table[i];
+    }
+    for (i = 0; i < nb_listeners; i++) {
+        sprintf(id, "%d-4242@192.168.1.1", i);
+        EXPECT_EQ((i % 2) ? table[i] : NULL, get_listener(id));
+    }
+
+    /* Lookups by length do not need a terminated Call-ID. */
+    strcpy(id, "1-4242@192.168.1.1;trailer");
+    size_t len = strlen("1-4242@192.168.1.1");
+    EXPECT_EQ(table[1], get_listener(id, len, call_id_hash(id, len)));
+
+    for (i = 1; i < nb_listeners; i += 2) {
+        delete table[i];
+    }
+    delete [] table;
+}
+
+static const char *parser_corpus[] = {
+    ("INVITE sip:service@192.168.1.2:5060 SIP/2.0\r\n"
+     "Via: SIP/2.0/UDP 192.168.1.1:5061;branch=z9hG4bK-4242-1-0\r\n"
+     "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK-proxy\r\n"
+     "From: sipp <sip:sipp@192.168.1.1:5061>;tag=4242SIPpTag001\r\n"
+     "To: service <sip:service@192.168.1.2:5060>\r\n"
+     "Call-ID: 1-4242@192.168.1.1\r\n"
+     "CSeq: 1 INVITE\r\n"
+     "Contact: sip:sipp@192.168.1.1:5061\r\n"
+     "Max-Forwards: 70\r\n"
+     "Subject: Performance Test\r\n"
+     "Content-Type: application/sdp\r\n"
+     "Content-Length:   129\r\n"
+     "\r\n"
+     "v=0\r\n"
+     "o=user1 53655765 2353687637 IN IP4 192.168.1.1\r\n"
+     "s=-\r\n"
+     "c=IN IP4 192.168.1.1\r\n"
+     "t=0 0\r\n"
+     "m=audio 6000 RTP/AVP 0\r\n"
+     "a=rtpmap:0 PCMU/8000\r\n"),
+    ("SIP/2.0 200 OK\r\n"
+     "v: SIP/2.0/UDP 192.168.1.1:5061;branch=z9hG4bK-4242-1-0\r\n"
+     "Record-Route: <sip:proxy1.example.com;lr>\r\n"
+     "Record-Route: <sip:proxy2.example.com;lr>\r\n"
+     "f: sipp <sip:sipp@192.168.1.1:5061>;tag=4242SIPpTag001\r\n"
+     "t: service <sip:service@192.168.1.2:5060>;tag=2424SIPpTag011\r\n"
+     "i: 1-4242@192.168.1.1\r\n"
+     "CSeq: 1 INVITE\r\n"
+     "m: <sip:192.168.1.2:5060;transport=UDP>\r\n"
+     "c: application/sdp\r\n"
+     "l: 0\r\n"
+     "\r\n"),
+    ("ACK sip:service@192.168.1.2:5060 SIP/2.0\r\n"
+     "Via: SIP/2.0/UDP 192.168.1.1:5061;branch=z9hG4bK-4242-1-5\r\n"
+     "From: sipp <sip:sipp@192.168.1.1:5061>;tag=4242SIPpTag001\r\n"
+     "To: service <sip:service@192.168.1.2:5060>;tag=2424SIPpTag011\r\n"
+     "Call-ID: 1-4242@192.168.1.1\r\n"
+     "CSeq: 1 ACK\r\n"
+     "Contact: sip:sipp@192.168.1.1:5061\r\n"
+     "Max-Forwards: 70\r\n"
+     "Content-Length: 0\r\n"
+     "\r\n"),
+    ("BYE sip:service@192.168.1.2:5060 SIP/2.0\r\n"
+     "Via: SIP/2.0/UDP 192.168.1.1:5061;branch=z9hG4bK-4242-1-7\r\n"
+     "From: sipp <sip:sipp@192.168.1.1:5061>;tag=4242SIPpTag001\r\n"
+     "To: service <sip:service@192.168.1.2:5060>;tag=2424SIPpTag011\r\n"
+     "call-id: 1-4242@192.168.1.1\r\n"
+     "CSeq: 2 BYE\r\n"
+     "Subject: a header folded\r\n"
+     "   over two lines\r\n"
+     "Contact: sip:sipp@192.168.1.1:5061\r\n"
+     "Content-Length: 0\r\n"
+     "\r\n"),
+    NULL
+};
+
+static const char *parser_headers[] = {
+    "Via:", "From:", "To:", "Call-ID:", "CSeq:", "Contact:", "Content-Type:",
+    "Content-Length:", "Record-Route:", "Max-Forwards:", "Subject:", "v:",
+    "i:", "to:", "X-Missing:", NULL
+};
+
+TEST(MessageIndex, MatchesScan) {
+    struct sip_msg_index index;
+    char scanned[MAX_HEADER_BUF], indexed[MAX_HEADER_BUF];
+
+    for (int i = 0; parser_corpus[i]; i++) {
+        const char *msg = parser_corpus[i];
+        EXPECT_TRUE(sip_index_message(&index, msg));
+
+        for (int j = 0; parser_headers[j]; j++) {
+            for (int content = 0; content < 2; content++) {
+                get_header(msg, parser_headers[j], content, scanned, sizeof(scanned));
+                set_indexed_message(&index);
+                EXPECT_STREQ(scanned, get_header(msg, parser_headers[j], content,
+                                                 indexed, sizeof(indexed)))
+                        << "message " << i << " header " << parser_headers[j];
+                set_indexed_message(NULL);
+            }
+        }
+
+        get_call_id(msg, scanned, sizeof(scanned));
+        set_indexed_message(&index);
+        EXPECT_STREQ(scanned, get_call_id(msg, indexed, sizeof(indexed)));
+        set_indexed_message(NULL);
+    }
+}
+
+TEST(MessageParser, CallerBuffers) {
+    const char *msg = parser_corpus[1];
+    char a[MAX_HEADER_BUF], b[MAX_HEADER_BUF], small[8];
+
+    /* Results land in the caller's buffer and survive the next call. */
+    EXPECT_EQ(a, get_header_content(msg, "Record-Route:", a, sizeof(a)));
+    EXPECT_EQ(b, get_header_content(msg, "CSeq:", b, sizeof(b)));
+    EXPECT_STREQ("<sip:proxy1.example.com;lr>, <sip:proxy2.example.com;lr>", a);
+    EXPECT_STREQ("1 INVITE", b);
+
+    /* Short buffers truncate rather than overflow. */
+    EXPECT_STREQ("1-4242@", get_call_id(msg, small, sizeof(small)));
+    EXPECT_STREQ("Record-", get_header(msg, "Record-Route:", false, small, sizeof(small)));
+    EXPECT_STREQ("SIP/2.0", get_first_line(msg, small, sizeof(small)));
+
+    EXPECT_STREQ("2424SIPpTag011", get_peer_tag(msg, a, sizeof(a)));
+    EXPECT_EQ(NULL, get_peer_tag(parser_corpus[0], a, sizeof(a)));
+
+    /* The message itself is left untouched. */
+    EXPECT_STREQ(parser_corpus[1], msg);
+}
+
+TEST(MessageIndex, CompactFormsAndViews) {
+    struct sip_msg_index index;
+    size_t len;
+
+    EXPECT_TRUE(sip_index_message(&index, parser_corpus[1]));
+    EXPECT_EQ(10, index.nb_headers);
+    EXPECT_EQ(0, index.first[SIP_HDR_VIA]);
+
+    const char *value = sip_index_header(&index, "Call-ID:", &len);
+    EXPECT_EQ(std::string("1-4242@192.168.1.1"), std::string(value, len));
+    value = sip_index_header(&index, "Content-Length:", &len);
+    EXPECT_EQ(std::string("0"), std::string(value, len));
+    EXPECT_EQ(NULL, sip_index_header(&index, "Route:", &len));
+
+    /* Lines of the body that look like headers defeat the index. */
+    EXPECT_FALSE(sip_index_message(&index,
+                                   "NOTIFY sip:a@b SIP/2.0\r\n"
+                                   "Content-Type: message/sipfrag\r\n"
+                                   "\r\n"
+                                   "SIP/2.0 200 OK\r\n"
+                                   "Contact: <sip:c@d>\r\n"));
+    EXPECT_TRUE(index.body_headers);
+}
+
+/* Run with --gtest_also_run_disabled_tests to compare lookup costs. */
+TEST(MessageIndex, DISABLED_BenchmarkCorpus) {
+    const int rounds = 200000;
+    struct sip_msg_index index;
+    unsigned long long start, scanned, indexed;
+    char buf[MAX_HEADER_BUF];
+    int nb_msgs;
+
+    for (nb_msgs = 0; parser_corpus[nb_msgs]; nb_msgs++);
+
+    /* What process_incoming() looks up for a typical message. */
+    start = bench_usec();
+    for (int r = 0; r < rounds; r++) {
+        const char *msg = parser_corpus[r % nb_msgs];
+        get_call_id(msg, buf, sizeof(buf));
+        get_header_content(msg, "Content-Type:", buf, sizeof(buf));
+        get_header_content(msg, "CSeq:", buf, sizeof(buf));
+        get_header_content(msg, "via:", buf, sizeof(buf));
+        get_header_content(msg, "To:", buf, sizeof(buf));
+    }
+    scanned = bench_usec() - start;
+
+    start = bench_usec();
+    for (int r = 0; r < rounds; r++) {
+        const char *msg = parser_corpus[r % nb_msgs];
+        sip_index_message(&index, msg);
+        set_indexed_message(&index);
+        get_call_id(msg, buf, sizeof(buf));
+        get_header_content(msg, "Content-Type:", buf, sizeof(buf));
+        get_header_content(msg, "CSeq:", buf, sizeof(buf));
+        get_header_content(msg, "via:", buf, sizeof(buf));
+        get_header_content(msg, "To:", buf, sizeof(buf));
+        set_indexed_message(NULL);
+    }
+    indexed = bench_usec() - start;
+
+    printf("parser: %d messages, scanning %.0f ns/msg, indexed %.0f ns/msg\n",
+           rounds, scanned * 1000.0 / rounds, indexed * 1000.0 / rounds);
+}
+
+/* The INVITE of the built-in uac scenario, sent from a call that has no
+ * socket of its own. */
+static scenario *uac_scenario()
+{
+    static scenario *uac = NULL;
+
+    if (!uac) {
+        /* As main() sets them up. */
+        globalVariables = new AllocVariableTable(NULL);
+        userVariables = new AllocVariableTable(globalVariables);
+        strcpy(local_ip_escaped, "192.168.1.1");
+        strcpy(remote_ip_escaped, "192.168.1.2");
+        strcpy(media_ip_escaped, "192.168.1.1");
+        local_port = 5061;
+        remote_port = 5060;
+        media_port = 6000;
+        uac = new scenario(0, find_scenario("uac"));
+    }
+    return uac;
+}
+
+TEST(CompiledMessage, MatchesInterpreted) {
+    scenario *uac = uac_scenario();
+    call *c = new call(uac, NULL, NULL, "1-4242@192.168.1.1", 0, false, false, false);
+    char interpreted[SIPP_MAX_MSG_SIZE], compiled[SIPP_MAX_MSG_SIZE];
+    int interpreted_len, compiled_len;
+
+    for (unsigned int i = 0; i < uac->messages.size(); i++) {
+        SendingMessage *msg = uac->messages[i]->send_scheme;
+        if (!msg) {
+            continue;
+        }
+        int before = msg->numComponents();
+        c->createSendingMessage(msg, i, interpreted, sizeof(interpreted), &interpreted_len);
+        msg->compile();
+        c->createSendingMessage(msg, i, compiled, sizeof(compiled), &compiled_len);
+
+        EXPECT_STREQ(interpreted, compiled);
+        EXPECT_EQ(interpreted_len, compiled_len);
+        EXPECT_LT(msg->numComponents(), before);
+    }
+
+    /* Keywords that eat the next CRLF keep that literal to themselves. */
+    SendingMessage *msg = new SendingMessage(uac, const_cast<char*>(
+        "ACK sip:[service]@[remote_ip] SIP/2.0\n"
+        "[routes]\n"
+        "Via: SIP/2.0/[transport] [local_ip]:[local_port]\n"
+        "[last_Record-Route]\n"
+        "[local_ip_type]\n"
+        "Content-Length: 0\n\n"));
+    c->createSendingMessage(msg, -1, interpreted, sizeof(interpreted), &interpreted_len);
+    msg->compile();
+    EXPECT_EQ(5, msg->numComponents());
+    c->createSendingMessage(msg, -1, compiled, sizeof(compiled), &compiled_len);
+    EXPECT_STREQ(interpreted, compiled);
+    EXPECT_EQ(interpreted_len, compiled_len);
+    delete msg;
+    delete c;
+}
+
+/* Run with --gtest_also_run_disabled_tests to get the render rate. */
+TEST(CompiledMessage, DISABLED_BenchmarkUacInvite) {
+    const int rounds = 1000000;
+    scenario *uac = uac_scenario();
+    call *c = new call(uac, NULL, NULL, "1-4242@192.168.1.1", 0, false, false, false);
+    SendingMessage *invite = new SendingMessage(uac, const_cast<char*>(
+        "INVITE sip:[service]@[remote_ip]:[remote_port] SIP/2.0\n"
+        "Via: SIP/2.0/[transport] [local_ip]:[local_port];branch=[branch]\n"
+        "From: sipp <sip:sipp@[local_ip]:[local_port]>;tag=[pid]SIPpTag00[call_number]\n"
+        "To: [service] <sip:[service]@[remote_ip]:[remote_port]>\n"
+        "Call-ID: [call_id]\n"
+        "CSeq: 1 INVITE\n"
+        "Contact: sip:sipp@[local_ip]:[local_port]\n"
+        "Max-Forwards: 70\n"
+        "Subject: Performance Test\n"
+        "Content-Type: application/sdp\n"
+        "Content-Length: [len]\n"
+        "\n"
+        "v=0\n"
+        "o=user1 53655765 2353687637 IN IP[local_ip_type] [local_ip]\n"
+        "s=-\n"
+        "c=IN IP[media_ip_type] [media_ip]\n"
+        "t=0 0\n"
+        "m=audio [media_port] RTP/AVP 0\n"
+        "a=rtpmap:0 PCMU/8000\n"));
+    char buf[SIPP_MAX_MSG_SIZE];
+    unsigned long long start, interpreted, compiled;
+
+    start = bench_usec();
+    for (int r = 0; r < rounds; r++) {
+        c->createSendingMessage(invite, 0, buf, sizeof(buf));
+    }
+    interpreted = bench_usec() - start;
+
+    invite->compile();
+    start = bench_usec();
+    for (int r = 0; r < rounds; r++) {
+        c->createSendingMessage(invite, 0, buf, sizeof(buf));
+    }
+    compiled = bench_usec() - start;
+
+    printf("uac INVITE: interpreted %.0f msgs/s, compiled %.0f msgs/s\n",
+           rounds * 1e6 / interpreted, rounds * 1e6 / compiled);
+
+    delete invite;
+    delete c;
+}
+
+TEST(SocketBuf, PoolReuse) {
+    char data[100];
+    memset(data, 'x', sizeof(data));
+
+    struct socketbuf *first = alloc_socketbuf(data, sizeof(data), DO_COPY, NULL);
+    char *first_buf = first->buf;
+    EXPECT_EQ(sizeof(data), first->len);
+    EXPECT_LE(sizeof(data), first->size);
+    EXPECT_EQ(0, memcmp(first_buf, data, sizeof(data)));
+    free_socketbuf(first);
+
+    /* The structure and the data block come straight back. */
+    unsigned long hits = socketbuf_pool_hits;
+    struct socketbuf *second = alloc_socketbuf(data, 50, DO_COPY, NULL);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(first_buf, second->buf);
+    EXPECT_EQ(hits + 2, socketbuf_pool_hits);
+    free_socketbuf(second);
+
+    /* Larger requests are rounded up to the next size class. */
+    size_t allocated;
+    char *big = alloc_socketbuf_data(5000, &allocated);
+    EXPECT_EQ((size_t)SIPP_MAX_MSG_SIZE, allocated);
+    free_socketbuf_data(big, allocated);
+    EXPECT_EQ(big, alloc_socketbuf_data(SIPP_MAX_MSG_SIZE, &allocated));
+    free_socketbuf_data(big, allocated);
+
+    /* Anything above the largest class is not pooled. */
+    char *huge = alloc_socketbuf_data(SIPP_MAX_MSG_SIZE + 1, &allocated);
+    EXPECT_EQ((size_t)SIPP_MAX_MSG_SIZE + 1, allocated);
+    free_socketbuf_data(huge, allocated);
+}
+
+static const char *framer_corpus[] = {
+    "INVITE sip:bob@biloxi.com SIP/2.0\r\n"
+    "Via: SIP/2.0/TCP pc33.atlanta.com;branch=z9hG4bK776asdhds\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.com\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Content-Type: application/sdp\r\n"
+    "Content-Length: 32\r\n"
+    "\r\n"
+    "v=0\r\no=- 1 1 IN IP4 10.0.0.1\r\n\r\n",
+    "SIP/2.0 100 Trying\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.com\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n",
+    /* Compact form, lower case and no space before the value. */
+    "SIP/2.0 200 OK\r\n"
+    "i: a84b4c76e66710@pc33.atlanta.com\r\n"
+    "l:5\r\n"
+    "\r\n"
+    "\r\n\r\nx",
+    /* No Content-Length at all. */
+    "ACK sip:bob@192.0.2.4 SIP/2.0\r\n"
+    "CONTENT-LENGTH-X: 12\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.com\r\n"
+    "\r\n",
+    /* A value that is not a number counts as zero. */
+    "BYE sip:bob@192.0.2.4 SIP/2.0\r\n"
+    "content-length:   7x\r\n"
+    "\r\n",
+    /* CRLF keep-alive. */
+    "\r\n\r\n",
+};
+
+/* Feed the corpus as one pipelined stream, in reads of every size, and
+ * check that the framer cuts it back into the same messages. */
+TEST(SipFramer, SplitAndPipelined) {
+    std::string stream;
+    for (unsigned int i = 0; i < sizeof(framer_corpus) / sizeof(framer_corpus[0]); i++) {
+        stream += framer_corpus[i];
+    }
+
+    for (size_t chunk = 1; chunk <= stream.size(); chunk++) {
+        struct sip_framer framer;
+        std::string buf;
+        size_t fed = 0;
+        unsigned int found = 0;
+
+        sip_framer_reset(&framer);
+        while (fed < stream.size() || !buf.empty()) {
+            size_t len = sip_framer_scan(&framer, buf.data(), buf.size(), false);
+            if (len) {
+                ASSERT_LT(found, sizeof(framer_corpus) / sizeof(framer_corpus[0]));
+                EXPECT_EQ(framer_corpus[found], buf.substr(0, len)) << "reads of " << chunk;
+                found++;
+                buf.erase(0, len);
+                sip_framer_reset(&framer);
+                continue;
+            }
+            if (fed == stream.size()) {
+                break;
+            }
+            size_t n = std::min(chunk, stream.size() - fed);
+            buf.append(stream, fed, n);
+            fed += n;
+        }
+        EXPECT_EQ(sizeof(framer_corpus) / sizeof(framer_corpus[0]), found) << "reads of " << chunk;
+        EXPECT_TRUE(buf.empty());
+    }
+}
+
+TEST(SipFramer, ControlMessages) {
+    const char stream[] = "call-id 1\033call-id 2";
+    struct sip_framer framer;
+
+    sip_framer_reset(&framer);
+    EXPECT_EQ(0u, sip_framer_scan(&framer, stream, 4, true));
+    EXPECT_EQ(10u, sip_framer_scan(&framer, stream, sizeof(stream) - 1, true));
+    sip_framer_reset(&framer);
+    EXPECT_EQ(0u, sip_framer_scan(&framer, stream + 10, sizeof(stream) - 11, true));
+}
+
+TEST(SipFramer, ContentLengthErrors) {
+    const char too_big[] = "MESSAGE sip:a SIP/2.0\r\nContent-Length: 99999999999\r\n\r\n";
+    const char conflict[] = "MESSAGE sip:a SIP/2.0\r\nContent-Length: 4\r\nl: 5\r\n\r\nbody!";
+    const char repeated[] = "MESSAGE sip:a SIP/2.0\r\nContent-Length: 4\r\nl: 4\r\n\r\nbody";
+    struct sip_framer framer;
+
+    sip_framer_reset(&framer);
+    EXPECT_EQ(SIP_FRAMER_ERROR, sip_framer_scan(&framer, too_big, sizeof(too_big) - 1, false));
+    sip_framer_reset(&framer);
+    EXPECT_EQ(SIP_FRAMER_ERROR, sip_framer_scan(&framer, conflict, sizeof(conflict) - 1, false));
+    sip_framer_reset(&framer);
+    EXPECT_EQ(sizeof(repeated) - 1, sip_framer_scan(&framer, repeated, sizeof(repeated) - 1, false));
+}
+
+TEST(SipFramer, DISABLED_BenchmarkPipelined) {
+    const int rounds = 200000;
+    std::string stream;
+    for (int i = 0; i < 64; i++) {
+        stream += framer_corpus[i % 2];
+    }
+    struct sip_framer framer;
+    unsigned long long start = bench_usec();
+    unsigned long msgs = 0;
+
+    for (int r = 0; r < rounds / 64; r++) {
+        size_t offset = 0;
+        while (offset < stream.size()) {
+            sip_framer_reset(&framer);
+            size_t len = sip_framer_scan(&framer, stream.data() + offset, stream.size() - offset, false);
+            ASSERT_NE(0u, len);
+            offset += len;
+            msgs++;
+        }
+    }
+    unsigned long long elapsed = bench_usec() - start;
+
+    printf("framed %.0f msgs/s, %.0f MB/s\n", msgs * 1e6 / elapsed,
+           (double)stream.size() * (rounds / 64) / elapsed);
+}
+
+TEST(CallArena, GrowAndRelease) {
+    call_arena arena;
+
+    char *a = (char *)arena.alloc(10);
+    EXPECT_EQ(0u, (uintptr_t)a % 16);
+    EXPECT_EQ(1u, arena.chunks_used);
+
+    /* The latest block grows in place and can be handed back. */
+    strcpy(a, "hello");
+    EXPECT_EQ(a, arena.grow(a, 1000));
+    EXPECT_STREQ("hello", a);
+    arena.release(a);
+    EXPECT_EQ(a, arena.alloc(10));
+
+    /* Older blocks move, and keep their contents. */
+    char *b = arena.copy("world");
+    char *moved = (char *)arena.grow(a, 100);
+    EXPECT_NE(a, moved);
+    EXPECT_STREQ("hello", moved);
+    EXPECT_STREQ("world", b);
+
+    /* A typical call fits in one chunk; blocks bigger than a chunk get
+     * their own. */
+    arena.alloc(CALL_ARENA_CHUNK * 2);
+    EXPECT_EQ(2u, arena.chunks_used);
+}
+
+TEST(CallPool, ReusesCallsAndChunks) {
+    scenario *uac = uac_scenario();
+    call::prewarm_pool();
+
+    /* Once warm, a call costs no malloc for itself or its state. */
+    unsigned long misses = call_pool_misses;
+    unsigned long mallocs = call_arena_mallocs;
+    call *c = new call(uac, NULL, NULL, "1-4242@192.168.1.1", 0, false, false, false);
+    delete c;
+    call *d = new call(uac, NULL, NULL, "2-4242@192.168.1.1", 0, false, false, false);
+    EXPECT_EQ(c, d);
+    delete d;
+    EXPECT_EQ(misses, call_pool_misses);
+    EXPECT_EQ(mallocs, call_arena_mallocs);
+
+    /* Call-IDs longer than the inline buffer are still kept whole. */
+    std::string long_id(100, 'a');
+    c = new call(uac, NULL, NULL, long_id.c_str(), 0, false, false, false);
+    EXPECT_EQ(c, get_listener(long_id.c_str()));
+    delete c;
+}
+
+TEST(VariableTable, InlineValuesSurviveExpand) {
+    AllocVariableTable vars(NULL);
+    std::string longval(200, 'x');
+
+    int first = vars.find("first", true);
+    vars.getVar(first)->setMatchingValue("tag=1234;rport", 8);
+    int second = vars.find("second", true);
+    vars.getVar(second)->setMatchingValue(longval.c_str(), longval.size());
+
+    /* Growing the table moves the variables, inline buffers included. */
+    for (int i = 0; i < 20; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        vars.find(name, true);
+    }
+    EXPECT_STREQ("tag=1234", vars.getVar(first)->getMatchingValue());
+    EXPECT_EQ(longval, vars.getVar(second)->getMatchingValue());
+
+    /* Values switch between inline and allocated storage as they change. */
+    vars.getVar(second)->setMatchingValue("short", 5);
+    EXPECT_STREQ("short", vars.getVar(second)->getString());
+    vars.getVar(first)->setMatchingValue(longval.c_str(), VAR_INLINE_SIZE);
+    EXPECT_EQ(longval.substr(0, VAR_INLINE_SIZE), vars.getVar(first)->getMatchingValue());
+    EXPECT_TRUE(vars.getVar(first)->isSet());
+}
+
+TEST(Arrivals, ReadTrace) {
+    std::istringstream trace("time,caller\n"
+                             "# warm up\n"
+                             "1000.5,alice\n"
+                             "\n"
+                             "1000.5;bob\n"
+                             "1001.25\n");
+    std::vector<unsigned long long> offsets;
+    int bad_line = 0;
+
+    ASSERT_TRUE(read_arrival_trace(trace, &offsets, &bad_line));
+    ASSERT_EQ(3u, offsets.size());
+    EXPECT_EQ(0u, offsets[0]);
+    EXPECT_EQ(0u, offsets[1]);
+    EXPECT_EQ(750000u, offsets[2]);
+
+    std::istringstream decreasing("2\n1\n");
+    EXPECT_FALSE(read_arrival_trace(decreasing, &offsets, &bad_line));
+    EXPECT_EQ(2, bad_line);
+    std::istringstream garbage("0.5\n1.0 calls\n");
+    EXPECT_FALSE(read_arrival_trace(garbage, &offsets, &bad_line));
+    EXPECT_EQ(2, bad_line);
+}
+
+TEST(Arrivals, PoissonGapsHaveTheRateMean) {
+    CExponential gaps(500.0);
+    double sum = 0;
+    int n = 100000;
+
+    for (int i = 0; i < n; i++) {
+        double gap = gaps.sample();
+        ASSERT_GE(gap, 0.0);
+        sum += gap;
+    }
+    EXPECT_NEAR(500.0, sum / n, 10.0);
+    EXPECT_NEAR(500.0 * log(2.0), gaps.cdfInv(0.5), 0.001);
+}
+
+TEST(Histogram, BucketsAndPercentiles) {
+    CHistogram h;
+
+    /* Small values are exact, large ones within 1/64th. */
+    for (unsigned long long v = 0; v < 128; v++) {
+        EXPECT_EQ(v, CHistogram::highestInBucket(CHistogram::bucketOf(v)));
+    }
+    for (unsigned long long v = 128; v < (1ULL << 30); v = v * 3 + 1) {
+        unsigned long long top = CHistogram::highestInBucket(CHistogram::bucketOf(v));
+        EXPECT_GE(top, v);
+        EXPECT_LE(top - v, v / 64);
+    }
+    EXPECT_EQ(HIST_BUCKETS - 1, CHistogram::bucketOf(~0ULL));
+
+    EXPECT_EQ(0u, h.percentile(99));
+    for (unsigned long long v = 1; v <= 10000; v++) {
+        h.record(v);
+    }
+    EXPECT_EQ(10000u, h.count());
+    EXPECT_NEAR(5000.0, (double)h.percentile(50), 5000 / 64);
+    EXPECT_NEAR(9900.0, (double)h.percentile(99), 9900 / 64);
+    EXPECT_NEAR(9999.0, (double)h.percentile(99.99), 9999 / 64);
+    EXPECT_EQ(CHistogram::highestInBucket(CHistogram::bucketOf(10000)), h.percentile(100));
+
+    /* Two halves add up to the whole. */
+    CHistogram low, high;
+    for (unsigned long long v = 1; v <= 10000; v++) {
+        (v <= 5000 ? low : high).record(v);
+    }
+    low.add(high);
+    EXPECT_EQ(h.count(), low.count());
+    EXPECT_EQ(h.percentile(99.9), low.percentile(99.9));
+    low.reset();
+    EXPECT_EQ(0u, low.count());
+}
+
+TEST(RttDump, BinaryRecords) {
+    char name[] = "/tmp/sipp_unittest";
+    char extension[] = ".bin";
+    char path[256];
+    CStat *stats = new CStat();
+
+    stats->findRtd("1", true);
+    stats->findRtd("invite", true);
+    stats->initRtt(name, extension, 10, true);
+    for (int i = 0; i < 1000; i++) {
+        stats->computeRtt(1000000ULL * i, 1000000ULL * i + 1500 + i, 1 + i % 2);
+    }
+    /* Stopping the writer flushes whatever is still queued. */
+    delete stats;
+
+    snprintf(path, sizeof(path), "%s_%d_rtt%s", name, getpid(), extension);
+    FILE *f = fopen(path, "r");
+    ASSERT_TRUE(f != NULL);
+    char magic[8];
+    uint32_t nrtds, len;
+    char rtd[16];
+    ASSERT_EQ(1u, fread(magic, sizeof(magic), 1, f));
+    EXPECT_EQ(0, memcmp(magic, "SIPPRTT1", 8));
+    ASSERT_EQ(1u, fread(&nrtds, sizeof(nrtds), 1, f));
+    EXPECT_EQ(2u, nrtds);
+    ASSERT_EQ(1u, fread(&len, sizeof(len), 1, f));
+    ASSERT_EQ(1u, len);
+    ASSERT_EQ(1u, fread(rtd, len, 1, f));
+    ASSERT_EQ(1u, fread(&len, sizeof(len), 1, f));
+    ASSERT_EQ(6u, len);
+    ASSERT_EQ(1u, fread(rtd, len, 1, f));
+    EXPECT_EQ(0, memcmp(rtd, "invite", 6));
+
+    CStat::T_value_rtt value;
+    int n = 0;
+    while (fread(&value, sizeof(value), 1, f) == 1) {
+        EXPECT_EQ(1000000ULL * n + 1500 + n, value.date_us);
+        EXPECT_EQ(1500u + n, value.rtt_us);
+        EXPECT_EQ(1 + n % 2, value.rtd_no);
+        n++;
+    }
+    EXPECT_EQ(1000, n);
+    fclose(f);
+    unlink(path);
+}
+
+static void *count_rtp(void *)
+{
+    for (int i = 0; i < 100000; i++) {
+        CThreadCounters::add(CThreadCounters::TC_RTP_PCKTS);
+        CThreadCounters::add(CThreadCounters::TC_RTP_BYTES, 160);
+    }
+    return NULL;
+}
+
+TEST(ThreadCounters, FoldedOncePerIncrement) {
+    pthread_t threads[4];
+    unsigned long pckts = rtp_pckts, bytes = rtp_bytes;
+
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, count_rtp, NULL));
+    }
+    CStat::foldThreadCounters();
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CStat::foldThreadCounters();
+    EXPECT_EQ(pckts + 400000, rtp_pckts);
+    EXPECT_EQ(bytes + 400000 * 160, rtp_bytes);
+
+    /* Nothing new: folding again adds nothing. */
+    CStat::foldThreadCounters();
+    EXPECT_EQ(pckts + 400000, rtp_pckts);
+}
+
+TEST(Pcapng, BlockEncoding) {
+    struct sockaddr_storage from, to;
+    struct sockaddr_in *s4 = (struct sockaddr_in *)&from;
+    struct sockaddr_in *d4 = (struct sockaddr_in *)&to;
+    struct timeval when = { 1, 2 };
+    unsigned char buf[512];
+    uint32_t u32;
+    uint16_t u16;
+
+    memset(&from, 0, sizeof(from));
+    memset(&to, 0, sizeof(to));
+    s4->sin_family = d4->sin_family = AF_INET;
+    s4->sin_addr.s_addr = htonl(0x7f000001);
+    d4->sin_addr.s_addr = htonl(0x7f000002);
+    s4->sin_port = htons(5060);
+    d4->sin_port = htons(5070);
+
+    FILE *f = tmpfile();
+    ASSERT_TRUE(f != NULL);
+    pcapng_lfi.fptr = f;
+    pcapng_header(f);
+    /* 20 + 8 + 5 bytes: three bytes of padding. */
+    TRACE_PCAPNG(&when, &from, &to, false, 0, "hello", 5);
+    /* 20 + 20 + 4 bytes: no padding. */
+    TRACE_PCAPNG(&when, &to, &from, true, 100, "SIP!", 4);
+    flush_logs();
+    pcapng_lfi.fptr = NULL;
+
+    size_t n = ftell(f);
+    rewind(f);
+    ASSERT_EQ(n, fread(buf, 1, sizeof(buf), f));
+    fclose(f);
+    ASSERT_EQ(28u + 20u + 68u + 76u, n);
+
+    /* Section header block. */
+    memcpy(&u32, buf, 4);
+    EXPECT_EQ(0x0A0D0D0Au, u32);
+    memcpy(&u32, buf + 4, 4);
+    EXPECT_EQ(28u, u32);
+    memcpy(&u32, buf + 8, 4);
+    EXPECT_EQ(0x1A2B3C4Du, u32);
+    memcpy(&u32, buf + 24, 4);
+    EXPECT_EQ(28u, u32);
+
+    /* Interface description block: 16-bit linktype then reserved. */
+    unsigned char *idb = buf + 28;
+    memcpy(&u32, idb, 4);
+    EXPECT_EQ(1u, u32);
+    memcpy(&u32, idb + 4, 4);
+    EXPECT_EQ(20u, u32);
+    memcpy(&u16, idb + 8, 2);
+    EXPECT_EQ(101, u16);
+    memcpy(&u16, idb + 10, 2);
+    EXPECT_EQ(0, u16);
+    memcpy(&u32, idb + 16, 4);
+    EXPECT_EQ(20u, u32);
+
+    /* Enhanced packet blocks. */
+    unsigned char *epb = idb + 20;
+    memcpy(&u32, epb, 4);
+    EXPECT_EQ(6u, u32);
+    memcpy(&u32, epb + 4, 4);
+    EXPECT_EQ(68u, u32);
+    memcpy(&u32, epb + 12, 4);
+    EXPECT_EQ(0u, u32);
+    memcpy(&u32, epb + 16, 4);
+    EXPECT_EQ(1000002u, u32);
+    memcpy(&u32, epb + 20, 4);
+    EXPECT_EQ(33u, u32);
+    memcpy(&u32, epb + 24, 4);
+    EXPECT_EQ(33u, u32);
+    EXPECT_EQ(0x45, epb[28]);
+    EXPECT_EQ(IPPROTO_UDP, epb[28 + 9]);
+    EXPECT_EQ(0, memcmp(epb + 28 + 28, "hello", 5));
+    EXPECT_EQ(0, epb[61]);
+    EXPECT_EQ(0, epb[62]);
+    EXPECT_EQ(0, epb[63]);
+    memcpy(&u32, epb + 64, 4);
+    EXPECT_EQ(68u, u32);
+
+    epb += 68;
+    memcpy(&u32, epb + 4, 4);
+    EXPECT_EQ(76u, u32);
+    memcpy(&u32, epb + 20, 4);
+    EXPECT_EQ(44u, u32);
+    EXPECT_EQ(IPPROTO_TCP, epb[28 + 9]);
+    memcpy(&u32, epb + 28 + 24, 4);
+    EXPECT_EQ(100u, ntohl(u32));
+    EXPECT_EQ(0, memcmp(epb + 28 + 40, "SIP!", 4));
+    memcpy(&u32, epb + 72, 4);
+    EXPECT_EQ(76u, u32);
+}
+
+static void queue_record(char c, size_t len)
+{
+    char *p = trace_reserve(len);
+    if (p) {
+        memset(p, c, len);
+        trace_commit(&log_lfi, len);
+    }
+}
+
+static void *fill_log_ring(void *)
+{
+    unsigned long dropped = flush_logs();
+
+    /* Four records nearly fill the 4096 bytes ring, the fifth is dropped. */
+    queue_record('a', 1000);
+    queue_record('b', 1000);
+    queue_record('c', 1000);
+    queue_record('d', 1000);
+    queue_record('x', 100);
+    EXPECT_EQ(dropped + 1, flush_logs());
+
+    /* The end of the ring is padded and the record wraps to its start. */
+    queue_record('e', 500);
+    queue_record('f', 3000);
+    EXPECT_EQ(dropped + 1, flush_logs());
+    return NULL;
+}
+
+TEST(LogRing, WrapPadAndDrop) {
+    unsigned long long size = trace_buffer_size;
+    pthread_t thread;
+    char buf[8192];
+
+    /* The logger thread is stopped by the first flush_logs(), so the
+     * rings only drain when the test says so. */
+    trace_buffer_size = 4096;
+    FILE *f = tmpfile();
+    ASSERT_TRUE(f != NULL);
+    log_lfi.fptr = f;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, fill_log_ring, NULL));
+    pthread_join(thread, NULL);
+    log_lfi.fptr = NULL;
+    trace_buffer_size = size;
+
+    size_t n = ftell(f);
+    rewind(f);
+    ASSERT_EQ(7500u, n);
+    ASSERT_EQ(n, fread(buf, 1, sizeof(buf), f));
+    fclose(f);
+    const char expected[] = "abcdef";
+    size_t lens[] = { 1000, 1000, 1000, 1000, 500, 3000 };
+    char *p = buf;
+    for (int i = 0; i < 6; i++) {
+        for (size_t j = 0; j < lens[i]; j++) {
+            ASSERT_EQ(expected[i], p[j]);
+        }
+        p += lens[i];
+    }
+}
@@ -37,6 +37,9 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 #include "sipp.hpp"
 #include "socket.hpp"
 #include "logger.hpp"
@@ -270,7 +273,6 @@ bool process_command(char *command)
 int command_mode = 0;
 char *command_buffer = NULL;
 
-extern char * get_call_id(char *msg);
 extern bool sipMsgCheck (const char *P_msg, struct sipp_socket *socket);
 
 #ifdef _USE_OPENSSL
@@ -629,159 +631,188 @@ void handle_stdin_socket()
 
 /****************************** Network Interface *******************/
 
-/* Our message detection states: */
-#define CFM_NORMAL 0 /* No CR Found, searchign for \r\n\r\n. */
-#define CFM_CONTROL 1 /* Searching for 27 */
-#define CFM_CR 2 /* CR Found, Searching for \n\r\n */
-#define CFM_CRLF 3 /* CRLF Found, Searching for \r\n */
-#define CFM_CRLFCR 4 /* CRLFCR Found, Searching for \n */
-#define CFM_CRLFCRLF 5 /* We've found the end of the headers! */
-
-void merge_socketbufs(struct socketbuf *socketbuf)
+/* Find the next CRLF in [p, end), sixteen or thirty-two positions at a
+ * time: a position matches when its byte is CR and the following one LF. */
+static inline const char *find_crlf(const char *p, const char *end)
 {
-    struct socketbuf *next = socketbuf->next;
-    int newsize;
-    char *newbuf;
-
-    if (!next) {
-        return;
+#ifdef __AVX2__
+    const __m256i cr32 = _mm256_set1_epi8('\r');
+    const __m256i lf32 = _mm256_set1_epi8('\n');
+    while (end - p > 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, cr32),
+                                                                  _mm256_cmpeq_epi8(b, lf32)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
     }
-
-    if (next->offset) {
-        ERROR("Internal error: can not merge a socketbuf with a non-zero offset.");
+#endif
+#ifdef __SSE2__
+    const __m128i cr16 = _mm_set1_epi8('\r');
+    const __m128i lf16 = _mm_set1_epi8('\n');
+    while (end - p > 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, cr16),
+                                                            _mm_cmpeq_epi8(b, lf16)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
     }
-
-    if (socketbuf->offset) {
-        memmove(socketbuf->buf, socketbuf->buf + socketbuf->offset, socketbuf->len - socketbuf->offset);
-        socketbuf->len -= socketbuf->offset;
-        socketbuf->offset = 0;
+#endif
+    for (; end - p > 1; p++) {
+        if (p[0] == '\r' && p[1] == '\n') {
+            return p;
+        }
     }
+    return NULL;
+}
 
-    newsize = socketbuf->len + next->len;
+/* Parse the value of a Content-Length header, from the colon to the end of
+ * the line.  Anything but spaces after the integer makes it zero, and a
+ * value above SIPP_MAX_MSG_SIZE gives -1. */
+static int parse_content_length(const char *l, const char *eol)
+{
+    while (l < eol && isspace(*l)) {
+        l++;
+    }
+    if (l == eol) {
+        return 0;
+    }
 
-    newbuf = (char *)realloc(socketbuf->buf, newsize);
-    if (!newbuf) {
-        ERROR("Could not allocate memory to merge socket buffers!");
+    int content_length = 0;
+    while (l < eol && isdigit(*l)) {
+        content_length = content_length * 10 + (*l++ - '0');
+        if (content_length > SIPP_MAX_MSG_SIZE) {
+            return -1;
+        }
     }
-    memcpy(newbuf + socketbuf->len, next->buf, next->len);
-    socketbuf->buf = newbuf;
-    socketbuf->len = newsize;
-    socketbuf->next = next->next;
-    free_socketbuf(next);
+    if (l != eol && !isspace(*l)) {
+        return 0;
+    }
+    return content_length;
 }
 
-/* Check for a message in the socket and return the length of the first
- * message.  If this is UDP, the only check is if we have buffers.  If this is
- * TCP or TLS we need to parse out the content-length. */
-static int check_for_message(struct sipp_socket *socket)
+void sip_framer_reset(struct sip_framer *framer)
 {
-    struct socketbuf *socketbuf = socket->ss_in;
-    int state = socket->ss_control ? CFM_CONTROL : CFM_NORMAL;
-    const char *l;
-
-    if (!socketbuf)
-        return 0;
+    framer->scanned = 0;
+    framer->header_len = 0;
+    framer->content_length = 0;
+    framer->has_content_length = false;
+}
+
+/* Look for the end of the first message in a stream buffer.  Only the
+ * bytes that arrived since the last call are scanned: the end of the
+ * headers and the Content-Length (or compact l:) header are found in the
+ * same pass, at each line break.  A line is only looked at once it is
+ * complete, so a header split across reads is picked up on the next one.
+ * Returns the message length, 0 if it is not all there yet, or
+ * SIP_FRAMER_ERROR. */
+size_t sip_framer_scan(struct sip_framer *framer, const char *buf, size_t len, bool control)
+{
+    const char *end = buf + len;
 
-    if (socket->ss_transport == T_UDP || socket->ss_transport == T_SCTP) {
-        return socketbuf->len;
+    if (control) {
+        /* For CMD Message the escape char is the end of message */
+        const char *esc = (const char *)memchr(buf + framer->scanned, 27, len - framer->scanned);
+        if (!esc) {
+            framer->scanned = len;
+            return 0;
+        }
+        return esc - buf + 1;
     }
 
-    int len = 0;
-
-    while (socketbuf->offset + len < socketbuf->len) {
-        char c = socketbuf->buf[socketbuf->offset + len];
+    if (!framer->header_len) {
+        const char *p = buf + framer->scanned;
+        const char *crlf;
 
-        switch(state) {
-        case CFM_CONTROL:
-            /* For CMD Message the escape char is the end of message */
-            if (c == 27) {
-                return len + 1; /* The plus one includes the control character. */
-            }
-            break;
-        case CFM_NORMAL:
-            if (c == '\r') {
-                state = CFM_CR;
-            }
-            break;
-        case CFM_CR:
-            if (c == '\n') {
-                state = CFM_CRLF;
-            } else {
-                state = CFM_NORMAL;
+        while ((crlf = find_crlf(p, end))) {
+            const char *line = crlf + 2;
+            if (end - line < 2) {
+                break;
             }
-            break;
-        case CFM_CRLF:
-            if (c == '\r') {
-                state = CFM_CRLFCR;
-            } else {
-                state = CFM_NORMAL;
+            if (line[0] == '\r' && line[1] == '\n') {
+                framer->header_len = line + 2 - buf;
+                break;
             }
-            break;
-        case CFM_CRLFCR:
-            if (c == '\n') {
-                state = CFM_CRLFCRLF;
-            } else {
-                state = CFM_NORMAL;
+            if (line[0] == 'c' || line[0] == 'C' || line[0] == 'l' || line[0] == 'L') {
+                const char *eol = find_crlf(line, end);
+                if (!eol) {
+                    break;
+                }
+                int content_length = -2;
+                if (eol - line >= 15 && !strncasecmp(line, "Content-Length:", 15)) {
+                    content_length = parse_content_length(line + 15, eol);
+                } else if (eol - line >= 2 && !strncasecmp(line, "l:", 2)) {
+                    content_length = parse_content_length(line + 2, eol);
+                }
+                if (content_length == -1 ||
+                        (content_length >= 0 && framer->has_content_length &&
+                         (size_t)content_length != framer->content_length)) {
+                    return SIP_FRAMER_ERROR;
+                }
+                if (content_length >= 0) {
+                    framer->content_length = content_length;
+                    framer->has_content_length = true;
+                }
             }
-            break;
+            p = line;
         }
 
-        /* Head off failing because the buffer does not contain the whole header. */
-        if (socketbuf->offset + len == socketbuf->len - 1) {
-            merge_socketbufs(socketbuf);
-        }
-
-        if (state == CFM_CRLFCRLF) {
-            break;
+        if (!framer->header_len) {
+            /* Resume at the last line break, or at a CR that may be the
+             * start of one. */
+            if (crlf) {
+                framer->scanned = crlf - buf;
+            } else if (len > framer->scanned + 1) {
+                framer->scanned = len - 1;
+            }
+            return 0;
         }
-
-        len++;
     }
 
-    /* We did not find the end-of-header marker. */
-    if (state != CFM_CRLFCRLF) {
+    if (framer->header_len + framer->content_length > len) {
         return 0;
     }
+    return framer->header_len + framer->content_length;
+}
 
-    /* Find the content-length header. */
-    if ((l = strncasestr(socketbuf->buf + socketbuf->offset, "\r\nContent-Length:", len))) {
-        l += strlen("\r\nContent-Length:");
-    } else if ((l = strncasestr(socketbuf->buf + socketbuf->offset, "\r\nl:", len))) {
-        l += strlen("\r\nl:");
-    } else {
-        /* There is no header, so the content-length is zero. */
-        return len + 1;
-    }
+/* Check for a message in the socket and return the length of the first
+ * message.  If this is UDP, the only check is if we have buffers.  If this is
+ * TCP or TLS we need to parse out the content-length, and -1 means that the
+ * stream can not be framed. */
+static int check_for_message(struct sipp_socket *socket)
+{
+    struct socketbuf *socketbuf = socket->ss_in;
 
-    /* Skip spaces. */
-    while (isspace(*l)) {
-        if (*l == '\r' || *l == '\n') {
-            /* We ran into an end-of-line, so there is no content-length. */
-            return len + 1;
-        }
-        l++;
-    }
+    if (!socketbuf)
+        return 0;
 
-    /* Do the integer conversion, we only allow '\r' or spaces after the integer. */
-    char *endptr;
-    int content_length = strtol(l, &endptr, 10);
-    if (*endptr != '\r' && !isspace(*endptr)) {
-        content_length = 0;
+    if (socket->ss_transport == T_UDP || socket->ss_transport == T_SCTP) {
+        return socketbuf->len;
     }
 
-    /* Now that we know how large this message is, we make sure we have the whole thing. */
-    do {
-        /* It is in this buffer. */
-        if (socketbuf->offset + len + content_length < socketbuf->len) {
-            return len + content_length + 1;
-        }
-        if (socketbuf->next == NULL) {
-            /* There is no buffer to merge, so we fail. */
-            return 0;
-        }
-        /* We merge ourself with the next buffer. */
-        merge_socketbufs(socketbuf);
-    } while (1);
+    size_t msg_len = sip_framer_scan(&socket->ss_framer, socketbuf->buf + socketbuf->offset,
+                                     socketbuf->len - socketbuf->offset, socket->ss_control);
+    return msg_len == SIP_FRAMER_ERROR ? -1 : (int)msg_len;
+}
+
+/* There is no finding the next message in a stream that does not frame:
+ * drop what was read, and fail the read so that the connection is reset. */
+static void drop_unframed_input(struct sipp_socket *socket)
+{
+    WARNING("Invalid or conflicting Content-Length on %s connection, dropping it",
+            TRANSPORT_TO_STRING(socket->ss_transport));
+    while (socket->ss_in) {
+        struct socketbuf *next = socket->ss_in->next;
+        free_socketbuf(socket->ss_in);
+        socket->ss_in = next;
+    }
+    sip_framer_reset(&socket->ss_framer);
+    errno = EBADMSG;
 }
 
 #ifdef USE_SCTP
@@ -848,9 +879,116 @@ void set_multihome_addr(struct sipp_socket* socket, int port)
 }
 #endif
 
-/* Pull up to tcp_readsize data bytes out of the socket into our local buffer. */
-int empty_socket(struct sipp_socket *socket)
+#ifdef HAVE_MMSG
+/* Read up to recv_batch datagrams with one recvmmsg() and process them
+ * in place, skipping the socketbuf copy and read_message(). The buffers
+ * are allocated once and reused by every batch. A batch never takes more
+ * messages than are left in *budget, but always at least one. */
+static int empty_udp_socket(struct sipp_socket *socket, int *budget)
 {
+    static char *buffers = NULL;
+    struct mmsghdr msgs[MAX_RECV_BATCH];
+    struct iovec iovs[MAX_RECV_BATCH];
+    struct sockaddr_storage addrs[MAX_RECV_BATCH];
+    int nb_msgs, total = 0;
+    int batch = recv_batch;
+
+    if (budget && *budget < batch) {
+        batch = *budget > 0 ? *budget : 1;
+    }
+
+    if (!buffers) {
+        buffers = (char *)malloc((size_t)MAX_RECV_BATCH * (SIPP_MAX_MSG_SIZE + 1));
+        if (!buffers) {
+            ERROR("Could not allocate memory for read!");
+        }
+    }
+
+    for (int i = 0; i < batch; i++) {
+        iovs[i].iov_base = buffers + (size_t)i * (SIPP_MAX_MSG_SIZE + 1);
+        iovs[i].iov_len = SIPP_MAX_MSG_SIZE;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    nb_msgs = recvmmsg(socket->ss_fd, msgs, batch, MSG_DONTWAIT, NULL);
+    if (nb_msgs <= 0) {
+        return nb_msgs;
+    }
+    recv_batches++;
+    recv_batch_msgs += nb_msgs;
+    if (budget) {
+        *budget -= nb_msgs;
+    }
+
+    getmilliseconds();
+    for (int i = 0; i < nb_msgs; i++) {
+        char *msg = (char *)iovs[i].iov_base;
+        int len = msgs[i].msg_len;
+
+        msg[len] = '\0';
+        total += len;
+        if (len > 0) {
+            process_message(socket, msg, len, &addrs[i]);
+        }
+    }
+
+    /* An empty datagram is not an error, but read_error() takes 0 as one. */
+    return total ? total : 1;
+}
+#endif
+
+/* Stream sockets read into a single input buffer, taken from the pools
+ * while they have unread data. Reads go straight to its free tail; the
+ * unread part is moved back to the start when the tail gets short, and
+ * the buffer only grows when a single message does not fit. */
+static struct socketbuf *stream_socketbuf(struct sipp_socket *socket, size_t readsize)
+{
+    struct socketbuf *in = socket->ss_in;
+
+    if (!in) {
+        size_t allocated;
+        char *buf = alloc_socketbuf_data(readsize, &allocated);
+        in = socket->ss_in = alloc_socketbuf(buf, allocated, NO_COPY, NULL);
+        in->len = 0;
+        return in;
+    }
+
+    if (in->size - in->len >= readsize) {
+        return in;
+    }
+    if (in->offset) {
+        memmove(in->buf, in->buf + in->offset, in->len - in->offset);
+        in->len -= in->offset;
+        in->offset = 0;
+    }
+    if (in->size - in->len < readsize) {
+        size_t allocated;
+        char *buf = alloc_socketbuf_data(in->len + readsize, &allocated);
+        memcpy(buf, in->buf, in->len);
+        free_socketbuf_data(in->buf, in->size);
+        in->buf = buf;
+        in->size = allocated;
+    }
+    return in;
+}
+
+/* Pull up to tcp_readsize data bytes out of the socket into our local buffer.
+ * UDP sockets shared by all calls are read in batches with recvmmsg(),
+ * and their messages are processed right away and taken off *budget. */
+int empty_socket(struct sipp_socket *socket, int *budget)
+{
+#ifdef HAVE_MMSG
+    if (recv_batch > 1 && socket->ss_transport == T_UDP &&
+            !socket->ss_call_socket && !socket->ss_control) {
+        return empty_udp_socket(socket, budget);
+    }
+#else
+    (void)budget;
+#endif
 
     int readsize=0;
     if (socket->ss_transport == T_UDP || socket->ss_transport == T_SCTP) {
@@ -868,11 +1006,14 @@ int empty_socket(struct sipp_socket *socket)
      * sent the last message. */
     sipp_socklen_t addrlen = sizeof(struct sockaddr_storage);
 
-    buffer = (char *)malloc(readsize);
-    if (!buffer) {
-        ERROR("Could not allocate memory for read!");
+    if (socket->ss_transport == T_TCP || socket->ss_transport == T_TLS) {
+        socketbuf = stream_socketbuf(socket, readsize);
+        buffer = socketbuf->buf + socketbuf->len;
+    } else {
+        size_t allocated;
+        buffer = alloc_socketbuf_data(readsize, &allocated);
+        socketbuf = alloc_socketbuf(buffer, allocated, NO_COPY, NULL);
     }
-    socketbuf = alloc_socketbuf(buffer, readsize, NO_COPY, NULL);
 
     switch(socket->ss_transport) {
     case T_TCP:
@@ -906,18 +1047,28 @@ int empty_socket(struct sipp_socket *socket)
 #endif
         break;
     }
-    if (ret <= 0) {
-        free_socketbuf(socketbuf);
-        return ret;
+    if (socket->ss_transport == T_TCP || socket->ss_transport == T_TLS) {
+        if (ret <= 0) {
+            return ret;
+        }
+        socketbuf->len += ret;
+    } else {
+        if (ret <= 0) {
+            free_socketbuf(socketbuf);
+            return ret;
+        }
+        socketbuf->len = ret;
+        buffer_read(socket, socketbuf);
     }
 
-    socketbuf->len = ret;
-
-    buffer_read(socket, socketbuf);
-
     /* Do we have a complete SIP message? */
     if (!socket->ss_msglen) {
-        if (int msg_len = check_for_message(socket)) {
+        int msg_len = check_for_message(socket);
+        if (msg_len < 0) {
+            drop_unframed_input(socket);
+            return -1;
+        }
+        if (msg_len) {
             socket->ss_msglen = msg_len;
             pending_messages++;
         }
@@ -1032,6 +1183,14 @@ void sipp_close_socket (struct sipp_socket *socket)
 
     sipp_socket_invalidate(socket);
     sockets_pending_reset.erase(socket);
+    while (struct socketbuf *buf = socket->ss_in) {
+        socket->ss_in = buf->next;
+        free_socketbuf(buf);
+    }
+    while (struct socketbuf *buf = socket->ss_out) {
+        socket->ss_out = buf->next;
+        free_socketbuf(buf);
+    }
     free(socket);
 }
 
@@ -1062,25 +1221,59 @@ ssize_t read_message(struct sipp_socket *socket, char *buf, size_t len, struct s
         buf[avail-1] = '\0';
 
     socket->ss_in->offset += avail;
+    sip_framer_reset(&socket->ss_framer);
 
-    /* Have we emptied the buffer? */
+    /* Have we emptied the buffer? Idle stream sockets do not hold on to
+     * one: the next read takes a buffer from the pools again. */
     if (socket->ss_in->offset == socket->ss_in->len) {
         struct socketbuf *next = socket->ss_in->next;
         free_socketbuf(socket->ss_in);
         socket->ss_in = next;
     }
 
-    if (int msg_len = check_for_message(socket)) {
+    int msg_len = check_for_message(socket);
+    if (msg_len > 0) {
         socket->ss_msglen = msg_len;
     } else {
         socket->ss_msglen = 0;
         pending_messages--;
+        if (msg_len < 0) {
+            drop_unframed_input(socket);
+            read_error(socket, -1);
+        }
     }
 
     return avail;
 }
 
-void process_message(struct sipp_socket *socket, char *msg, ssize_t msg_size, struct sockaddr_storage *src)
+/* Capture a message in the -trace_pcapng file. The addresses of stream
+ * sockets do not change, so they are only looked up once. */
+static void trace_pcapng(struct sipp_socket *socket, bool sent, const struct sockaddr_storage *peer,
+                         const char *msg, size_t len, const struct timeval *when)
+{
+    bool stream = socket->ss_transport != T_UDP;
+    socklen_t addrlen;
+
+    if (socket->ss_pcap_local.ss_family == AF_UNSPEC) {
+        addrlen = sizeof(socket->ss_pcap_local);
+        getsockname(socket->ss_fd, (struct sockaddr *)&socket->ss_pcap_local, &addrlen);
+    }
+    if (stream) {
+        if (socket->ss_pcap_peer.ss_family == AF_UNSPEC) {
+            addrlen = sizeof(socket->ss_pcap_peer);
+            getpeername(socket->ss_fd, (struct sockaddr *)&socket->ss_pcap_peer, &addrlen);
+        }
+        peer = &socket->ss_pcap_peer;
+    } else if (!peer) {
+        peer = &socket->ss_remote_sockaddr;
+    }
+
+    TRACE_PCAPNG(when, sent ? &socket->ss_pcap_local : peer, sent ? peer : &socket->ss_pcap_local,
+                 stream, socket->ss_pcap_seq[sent], msg, len);
+    socket->ss_pcap_seq[sent] += len;
+}
+
+static void route_message(struct sipp_socket *socket, char *msg, ssize_t msg_size, struct sockaddr_storage *src)
 {
     // TRACE_MSG(" msg_size %d and pollset_index is %d \n", msg_size, pollset_index));
     if (msg_size <= 0) {
@@ -1094,18 +1287,30 @@ void process_message(struct sipp_socket *socket, char *msg, ssize_t msg_size, st
         return;
     }
 
-    char *call_id = get_call_id(msg);
+    char call_id[MAX_HEADER_LEN];
+    get_call_id(msg, call_id, sizeof(call_id));
     if (call_id[0] == '\0') {
         WARNING("SIP message without Call-ID discarded");
         return;
     }
-    listener *listener_ptr = get_listener(call_id);
+    /* The Call-ID hash is computed once here to key the call table lookup. */
+    size_t call_id_len = strlen(call_id);
+    unsigned int call_hash = call_id_hash(call_id, call_id_len);
+    listener *listener_ptr = get_listener(call_id, call_id_len, call_hash);
     struct timeval currentTime;
     GET_TIME (&currentTime);
 
     if (useShortMessagef == 1) {
+        char cseq[MAX_HEADER_LEN];
+        char first_line[MAX_HEADER_LEN];
         TRACE_SHORTMSG("%s\tR\t%s\tCSeq:%s\t%s\n",
-                       CStat::formatTime(&currentTime), call_id, get_header_content(msg, "CSeq:"), get_first_line(msg));
+                       CStat::formatTime(&currentTime), call_id,
+                       get_header_content(msg, "CSeq:", cseq, sizeof(cseq)),
+                       get_first_line(msg, first_line, sizeof(first_line)));
+    }
+
+    if (usePcapngf == 1) {
+        trace_pcapng(socket, false, src, msg, msg_size, &currentTime);
     }
 
     if (useMessagef == 1) {
@@ -1232,6 +1437,19 @@ void process_message(struct sipp_socket *socket, char *msg, ssize_t msg_size, st
     }
 }
 
+void process_message(struct sipp_socket *socket, char *msg, ssize_t msg_size, struct sockaddr_storage *src)
+{
+    struct sip_msg_index index;
+    struct sip_msg_index *previous;
+
+    /* Index the headers once; the header lookups made while routing and
+     * processing this message then use the index instead of rescanning. */
+    sip_index_message(&index, msg);
+    previous = set_indexed_message(&index);
+    route_message(socket, msg, msg_size, src);
+    set_indexed_message(previous);
+}
+
 struct sipp_socket *sipp_allocate_socket(bool use_ipv6, int transport, int fd, int accepting) {
     struct sipp_socket *ret = (struct sipp_socket *)malloc(sizeof(struct sipp_socket));
     if (!ret) {
@@ -1269,6 +1487,7 @@ struct sipp_socket *sipp_allocate_socket(bool use_ipv6, int transport, int fd, i
     ret->ss_in = NULL;
     ret->ss_out = NULL;
     ret->ss_msglen = 0;
+    sip_framer_reset(&ret->ss_framer);
     ret->ss_congested = false;
     ret->ss_invalid = false;
 
@@ -1591,6 +1810,10 @@ int sipp_reconnect_socket(struct sipp_socket *socket)
     }
 
     socket->ss_fd = socket_fd(socket->ss_ipv6, socket->ss_transport);
+    socket->ss_server_ip[0] = '\0';
+    memset(&socket->ss_pcap_local, 0, sizeof(socket->ss_pcap_local));
+    memset(&socket->ss_pcap_peer, 0, sizeof(socket->ss_pcap_peer));
+    socket->ss_pcap_seq[0] = socket->ss_pcap_seq[1] = 0;
     if (socket->ss_fd == -1) {
         ERROR_NO("Could not obtain new socket: ");
     }
@@ -1639,24 +1862,95 @@ int sipp_reconnect_socket(struct sipp_socket *socket)
 
 /*************************** I/O functions ***************************/
 
-/* Allocate a socket buffer. */
+/* Freed socketbufs and their data are kept on free lists rather than
+ * given back to malloc: the structures on one list, and the data on one
+ * list per size class. Anything bigger than the largest class, or freed
+ * while its list is full, goes back to malloc. */
+#define SOCKETBUF_SMALL 4096
+#define SOCKETBUF_POOL_MAX 1024
+
+struct socketbuf_pool {
+    size_t size;
+    int count;
+    char *free; /* The next free block is stored at the start of each one. */
+};
+
+static struct socketbuf_pool socketbuf_pools[] = {
+    { SOCKETBUF_SMALL, 0, NULL },
+    { SIPP_MAX_MSG_SIZE, 0, NULL },
+};
+#define NB_SOCKETBUF_POOLS (sizeof(socketbuf_pools) / sizeof(socketbuf_pools[0]))
+
+static struct socketbuf *free_socketbufs = NULL;
+static int nb_free_socketbufs = 0;
+
+char *alloc_socketbuf_data(size_t size, size_t *allocated)
+{
+    char *buf;
+
+    for (unsigned int i = 0; i < NB_SOCKETBUF_POOLS; i++) {
+        struct socketbuf_pool *pool = &socketbuf_pools[i];
+        if (size > pool->size) {
+            continue;
+        }
+        *allocated = pool->size;
+        if ((buf = pool->free)) {
+            memcpy(&pool->free, buf, sizeof(char *));
+            pool->count--;
+            socketbuf_pool_hits++;
+            return buf;
+        }
+        socketbuf_pool_misses++;
+        size = pool->size;
+        break;
+    }
+
+    buf = (char *)malloc(size);
+    if (!buf) {
+        ERROR("Could not allocate socket buffer data!\n");
+    }
+    *allocated = size;
+    return buf;
+}
+
+void free_socketbuf_data(char *buf, size_t allocated)
+{
+    for (unsigned int i = 0; i < NB_SOCKETBUF_POOLS; i++) {
+        struct socketbuf_pool *pool = &socketbuf_pools[i];
+        if (allocated == pool->size && pool->count < SOCKETBUF_POOL_MAX) {
+            memcpy(buf, &pool->free, sizeof(char *));
+            pool->free = buf;
+            pool->count++;
+            return;
+        }
+    }
+    free(buf);
+}
+
+/* Allocate a socket buffer. Without DO_COPY, the buffer is adopted and
+ * must come from alloc_socketbuf_data() or malloc() with size bytes. */
 struct socketbuf *alloc_socketbuf(char *buffer, size_t size, int copy, struct sockaddr_storage *dest)
 {
     struct socketbuf *socketbuf;
 
-    socketbuf = (struct socketbuf *)malloc(sizeof(struct socketbuf));
-    if (!socketbuf) {
-        ERROR("Could not allocate socket buffer!\n");
+    if ((socketbuf = free_socketbufs)) {
+        free_socketbufs = socketbuf->next;
+        nb_free_socketbufs--;
+        socketbuf_pool_hits++;
+    } else {
+        socketbuf = (struct socketbuf *)malloc(sizeof(struct socketbuf));
+        if (!socketbuf) {
+            ERROR("Could not allocate socket buffer!\n");
+        }
+        socketbuf_pool_misses++;
     }
     memset(socketbuf, 0, sizeof(struct socketbuf));
     if (copy) {
-        socketbuf->buf = (char *)malloc(size);
-        if (!socketbuf->buf) {
-            ERROR("Could not allocate socket buffer data!\n");
-        }
+        socketbuf->buf = alloc_socketbuf_data(size, &socketbuf->size);
         memcpy(socketbuf->buf, buffer, size);
     } else {
         socketbuf->buf = buffer;
+        socketbuf->size = size;
     }
     socketbuf->len = size;
     socketbuf->offset = 0;
@@ -1671,8 +1965,14 @@ struct socketbuf *alloc_socketbuf(char *buffer, size_t size, int copy, struct so
 /* Free a poll buffer. */
 void free_socketbuf(struct socketbuf *socketbuf)
 {
-    free(socketbuf->buf);
-    free(socketbuf);
+    free_socketbuf_data(socketbuf->buf, socketbuf->size);
+    if (nb_free_socketbufs < SOCKETBUF_POOL_MAX) {
+        socketbuf->next = free_socketbufs;
+        free_socketbufs = socketbuf;
+        nb_free_socketbufs++;
+    } else {
+        free(socketbuf);
+    }
 }
 
 size_t decompress_if_needed(int sock, char *buff,  size_t len, void **st)
@@ -1762,6 +2062,22 @@ void sipp_sctp_peer_params(struct sipp_socket *socket)
 }
 #endif
 
+/* Let several sockets bind the same address; the kernel then hashes
+ * incoming datagrams over them by source address and port. */
+void sipp_reuseport_socket(struct sipp_socket *socket)
+{
+#ifdef SO_REUSEPORT
+    int sock_opt = 1;
+
+    if (setsockopt(socket->ss_fd, SOL_SOCKET, SO_REUSEPORT, (void *)&sock_opt,
+                   sizeof (sock_opt)) == -1) {
+        ERROR_NO("setsockopt(SO_REUSEPORT) failed");
+    }
+#else
+    ERROR("SO_REUSEPORT is not supported on this platform");
+#endif
+}
+
 void sipp_customize_socket(struct sipp_socket *socket)
 {
     unsigned int buffsize = buff_size;
@@ -2018,7 +2334,6 @@ void buffer_write(struct sipp_socket *socket, const char *buffer, size_t len, st
 void buffer_read(struct sipp_socket *socket, struct socketbuf *newbuf)
 {
     struct socketbuf *buf = socket->ss_in;
-    struct socketbuf *prev = buf;
 
     if (!buf) {
         socket->ss_in = newbuf;
@@ -2026,11 +2341,10 @@ void buffer_read(struct sipp_socket *socket, struct socketbuf *newbuf)
     }
 
     while (buf->next) {
-        prev = buf;
         buf = buf->next;
     }
 
-    prev->next = newbuf;
+    buf->next = newbuf;
 }
 
 #ifdef _USE_OPENSSL
@@ -2347,6 +2661,109 @@ int flush_socket(struct sipp_socket *socket)
     return 0;
 }
 
+#ifdef HAVE_MMSG
+/* Datagrams written during a scheduler pass, packed into one buffer. */
+struct send_queue_entry {
+    struct sipp_socket *socket;
+    struct sockaddr_storage dest;
+    size_t offset;
+    size_t len;
+};
+
+#define SEND_QUEUE_BYTES (4 * SIPP_MAX_MSG_SIZE)
+
+static struct send_queue_entry *send_queue = NULL;
+static char *send_queue_buf = NULL;
+static int send_queue_len = 0;
+static size_t send_queue_used = 0;
+
+/* Only sockets that live as long as SIPp itself are queued, so that no
+ * entry can outlive its socket. Returns false if the caller must send
+ * the datagram itself. */
+static bool queue_datagram(struct sipp_socket *socket, const char *buffer, size_t len, struct sockaddr_storage *dest)
+{
+    if (send_batch <= 1 || socket->ss_transport != T_UDP || compression ||
+            socket->ss_call_socket || socket->ss_control ||
+            socket->ss_invalid || socket->ss_congested || socket->ss_out) {
+        return false;
+    }
+
+    if (!send_queue) {
+        send_queue = (struct send_queue_entry *)malloc(sizeof(*send_queue) * MAX_SEND_BATCH);
+        send_queue_buf = (char *)malloc(SEND_QUEUE_BYTES);
+        if (!send_queue || !send_queue_buf) {
+            ERROR("Could not allocate the send queue!");
+        }
+    }
+    if (send_queue_len == send_batch || send_queue_used + len > SEND_QUEUE_BYTES) {
+        flush_send_queue();
+    }
+
+    struct send_queue_entry *entry = &send_queue[send_queue_len++];
+    entry->socket = socket;
+    memcpy(&entry->dest, dest, SOCK_ADDR_SIZE(dest));
+    entry->offset = send_queue_used;
+    entry->len = len;
+    memcpy(send_queue_buf + send_queue_used, buffer, len);
+    send_queue_used += len;
+    return true;
+}
+
+/* Send queued datagrams with one sendmmsg() per run of the same socket.
+ * What the kernel will not take now is buffered on the socket as if
+ * write_socket() had been called with WS_BUFFER. */
+void flush_send_queue()
+{
+    struct mmsghdr msgs[MAX_SEND_BATCH];
+    struct iovec iovs[MAX_SEND_BATCH];
+    int start = 0;
+
+    for (int i = 0; i < send_queue_len; i++) {
+        iovs[i].iov_base = send_queue_buf + send_queue[i].offset;
+        iovs[i].iov_len = send_queue[i].len;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_name = &send_queue[i].dest;
+        msgs[i].msg_hdr.msg_namelen = SOCK_ADDR_SIZE(&send_queue[i].dest);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (start < send_queue_len) {
+        struct sipp_socket *socket = send_queue[start].socket;
+        int end = start;
+        while (end < send_queue_len && send_queue[end].socket == socket) {
+            end++;
+        }
+
+        while (start < end) {
+            int rc = sendmmsg(socket->ss_fd, &msgs[start], end - start, 0);
+            if (rc > 0) {
+                send_batches++;
+                send_batch_msgs += rc;
+                start += rc;
+            } else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                for (; start < end; start++) {
+                    buffer_write(socket, (char *)iovs[start].iov_base,
+                                 iovs[start].iov_len, &send_queue[start].dest);
+                }
+                enter_congestion(socket, errno);
+            } else {
+                /* Drop the datagram that failed, as write_socket() would. */
+                write_error(socket, rc);
+                start++;
+            }
+        }
+    }
+
+    send_queue_len = 0;
+    send_queue_used = 0;
+}
+#else
+void flush_send_queue()
+{
+}
+#endif
+
 /* Write data to a socket. */
 int write_socket(struct sipp_socket *socket, const char *buffer, ssize_t len, int flags, struct sockaddr_storage *dest)
 {
@@ -2362,6 +2779,11 @@ int write_socket(struct sipp_socket *socket, const char *buffer, ssize_t len, in
         if (rc < 0) {
             if ((errno == EWOULDBLOCK) && (flags & WS_BUFFER)) {
                 buffer_write(socket, buffer, len, dest);
+                if (usePcapngf == 1) {
+                    struct timeval currentTime;
+                    GET_TIME (&currentTime);
+                    trace_pcapng(socket, true, dest, buffer, len, &currentTime);
+                }
                 return len;
             } else {
                 return rc;
@@ -2369,7 +2791,14 @@ int write_socket(struct sipp_socket *socket, const char *buffer, ssize_t len, in
         }
     }
 
+#ifdef HAVE_MMSG
+    if (queue_datagram(socket, buffer, len, dest)) {
+        rc = len;
+    } else
+#endif
     rc = socket_write_primitive(socket, buffer, len, dest);
+    /* Tracing and buffering below may clobber errno. */
+    int write_errno = errno;
     struct timeval currentTime;
     GET_TIME (&currentTime);
 
@@ -2384,18 +2813,30 @@ int write_socket(struct sipp_socket *socket, const char *buffer, ssize_t len, in
                       len, len, buffer);
         }
 
+        if (usePcapngf == 1) {
+            trace_pcapng(socket, true, dest, buffer, len, &currentTime);
+        }
+
         if (useShortMessagef == 1) {
             char *msg = strdup(buffer);
-            char *call_id = get_call_id(msg);
+            char call_id[MAX_HEADER_LEN];
+            char cseq[MAX_HEADER_LEN];
+            char first_line[MAX_HEADER_LEN];
             TRACE_SHORTMSG("%s\tS\t%s\tCSeq:%s\t%s\n",
-                           CStat::formatTime(&currentTime), call_id, get_header_content(msg, "CSeq:"), get_first_line(msg));
+                           CStat::formatTime(&currentTime),
+                           get_call_id(msg, call_id, sizeof(call_id)),
+                           get_header_content(msg, "CSeq:", cseq, sizeof(cseq)),
+                           get_first_line(msg, first_line, sizeof(first_line)));
             free(msg);
         }
 
     } else if (rc <= 0) {
-        if ((errno == EWOULDBLOCK) && (flags & WS_BUFFER)) {
+        if ((write_errno == EWOULDBLOCK) && (flags & WS_BUFFER)) {
             buffer_write(socket, buffer, len, dest);
-            enter_congestion(socket, errno);
+            if (usePcapngf == 1) {
+                trace_pcapng(socket, true, dest, buffer, len, &currentTime);
+            }
+            enter_congestion(socket, write_errno);
             return len;
         }
         if (useMessagef == 1) {
@@ -2405,7 +2846,9 @@ int write_socket(struct sipp_socket *socket, const char *buffer, ssize_t len, in
                       TRANSPORT_TO_STRING(socket->ss_transport),
                       len, buffer);
         }
-        return write_error(socket, errno);
+        /* write_error() looks at errno itself. */
+        errno = write_errno;
+        return write_error(socket, write_errno);
     } else {
         /* We have a truncated message, which must be handled internally to the write function. */
         if (useMessagef == 1) {
@@ -2416,7 +2859,11 @@ int write_socket(struct sipp_socket *socket, const char *buffer, ssize_t len, in
                       rc, len, len, buffer);
         }
         buffer_write(socket, buffer + rc, len - rc, dest);
-        enter_congestion(socket, errno);
+        /* The tail goes out with the buffer, capture the whole message. */
+        if (usePcapngf == 1) {
+            trace_pcapng(socket, true, dest, buffer, len, &currentTime);
+        }
+        enter_congestion(socket, write_errno);
     }
 
     return rc;
@@ -2583,12 +3030,27 @@ int open_connections()
         }
     }
 
+    if (reuseport_sockets < 1 || reuseport_sockets > MAX_REUSEPORT_SOCKETS) {
+        ERROR("The number of SO_REUSEPORT sockets must be between 1 and %d", MAX_REUSEPORT_SOCKETS);
+    }
+    if (reuseport_sockets > 1 && (transport != T_UDP || sendMode != MODE_SERVER || peripsocket)) {
+        ERROR("-reuseport is only supported for UDP server scenarios without -t ui");
+    }
+    /* The default port probe must not succeed on a port that another
+     * SO_REUSEPORT process is listening on. */
+    if (reuseport_sockets > 1 && !user_port) {
+        ERROR("-reuseport requires an explicit local port (-p)");
+    }
+
     /* Creating and binding the local socket */
     if ((main_socket = new_sipp_socket(local_ip_is_ipv6, transport)) == NULL) {
         ERROR_NO("Unable to get the local socket");
     }
 
     sipp_customize_socket(main_socket);
+    if (reuseport_sockets > 1) {
+        sipp_reuseport_socket(main_socket);
+    }
 
     /* Trying to bind local port */
     char peripaddr[256];
@@ -2704,6 +3166,21 @@ int open_connections()
         map_perip_fd[peripaddr] = main_socket;
     }
 
+    // Open the other sockets sharing the main socket's port. The calls
+    // they create keep answering through the socket the INVITE came in on.
+    for (int i = 1; i < reuseport_sockets; i++) {
+        struct sipp_socket *sock;
+
+        if ((sock = new_sipp_socket(local_ip_is_ipv6, transport)) == NULL) {
+            ERROR_NO("Unable to get a SO_REUSEPORT socket");
+        }
+        sipp_customize_socket(sock);
+        sipp_reuseport_socket(sock);
+        if (sipp_bind_socket(sock, &local_sockaddr, NULL)) {
+            ERROR_NO("Unable to bind SO_REUSEPORT socket %d to port %d", i, local_port);
+        }
+    }
+
     // Create additional server sockets when running in socket per
     // IP address mode.
     if (peripsocket && sendMode == MODE_SERVER) {
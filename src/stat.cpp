@@ -26,6 +26,7 @@
 #include <fstream>
 #include <iomanip>
 #include <assert.h>
+#include <fcntl.h>
 
 #include "sipp.hpp"
 #include "scenario.hpp"
@@ -107,7 +108,9 @@
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_C * RTD_TYPES) + RTD_COUNT] = 0; \
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_C * RTD_TYPES) + RTD_SUM] = 0; \
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_C * RTD_TYPES) + RTD_SUMSQ] = 0; \
+	M_rtdHistograms[j * GENERIC_TYPES + GENERIC_C].reset(); \
   } \
+  M_callLengthHistograms[GENERIC_C].reset(); \
 }
 
 #define RESET_PD_COUNTERS                          \
@@ -128,7 +131,9 @@
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_PD * RTD_TYPES) + RTD_COUNT] = 0; \
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_PD * RTD_TYPES) + RTD_SUM] = 0; \
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_PD * RTD_TYPES) + RTD_SUMSQ] = 0; \
+	M_rtdHistograms[j * GENERIC_TYPES + GENERIC_PD].reset(); \
   } \
+  M_callLengthHistograms[GENERIC_PD].reset(); \
 }
 
 #define RESET_PL_COUNTERS                          \
@@ -149,7 +154,133 @@
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_PL * RTD_TYPES) + RTD_COUNT] = 0; \
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_PL * RTD_TYPES) + RTD_SUM] = 0; \
 	M_rtdInfo[(j * GENERIC_TYPES * RTD_TYPES) + (GENERIC_PL * RTD_TYPES) + RTD_SUMSQ] = 0; \
+	M_rtdHistograms[j * GENERIC_TYPES + GENERIC_PL].reset(); \
   } \
+  M_callLengthHistograms[GENERIC_PL].reset(); \
+}
+
+/* The percentiles in the -trace_stat file. */
+static const double stat_percentiles[] = {50, 90, 99, 99.9, 99.99};
+static const char *stat_percentile_names[] = {"P50", "P90", "P99", "P99.9", "P99.99"};
+#define NB_STAT_PERCENTILES (sizeof(stat_percentiles) / sizeof(stat_percentiles[0]))
+
+/*
+  __________________________________________________________________________
+
+  C L A S S    C H i s t o g r a m
+  __________________________________________________________________________
+*/
+
+CHistogram::CHistogram()
+{
+    reset();
+}
+
+int CHistogram::bucketOf(unsigned long long value)
+{
+    if (value >= (1ULL << HIST_MAX_BITS)) {
+        value = (1ULL << HIST_MAX_BITS) - 1;
+    }
+    if (value < (1ULL << HIST_SUB_BITS)) {
+        return (int)value;
+    }
+    /* Keep the top HIST_SUB_BITS bits: sub is in [HIST_HALF, 2 * HIST_HALF). */
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS + 1;
+    return shift * HIST_HALF + (int)(value >> shift);
+}
+
+unsigned long long CHistogram::highestInBucket(int bucket)
+{
+    if (bucket < (1 << HIST_SUB_BITS)) {
+        return bucket;
+    }
+    int shift = bucket / HIST_HALF - 1;
+    unsigned long long sub = bucket - shift * HIST_HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+void CHistogram::record(unsigned long long value)
+{
+    M_counts[bucketOf(value)]++;
+    M_total++;
+}
+
+void CHistogram::add(const CHistogram &other)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        M_counts[i] += other.M_counts[i];
+    }
+    M_total += other.M_total;
+}
+
+void CHistogram::reset()
+{
+    memset(M_counts, 0, sizeof(M_counts));
+    M_total = 0;
+}
+
+unsigned long long CHistogram::percentile(double percent) const
+{
+    unsigned long long seen = 0;
+    unsigned long long wanted;
+
+    if (!M_total) {
+        return 0;
+    }
+    wanted = (unsigned long long)ceil(percent / 100.0 * M_total);
+    if (wanted < 1) {
+        wanted = 1;
+    }
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += M_counts[i];
+        if (seen >= wanted) {
+            return highestInBucket(i);
+        }
+    }
+    return highestInBucket(HIST_BUCKETS - 1);
+}
+
+/*
+  __________________________________________________________________________
+
+  C L A S S    C T h r e a d C o u n t e r s
+  __________________________________________________________________________
+*/
+
+__thread CThreadCounters *CThreadCounters::M_mine = NULL;
+CThreadCounters *CThreadCounters::M_blocks = NULL;
+pthread_mutex_t CThreadCounters::M_blocksLock = PTHREAD_MUTEX_INITIALIZER;
+
+CThreadCounters *CThreadCounters::attach()
+{
+    void *L_block;
+
+    /* Blocks are never freed: the threads that count live as long as
+     * the run, and a late fold may still read an exited thread's block. */
+    if (posix_memalign(&L_block, 64, sizeof(CThreadCounters))) {
+        ERROR("Could not allocate thread counters");
+    }
+    memset(L_block, 0, sizeof(CThreadCounters));
+    M_mine = (CThreadCounters *)L_block;
+
+    pthread_mutex_lock(&M_blocksLock);
+    M_mine->M_next = M_blocks;
+    M_blocks = M_mine;
+    pthread_mutex_unlock(&M_blocksLock);
+    return M_mine;
+}
+
+void CThreadCounters::fold(unsigned long long P_delta[TC_NB_COUNTERS])
+{
+    pthread_mutex_lock(&M_blocksLock);
+    for (CThreadCounters *L_block = M_blocks; L_block; L_block = L_block->M_next) {
+        for (int i = 0; i < TC_NB_COUNTERS; i++) {
+            unsigned long long L_value = __atomic_load_n(&L_block->M_counters[i], __ATOMIC_RELAXED);
+            P_delta[i] += L_value - L_block->M_folded[i];
+            L_block->M_folded[i] = L_value;
+        }
+    }
+    pthread_mutex_unlock(&M_blocksLock);
 }
 
 /*
@@ -160,6 +291,8 @@
 */
 
 unsigned long long CStat::M_G_counters[E_NB_G_COUNTER - E_NB_COUNTER];
+pthread_t CStat::M_foldThread;
+bool CStat::M_foldThreadSet = false;
 
 CStat::~CStat()
 {
@@ -183,16 +316,12 @@ CStat::~CStat()
     if(M_fileName != NULL)
         delete [] M_fileName;
 
-    if(M_outputStreamRtt != NULL) {
-        M_outputStreamRtt->close();
-        delete M_outputStreamRtt;
-    }
+    stopRttWriter();
     if(M_fileNameRtt != NULL)
         delete [] M_fileNameRtt;
 
-
-    if(M_dumpRespTime != NULL)
-        delete [] M_dumpRespTime ;
+    if(M_rttRing != NULL)
+        delete [] M_rttRing ;
 
     free(M_rtdInfo);
     for (int_str_map::iterator i = M_revRtdMap.begin(); i != M_revRtdMap.end(); ++i) {
@@ -205,9 +334,8 @@ CStat::~CStat()
     M_fileName                      = NULL;
     M_outputStream                  = NULL;
 
-    M_outputStreamRtt               = NULL;
     M_fileNameRtt                   = NULL;
-    M_dumpRespTime                  = NULL;
+    M_rttRing                       = NULL;
 }
 
 
@@ -221,8 +349,6 @@ int CStat::init ()
     M_outputStream = NULL;
     M_headerAlreadyDisplayed = false;
 
-    M_outputStreamRtt = NULL;
-    M_headerAlreadyDisplayedRtt = false;
 
     std::vector<int> error_codes(0);
 
@@ -385,7 +511,7 @@ void CStat::setFileName(char * P_name)
 
 
 void CStat::initRtt(char * P_name, char * P_extension,
-                    unsigned long P_report_freq_dumpRtt)
+                    unsigned long P_report_freq_dumpRtt, bool P_binary)
 {
     int sizeOf, sizeOfExtension;
 
@@ -410,20 +536,28 @@ void CStat::initRtt(char * P_name, char * P_extension,
              << DEFAULT_FILE_NAME << endl;
     }
 
-    // initiate the table dump response time
+    // initiate the ring of response times, large enough to absorb a few
+    // dump periods while the writer thread is busy
     M_report_freq_dumpRtt = P_report_freq_dumpRtt ;
+    M_binaryRtt = P_binary ;
 
-    M_dumpRespTime = new T_value_rtt [P_report_freq_dumpRtt] ;
+    unsigned long L_size = RTT_RING_MIN_SIZE ;
+    while (L_size < 4 * P_report_freq_dumpRtt && L_size < RTT_RING_MAX_SIZE) {
+        L_size <<= 1 ;
+    }
+    M_rttRing = new T_value_rtt [L_size] ;
+    M_rttMask = L_size - 1 ;
 
-    if ( M_dumpRespTime == NULL ) {
-        cerr << "Memory allocation failure" << endl;
-        exit(EXIT_FATAL_ERROR);
+    // snapshot the RTD names for the writer thread
+    M_rttNames.assign(nRtds() + 1, string());
+    for (int L_i = 1; L_i <= nRtds(); L_i++) {
+        M_rttNames[L_i] = M_revRtdMap[L_i];
     }
 
-    for (unsigned L_i = 0 ; L_i < P_report_freq_dumpRtt; L_i ++) {
-        M_dumpRespTime[L_i].date = 0.0;
-        M_dumpRespTime[L_i].rtd_no = 0;
-        M_dumpRespTime[L_i].rtt = 0.0;
+    M_fdRtt = open(M_fileNameRtt, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (M_fdRtt < 0) {
+        cerr << "Unable to open rtt file '" << M_fileNameRtt << "' !" << endl;
+        exit(EXIT_FATAL_ERROR);
     }
 }
 
@@ -707,46 +841,32 @@ int CStat::globalStat (E_Action P_action)
 {
     switch (P_action) {
     case E_OUT_OF_CALL_MSGS :
-        M_G_counters [CPT_G_C_OutOfCallMsgs - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PD_OutOfCallMsgs - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PL_OutOfCallMsgs - E_NB_COUNTER - 1]++;
+        CThreadCounters::add(CThreadCounters::TC_OUT_OF_CALL_MSGS);
         break;
 
     case E_WATCHDOG_MAJOR :
-        M_G_counters [CPT_G_C_WatchdogMajor - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PD_WatchdogMajor - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PL_WatchdogMajor - E_NB_COUNTER - 1]++;
+        CThreadCounters::add(CThreadCounters::TC_WATCHDOG_MAJOR);
         break;
 
     case E_WATCHDOG_MINOR :
-        M_G_counters [CPT_G_C_WatchdogMinor - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PD_WatchdogMinor - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PL_WatchdogMinor - E_NB_COUNTER - 1]++;
+        CThreadCounters::add(CThreadCounters::TC_WATCHDOG_MINOR);
         break;
 
     case E_DEAD_CALL_MSGS :
-        M_G_counters [CPT_G_C_DeadCallMsgs - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PD_DeadCallMsgs - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PL_DeadCallMsgs - E_NB_COUNTER - 1]++;
+        CThreadCounters::add(CThreadCounters::TC_DEAD_CALL_MSGS);
         break;
 
     case E_FATAL_ERRORS :
-        M_G_counters [CPT_G_C_FatalErrors - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PD_FatalErrors - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PL_FatalErrors - E_NB_COUNTER - 1]++;
+        CThreadCounters::add(CThreadCounters::TC_FATAL_ERRORS);
         break;
 
     case E_WARNING :
-        M_G_counters [CPT_G_C_Warnings - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PD_Warnings - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PL_Warnings - E_NB_COUNTER - 1]++;
+        CThreadCounters::add(CThreadCounters::TC_WARNINGS);
         break;
 
     case E_AUTO_ANSWERED :
         // Let's count the automatic answered calls
-        M_G_counters [CPT_G_C_AutoAnswered - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PD_AutoAnswered - E_NB_COUNTER - 1]++;
-        M_G_counters [CPT_G_PL_AutoAnswered - E_NB_COUNTER - 1]++;
+        CThreadCounters::add(CThreadCounters::TC_AUTO_ANSWERED);
         break;
     default :
         ERROR("CStat::ComputeStat() - Unrecognized Action %d\n", P_action);
@@ -755,18 +875,88 @@ int CStat::globalStat (E_Action P_action)
     return (0);
 }
 
+void CStat::foldThreadCounters ()
+{
+    static const struct {
+        CThreadCounters::E_Counter counter;
+        E_CounterName C, PD, PL;
+    } L_global[] = {
+        { CThreadCounters::TC_OUT_OF_CALL_MSGS, CPT_G_C_OutOfCallMsgs, CPT_G_PD_OutOfCallMsgs, CPT_G_PL_OutOfCallMsgs },
+        { CThreadCounters::TC_DEAD_CALL_MSGS, CPT_G_C_DeadCallMsgs, CPT_G_PD_DeadCallMsgs, CPT_G_PL_DeadCallMsgs },
+        { CThreadCounters::TC_FATAL_ERRORS, CPT_G_C_FatalErrors, CPT_G_PD_FatalErrors, CPT_G_PL_FatalErrors },
+        { CThreadCounters::TC_WARNINGS, CPT_G_C_Warnings, CPT_G_PD_Warnings, CPT_G_PL_Warnings },
+        { CThreadCounters::TC_WATCHDOG_MAJOR, CPT_G_C_WatchdogMajor, CPT_G_PD_WatchdogMajor, CPT_G_PL_WatchdogMajor },
+        { CThreadCounters::TC_WATCHDOG_MINOR, CPT_G_C_WatchdogMinor, CPT_G_PD_WatchdogMinor, CPT_G_PL_WatchdogMinor },
+        { CThreadCounters::TC_AUTO_ANSWERED, CPT_G_C_AutoAnswered, CPT_G_PD_AutoAnswered, CPT_G_PL_AutoAnswered },
+    };
+    unsigned long long L_delta[CThreadCounters::TC_NB_COUNTERS] = { 0 };
+
+    /* The folded counters have a single writer, the scheduler. */
+    if (M_foldThreadSet && !pthread_equal(pthread_self(), M_foldThread)) {
+        return;
+    }
+    CThreadCounters::fold(L_delta);
+
+    for (unsigned int i = 0; i < sizeof(L_global) / sizeof(L_global[0]); i++) {
+        unsigned long long L_value = L_delta[L_global[i].counter];
+        M_G_counters [L_global[i].C - E_NB_COUNTER - 1] += L_value;
+        M_G_counters [L_global[i].PD - E_NB_COUNTER - 1] += L_value;
+        M_G_counters [L_global[i].PL - E_NB_COUNTER - 1] += L_value;
+    }
+
+    rtp_pckts += L_delta[CThreadCounters::TC_RTP_PCKTS];
+    rtp_bytes += L_delta[CThreadCounters::TC_RTP_BYTES];
+    rtp2_pckts += L_delta[CThreadCounters::TC_RTP2_PCKTS];
+    rtp2_bytes += L_delta[CThreadCounters::TC_RTP2_BYTES];
+    rtp_pckts_pcap += L_delta[CThreadCounters::TC_RTP_PCKTS_PCAP];
+    rtp_bytes_pcap += L_delta[CThreadCounters::TC_RTP_BYTES_PCAP];
+#ifdef RTP_STREAM
+    rtpstream_pckts += L_delta[CThreadCounters::TC_RTPSTREAM_PCKTS];
+    rtpstream_bytes_out += L_delta[CThreadCounters::TC_RTPSTREAM_BYTES_OUT];
+    rtpstream_pckts_in += L_delta[CThreadCounters::TC_RTPSTREAM_PCKTS_IN];
+    rtpstream_bytes_in += L_delta[CThreadCounters::TC_RTPSTREAM_BYTES_IN];
+    rtpstream_calls_no_rtp_in += L_delta[CThreadCounters::TC_RTPSTREAM_CALLS_NO_RTP_IN];
+#endif
+}
+
+void CStat::setFoldThread ()
+{
+    M_foldThread = pthread_self();
+    M_foldThreadSet = true;
+}
+
+/* For the PCAP players, written in C. */
+extern "C" void count_pcap_rtp(unsigned long P_bytes)
+{
+    CThreadCounters::add(CThreadCounters::TC_RTP_PCKTS_PCAP);
+    CThreadCounters::add(CThreadCounters::TC_RTP_BYTES_PCAP, P_bytes);
+}
+
 
 void CStat::computeRtt (unsigned long long P_start_time, unsigned long long P_stop_time, int which)
 {
-    M_dumpRespTime[M_counterDumpRespTime].date = (double)P_stop_time / (double)1000;
-    M_dumpRespTime[M_counterDumpRespTime].rtd_no = which;
-    M_dumpRespTime[M_counterDumpRespTime].rtt =
-        ((double)(P_stop_time - P_start_time)) / (double)1000;
-    M_counterDumpRespTime++ ;
+    unsigned int L_tail = M_rttTail;
 
-    if (M_counterDumpRespTime > (M_report_freq_dumpRtt - 1)) {
-        dumpDataRtt () ;
+    if (M_rttRing == NULL) {
+        return;
+    }
+    if (!M_rttWriterStarted) {
+        startRttWriter();
+    }
+    if (L_tail - __atomic_load_n(&M_rttHead, __ATOMIC_ACQUIRE) > M_rttMask) {
+        // the writer is behind: never stall the calls waiting for it
+        if (M_rttDropped++ == 0) {
+            WARNING("The -trace_rtt writer can not keep up, response times are being dropped");
+        }
+        return;
     }
+
+    T_value_rtt *L_value = &M_rttRing[L_tail & M_rttMask];
+    unsigned long long L_rtt = P_stop_time - P_start_time;
+    L_value->date_us = P_stop_time;
+    L_value->rtt_us = L_rtt > 0xffffffffULL ? 0xffffffffU : (unsigned int)L_rtt;
+    L_value->rtd_no = which;
+    __atomic_store_n(&M_rttTail, L_tail + 1, __ATOMIC_RELEASE);
 }
 
 unsigned long long CStat::GetStat (E_CounterName P_counter)
@@ -937,6 +1127,7 @@ int CStat::findRtd(const char *name, bool start)
         ERROR("Could not allocate RTD info!\n");
     }
     M_ResponseTimeRepartition[ret - 1] = NULL;
+    M_rtdHistograms.resize(M_rtdMap.size() * GENERIC_TYPES);
 
     if (start) {
         rtd_started[name] = true;
@@ -974,6 +1165,9 @@ int CStat::computeStat (E_Action P_action,
                              CPT_C_AverageCallLength_Squares, P_value);
         updateRepartition(M_CallLengthRepartition,
                           M_SizeOfCallLengthRepartition, P_value);
+        for (int i = 0; i < GENERIC_TYPES; i++) {
+            M_callLengthHistograms[i].record(P_value * 1000ULL);
+        }
         // Updating Periodical Diplayed counter
         updateAverageCounter(CPT_PD_AverageCallLength_Sum,
                              CPT_PD_NbOfCallUsedForAverageCallLength,
@@ -992,6 +1186,12 @@ int CStat::computeStat (E_Action P_action,
         break;
 
     case E_ADD_RESPONSE_TIME_DURATION :
+        // The percentiles keep the microseconds, the rest is in ms
+        for (int i = 0; i < GENERIC_TYPES; i++) {
+            M_rtdHistograms[which * GENERIC_TYPES + i].record(P_value);
+        }
+        P_value /= 1000;
+
         // Updating Cumulative Counter
         M_rtdInfo[(which * RTD_TYPES * GENERIC_TYPES) + (GENERIC_C * RTD_TYPES) + RTD_COUNT]++;
         M_rtdInfo[(which * RTD_TYPES * GENERIC_TYPES) + (GENERIC_C * RTD_TYPES) + RTD_SUM] += P_value;
@@ -1066,10 +1266,17 @@ CStat::CStat ()
     M_fileNameRtt = NULL;
     M_genericCounters = NULL;
     M_time_ref = 0.0                   ;
-    M_dumpRespTime = NULL              ;
-    M_counterDumpRespTime = 0          ;
-    M_dumpRespTime = NULL;
-    M_fileNameRtt  = NULL;
+    M_fdRtt = -1                       ;
+    M_binaryRtt = false                ;
+    M_report_freq_dumpRtt = 0          ;
+    M_rttRing = NULL                   ;
+    M_rttMask = 0                      ;
+    M_rttHead = 0                      ;
+    M_rttTail = 0                      ;
+    M_rttFlush = 0                     ;
+    M_rttStop = 0                      ;
+    M_rttDropped = 0                   ;
+    M_rttWriterStarted = false         ;
     M_rtdInfo = NULL;
 
     init();
@@ -1235,6 +1442,9 @@ void CStat::displayData (FILE *f)
     for (int i = 1; i <= nRtds(); i++) {
         char s[80];
 
+        char s_P[80];
+        char s_C[80];
+
         /* Skip if we aren't stopped. */
         assert(rtd_stopped[M_revRtdMap[i]] == true);
 
@@ -1242,6 +1452,9 @@ void CStat::displayData (FILE *f)
         DISPLAY_TXT_COL (s,
                          msToHHMMSSus( (unsigned long)computeRtdMean(i, GENERIC_PD)),
                          msToHHMMSSus( (unsigned long)computeRtdMean(i, GENERIC_C)));
+        DISPLAY_TXT_COL ("  p50/p99/p99.9 ms",
+                         sPercentiles(s_P, M_rtdHistograms[(i - 1) * GENERIC_TYPES + GENERIC_PD]),
+                         sPercentiles(s_C, M_rtdHistograms[(i - 1) * GENERIC_TYPES + GENERIC_C]));
     }
     /* I Broke this!
       DISPLAY_TXT_COL ("Call Length",
@@ -1255,6 +1468,7 @@ void CStat::displayData (FILE *f)
     }
     DISPLAY_INFO("Average Call Length Repartition");
     displayRepartition(f, M_CallLengthRepartition, M_SizeOfCallLengthRepartition);
+    displayPercentiles(f, M_callLengthHistograms[GENERIC_C]);
 
     //  DISPLAY_VAL ("NbCall Average RT(P)",
     //                 M_counters[CPT_PD_NbOfCallUsedForAverageResponseTime]);
@@ -1344,6 +1558,8 @@ void CStat::displayStat (FILE *f)
     //               M_counters[CPT_C_UnexpectedMessage]);
 
     DISPLAY_CROSS_LINE ();
+    char s_P[80];
+    char s_C[80];
     for (int i = 1; i <= nRtds(); i++) {
         char s[80];
 
@@ -1351,10 +1567,20 @@ void CStat::displayStat (FILE *f)
         DISPLAY_TXT_COL (s,
                          msToHHMMSSus( (unsigned long)computeRtdMean(i, GENERIC_PD)),
                          msToHHMMSSus( (unsigned long)computeRtdMean(i, GENERIC_C)));
+        DISPLAY_TXT_COL ("  p50/p99/p99.9 ms",
+                         sPercentiles(s_P, M_rtdHistograms[(i - 1) * GENERIC_TYPES + GENERIC_PD]),
+                         sPercentiles(s_C, M_rtdHistograms[(i - 1) * GENERIC_TYPES + GENERIC_C]));
     }
     DISPLAY_TXT_COL ("Call Length",
                      msToHHMMSSus( (unsigned long)computeMean(CPT_PD_AverageCallLength_Sum, CPT_PD_NbOfCallUsedForAverageCallLength ) ),
                      msToHHMMSSus( (unsigned long)computeMean(CPT_C_AverageCallLength_Sum, CPT_C_NbOfCallUsedForAverageCallLength) ));
+    DISPLAY_TXT_COL ("  p50/p99/p99.9 ms",
+                     sPercentiles(s_P, M_callLengthHistograms[GENERIC_PD]),
+                     sPercentiles(s_C, M_callLengthHistograms[GENERIC_C]));
+    if (M_rttDropped) {
+        DISPLAY_CROSS_LINE ();
+        DISPLAY_CUMUL ("RTT samples dropped", M_rttDropped);
+    }
     fflush(f);
 }
 
@@ -1365,6 +1591,7 @@ void CStat::displayRepartition (FILE *f)
     displayRepartition(f,
                        M_CallLengthRepartition,
                        M_SizeOfCallLengthRepartition);
+    displayPercentiles(f, M_callLengthHistograms[GENERIC_C]);
 }
 
 void CStat::displayRtdRepartition (FILE *f, int which)
@@ -1380,6 +1607,32 @@ void CStat::displayRtdRepartition (FILE *f, int which)
     displayRepartition(f,
                        M_ResponseTimeRepartition[which - 1],
                        M_SizeOfResponseTimeRepartition);
+    displayPercentiles(f, M_rtdHistograms[(which - 1) * GENERIC_TYPES + GENERIC_C]);
+}
+
+char* CStat::sPercentiles(char *buf, const CHistogram &histogram)
+{
+    sprintf(buf, "%.3f/%.3f/%.3f",
+            histogram.percentile(50) / 1000.0,
+            histogram.percentile(99) / 1000.0,
+            histogram.percentile(99.9) / 1000.0);
+    return buf;
+}
+
+void CStat::displayPercentiles(FILE *f, const CHistogram &histogram)
+{
+    char s[80];
+
+    if (!histogram.count()) {
+        return;
+    }
+    snprintf(s, sizeof(s), "    p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  p99.99 %.3f ms",
+             histogram.percentile(50) / 1000.0,
+             histogram.percentile(90) / 1000.0,
+             histogram.percentile(99) / 1000.0,
+             histogram.percentile(99.9) / 1000.0,
+             histogram.percentile(99.99) / 1000.0);
+    DISPLAY_INFO(s);
 }
 
 
@@ -1524,6 +1777,17 @@ void CStat::dumpData ()
         (*M_outputStream) << sRepartitionHeader(M_CallLengthRepartition,
                                                 M_SizeOfCallLengthRepartition,
                                                 (char*) "CallLengthRepartition");
+        // percentiles, in milliseconds
+        for (int i = 1; i <= nRtds(); i++) {
+            for (unsigned int p = 0; p < NB_STAT_PERCENTILES; p++) {
+                (*M_outputStream) << "ResponseTime" << M_revRtdMap[i] << stat_percentile_names[p] << "(P)" << stat_delimiter
+                                  << "ResponseTime" << M_revRtdMap[i] << stat_percentile_names[p] << "(C)" << stat_delimiter;
+            }
+        }
+        for (unsigned int p = 0; p < NB_STAT_PERCENTILES; p++) {
+            (*M_outputStream) << "CallLength" << stat_percentile_names[p] << "(P)" << stat_delimiter
+                              << "CallLength" << stat_percentile_names[p] << "(C)" << stat_delimiter;
+        }
         (*M_outputStream) << endl;
         M_headerAlreadyDisplayed = true;
     }
@@ -1628,6 +1892,19 @@ void CStat::dumpData ()
     (*M_outputStream)
             << sRepartitionInfo(M_CallLengthRepartition,
                                 M_SizeOfCallLengthRepartition);
+
+    for (int i = 0; i < nRtds(); i++) {
+        for (unsigned int p = 0; p < NB_STAT_PERCENTILES; p++) {
+            (*M_outputStream)
+                    << M_rtdHistograms[i * GENERIC_TYPES + GENERIC_PL].percentile(stat_percentiles[p]) / 1000.0 << stat_delimiter
+                    << M_rtdHistograms[i * GENERIC_TYPES + GENERIC_C].percentile(stat_percentiles[p]) / 1000.0 << stat_delimiter;
+        }
+    }
+    for (unsigned int p = 0; p < NB_STAT_PERCENTILES; p++) {
+        (*M_outputStream)
+                << M_callLengthHistograms[GENERIC_PL].percentile(stat_percentiles[p]) / 1000.0 << stat_delimiter
+                << M_callLengthHistograms[GENERIC_C].percentile(stat_percentiles[p]) / 1000.0 << stat_delimiter;
+    }
     (*M_outputStream) << endl;
 
     // flushing the output file to let the tail -f working !
@@ -1637,45 +1914,135 @@ void CStat::dumpData ()
 
 void CStat::dumpDataRtt ()
 {
-    if(M_outputStreamRtt == NULL) {
-        // if the file is still not opened, we opened it now
-        M_outputStreamRtt = new ofstream(M_fileNameRtt);
-        M_headerAlreadyDisplayedRtt = false;
+    // the writer thread picks the queued samples up on its next wakeup
+    __atomic_store_n(&M_rttFlush, 1, __ATOMIC_RELEASE);
+}
 
-        if(M_outputStreamRtt == NULL) {
-            cerr << "Unable to open rtt file '" << M_fileNameRtt << "' !" << endl;
-            exit(EXIT_FATAL_ERROR);
-        }
+void* CStat::rttWriterThread (void* P_stat)
+{
+    ((CStat*)P_stat)->runRttWriter();
+    return NULL;
+}
 
-#ifndef __osf__
-        if(!M_outputStreamRtt->is_open()) {
-            cerr << "Unable to open rtt file '" << M_fileNameRtt << "' !" << endl;
-            exit(EXIT_FATAL_ERROR);
+void CStat::runRttWriter ()
+{
+    writeRttHeader();
+
+    for (;;) {
+        int L_stop = __atomic_load_n(&M_rttStop, __ATOMIC_ACQUIRE);
+        int L_flush = __atomic_exchange_n(&M_rttFlush, 0, __ATOMIC_ACQ_REL);
+        unsigned int L_tail = __atomic_load_n(&M_rttTail, __ATOMIC_ACQUIRE);
+
+        if (L_tail != M_rttHead &&
+                (L_stop || L_flush ||
+                 L_tail - M_rttHead >= M_report_freq_dumpRtt)) {
+            writeRttSamples(M_rttHead, L_tail);
         }
-#endif
+        if (L_stop) {
+            break;
+        }
+        usleep(RTT_WRITER_SLEEP_US);
     }
+}
+
+void CStat::writeRttHeader ()
+{
+    if (!M_binaryRtt) {
+        string L_header = string("Date_ms") + stat_delimiter
+                          + "response_time_ms" + stat_delimiter + "rtd_no\n";
+        writeRttBlock(L_header.c_str(), L_header.size());
+        return;
+    }
+
+    string L_header("SIPPRTT1");
+    uint32_t L_len = M_rttNames.size() - 1;
+    L_header.append((const char *)&L_len, sizeof(L_len));
+    for (unsigned int L_i = 1; L_i < M_rttNames.size(); L_i++) {
+        L_len = M_rttNames[L_i].size();
+        L_header.append((const char *)&L_len, sizeof(L_len));
+        L_header.append(M_rttNames[L_i]);
+    }
+    writeRttBlock(L_header.data(), L_header.size());
+}
+
+void CStat::writeRttSamples (unsigned int P_head, unsigned int P_tail)
+{
+    char L_block[RTT_WRITE_BLOCK_SIZE];
+    size_t L_len = 0;
+
+    while (P_head != P_tail) {
+        const T_value_rtt *L_value = &M_rttRing[P_head & M_rttMask];
+
+        if (M_binaryRtt) {
+            memcpy(L_block + L_len, L_value, sizeof(*L_value));
+            L_len += sizeof(*L_value);
+        } else {
+            const char *L_name = (L_value->rtd_no > 0 &&
+                                  (unsigned)L_value->rtd_no < M_rttNames.size()) ?
+                                 M_rttNames[L_value->rtd_no].c_str() : "";
+            int L_ret = snprintf(L_block + L_len, sizeof(L_block) - L_len,
+                                 "%llu.%03llu%s%u.%03u%s%s\n",
+                                 L_value->date_us / 1000, L_value->date_us % 1000,
+                                 stat_delimiter,
+                                 L_value->rtt_us / 1000, L_value->rtt_us % 1000,
+                                 stat_delimiter, L_name);
+            L_len += std::min((size_t)L_ret, sizeof(L_block) - L_len - 1);
+        }
+        P_head++;
 
-    if(M_headerAlreadyDisplayedRtt == false) {
-        (*M_outputStreamRtt) << "Date_ms" << stat_delimiter
-                             << "response_time_ms" << stat_delimiter
-                             << "rtd_no" << endl;
-        M_headerAlreadyDisplayedRtt = true;
+        if (P_head == P_tail || L_len > sizeof(L_block) - RTT_MAX_LINE_SIZE) {
+            writeRttBlock(L_block, L_len);
+            L_len = 0;
+            // hand the written slots back to the scheduler
+            __atomic_store_n(&M_rttHead, P_head, __ATOMIC_RELEASE);
+        }
     }
+}
 
-    for (unsigned int L_i = 0; L_i < M_counterDumpRespTime ; L_i ++) {
-        (*M_outputStreamRtt) <<  M_dumpRespTime[L_i].date   << stat_delimiter ;
-        (*M_outputStreamRtt) <<  M_dumpRespTime[L_i].rtt    << stat_delimiter ;
-        (*M_outputStreamRtt) <<  M_revRtdMap[M_dumpRespTime[L_i].rtd_no] << endl;
-        (*M_outputStreamRtt).flush();
-        M_dumpRespTime[L_i].date = 0.0;
-        M_dumpRespTime[L_i].rtt = 0.0;
-        M_dumpRespTime[L_i].rtd_no = 0;
+void CStat::writeRttBlock (const char* P_block, size_t P_len)
+{
+    while (P_len > 0) {
+        ssize_t L_ret = write(M_fdRtt, P_block, P_len);
+        if (L_ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        P_block += L_ret;
+        P_len -= L_ret;
     }
+}
 
-    // flushing the output file
-    (*M_outputStreamRtt).flush();
+/* The writer is only started with the first sample, once the -bg fork()
+ * is behind us: threads do not survive into the child process. */
+void CStat::startRttWriter ()
+{
+    if (pthread_create(&M_rttWriter, NULL, rttWriterThread, this) != 0) {
+        cerr << "Unable to start the rtt writer thread" << endl;
+        exit(EXIT_FATAL_ERROR);
+    }
+    M_rttWriterStarted = true;
+}
 
-    M_counterDumpRespTime = 0;
+void CStat::stopRttWriter ()
+{
+    if (M_rttWriterStarted) {
+        __atomic_store_n(&M_rttStop, 1, __ATOMIC_RELEASE);
+        pthread_join(M_rttWriter, NULL);
+        M_rttWriterStarted = false;
+    } else if (M_fdRtt >= 0) {
+        // no response time was measured: the file only gets its header
+        writeRttHeader();
+    }
+    if (M_fdRtt >= 0) {
+        ::close(M_fdRtt);
+        M_fdRtt = -1;
+    }
+    if (M_rttDropped) {
+        cerr << M_rttDropped << " response times could not be written to '"
+             << M_fileNameRtt << "'" << endl;
+    }
 }
 
 
@@ -1844,6 +2211,51 @@ double CUniform::cdfInv(double percentile)
     return min + (max * percentile);
 }
 
+#ifdef HAVE_GSL
+gsl_rng *gsl_init();
+#endif
+
+/* Exponential distribution. */
+CExponential::CExponential(double mean)
+{
+    this->mean = mean;
+#ifdef HAVE_GSL
+    rng = gsl_init();
+#else
+    if (!uniform_init) {
+        uniform_init = true;
+        srand(time(NULL));
+    }
+#endif
+}
+
+double CExponential::sample()
+{
+#ifdef HAVE_GSL
+    return gsl_ran_exponential(rng, mean);
+#else
+    /* Map (0, 1] through the inverse CDF; a zero would give infinity. */
+    double rval = ((double)rand() + 1.0)/((double)RAND_MAX + 1.0);
+    return -mean * log(rval);
+#endif
+}
+
+int CExponential::textDescr(char *s, int len)
+{
+    return snprintf(s, len, "Exp(%lf)", mean);
+}
+int CExponential::timeDescr(char *s, int len)
+{
+    int used = snprintf(s, len, "Exp(");
+    used += time_string(mean, s + used, len - used);
+    used += snprintf(s + used, len - used, ")");
+    return used;
+}
+double CExponential::cdfInv(double percentile)
+{
+    return -mean * log(1.0 - percentile);
+}
+
 #ifdef HAVE_GSL
 gsl_rng *gsl_init()
 {
@@ -1921,34 +2333,6 @@ double CLogNormal::cdfInv(double percentile)
     return gsl_cdf_lognormal_Pinv(percentile, mean, stdev);
 }
 
-/* Exponential distribution. */
-CExponential::CExponential(double mean)
-{
-    this->mean = mean;
-    rng = gsl_init();
-}
-
-double CExponential::sample()
-{
-    return gsl_ran_exponential(rng, mean);
-}
-
-int CExponential::textDescr(char *s, int len)
-{
-    return snprintf(s, len, "Exp(%lf)", mean);
-}
-int CExponential::timeDescr(char *s, int len)
-{
-    int used = snprintf(s, len, "Exp(");
-    used += time_string(mean, s + used, len - used);
-    used += snprintf(s + used, len - used, ")");
-    return used;
-}
-double CExponential::cdfInv(double percentile)
-{
-    return gsl_cdf_exponential_Pinv(percentile, mean);
-}
-
 /* Weibull distribution. */
 CWeibull::CWeibull(double lambda, double k)
 {
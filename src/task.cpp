@@ -49,6 +49,23 @@ task_list all_tasks;
 task_list running_tasks;
 timewheel paused_tasks;
 
+/* FNV-1a, cheap and well spread over the sequential Call-IDs we generate. */
+unsigned int call_id_hash(const char *call_id, size_t len)
+{
+    unsigned int hash = 2166136261U;
+
+    while (len--) {
+        hash ^= (unsigned char)*call_id++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+unsigned int call_id_hash(const char *call_id)
+{
+    return call_id_hash(call_id, strlen(call_id));
+}
+
 /* Get the overall list of running tasks. */
 task_list* get_running_tasks()
 {
@@ -83,11 +100,66 @@ int paused_tasks_count()
     return paused_tasks.size();
 }
 
+// Methods for the task_list class
+
+task_list::task_list()
+{
+    head.next = &head;
+    head.prev = &head;
+    head.owner = NULL;
+    count = 0;
+}
+
+void task_list::push_back(struct task_hook *hook)
+{
+    hook->prev = head.prev;
+    hook->next = &head;
+    head.prev->next = hook;
+    head.prev = hook;
+    count++;
+}
+
+void task_list::erase(struct task_hook *hook)
+{
+    hook->prev->next = hook->next;
+    hook->next->prev = hook->prev;
+    hook->next = hook->prev = NULL;
+    count--;
+}
+
+task *task_list::pop_front()
+{
+    if (empty()) {
+        return NULL;
+    }
+    struct task_hook *hook = head.next;
+    erase(hook);
+    return hook->owner;
+}
+
+void task_list::move_to(task_list *dest)
+{
+    if (empty()) {
+        return;
+    }
+    head.next->prev = dest->head.prev;
+    head.prev->next = &dest->head;
+    dest->head.prev->next = head.next;
+    dest->head.prev = head.prev;
+    dest->count += count;
+
+    head.next = &head;
+    head.prev = &head;
+    count = 0;
+}
+
 // Methods for the task class
 
 task::task()
 {
-    this->taskit = all_tasks.insert(all_tasks.end(), this);
+    this->taskhook.owner = this;
+    this->queuehook.owner = this;
+    all_tasks.push_back(&taskhook);
     add_to_runqueue();
 }
 
@@ -98,13 +170,13 @@ task::~task()
     } else {
         paused_tasks.remove_paused_task(this);
     }
-    all_tasks.erase(taskit);
+    all_tasks.erase(&taskhook);
 }
 
 /* Put this task in the run queue. */
 void task::add_to_runqueue()
 {
-    this->runit = running_tasks.insert(running_tasks.end(), this);
+    running_tasks.push_back(&queuehook);
     this->running = true;
 }
 
@@ -123,7 +195,7 @@ bool task::remove_from_runqueue()
     if (!this->running) {
         return false;
     }
-    running_tasks.erase(this->runit);
+    running_tasks.erase(&queuehook);
     this->running = false;
     return true;
 }
@@ -226,40 +298,34 @@ int timewheel::expire_paused_tasks()
                 int slot3 = ((wheel_base / LEVEL_ONE_SLOTS) / LEVEL_TWO_SLOTS);
                 assert(slot3 < LEVEL_THREE_SLOTS);
 
-                for (task_list::iterator l3it = wheel_three[slot3].begin();
-                        l3it != wheel_three[slot3].end();
-                        l3it++) {
+                task_list migrating;
+                wheel_three[slot3].move_to(&migrating);
+                while (task *l3task = migrating.pop_front()) {
                     /* Migrate this task to wheel two. */
-                  (*l3it)->recalculate_wheel();
+                  l3task->recalculate_wheel();
                 }
-
-                wheel_three[slot3].clear();
             }
 
             /* Repopulate wheel 1 from wheel 2 (which will now be full
                of the tasks pulled from wheel 3, if that was
                necessary) */
-            for (task_list::iterator l2it = wheel_two[slot2].begin();
-                    l2it != wheel_two[slot2].end();
-                    l2it++) {
+            task_list migrating;
+            wheel_two[slot2].move_to(&migrating);
+            while (task *l2task = migrating.pop_front()) {
                 /* Migrate this task to wheel one. */
-              (*l2it)->recalculate_wheel();
+              l2task->recalculate_wheel();
             }
-
-            wheel_two[slot2].clear();
         }
 
         /* Move tasks from the current slot of wheel 1 (i.e. the tasks
         scheduled to fire in the 1ms interval represented by
         wheel_base) onto a run queue. */
         found += wheel_one[slot1].size();
-        for(task_list::iterator it = wheel_one[slot1].begin();
-                it != wheel_one[slot1].end(); it++) {
-            (*it)->add_to_runqueue();
+        while (task *expired = wheel_one[slot1].pop_front()) {
+            expired->add_to_runqueue();
             // Decrement the total number of tasks in this wheel.
             count--;
         }
-        wheel_one[slot1].clear();
 
         wheel_base++; // Move wheel_base to the next 1ms interval
     }
@@ -272,15 +338,13 @@ int timewheel::expire_paused_tasks()
 // can be used for recalculating the wheel of an existing task.
 void timewheel::add_paused_task(task *task, bool increment)
 {
-    task_list::iterator task_it;
     if (task->wake() && task->wake() < wheel_base) {
         task->add_to_runqueue();
         return;
     }
     task_list *list = task2list(task);
-    task_it = list->insert(list->end(), task);
+    list->push_back(&task->queuehook);
     task->pauselist = list;
-    task->pauseit = task_it;
     if (increment) {
         count++;
     }
@@ -289,7 +353,7 @@ void timewheel::add_paused_task(task *task, bool increment)
 void timewheel::remove_paused_task(task *task)
 {
     task_list *list = task->pauselist;
-    list->erase(task->pauseit);
+    list->erase(&task->queuehook);
     count--;
 }
 
@@ -44,25 +44,37 @@
 #define MICROSECONDS_PER_SECOND 1000000LL
 #define MICROSECONDS_PER_MILLISECOND 1000LL
 #define NANOSECONDS_PER_MICROSECOND 1000LL
+/* The clocks start a little past zero: a clock_tick of 0 reads as "never"
+ * to the task wake-up code, and the coarse clock may trail the precise one
+ * by up to a kernel tick. */
+#define CLOCK_START_MICROSECONDS 10000LL
+
+static unsigned long long start_time = 0;
+
+static unsigned long long clock_microseconds(clockid_t clock)
+{
+    struct timespec time;
+    unsigned long long microseconds;
+
+    clock_gettime(clock, &time);
+    microseconds = (MICROSECONDS_PER_SECOND * time.tv_sec) + (time.tv_nsec / NANOSECONDS_PER_MICROSECOND);
+    if (start_time == 0) {
+      start_time = microseconds - CLOCK_START_MICROSECONDS;
+    }
+    return microseconds - start_time;
+}
 
 // Returns the number of microseconds that have passed since SIPp
 // started. Also updates the current clock_tick.
 unsigned long long getmicroseconds()
 {
-    struct timespec time;
     unsigned long long microseconds;
-    static unsigned long long start_time = 0;
 
 #if defined(CLOCK_MONOTONIC_COARSE)
-    clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+    microseconds = clock_microseconds(CLOCK_MONOTONIC_COARSE);
 #else
-    clock_gettime(CLOCK_MONOTONIC, &time);
+    microseconds = clock_microseconds(CLOCK_MONOTONIC);
 #endif
-    microseconds = (MICROSECONDS_PER_SECOND * time.tv_sec) + (time.tv_nsec / NANOSECONDS_PER_MICROSECOND);
-    if (start_time == 0) {
-      start_time = microseconds - 1;
-    }
-    microseconds = microseconds - start_time;
 
     // Static global from sipp.hpp
     clock_tick = microseconds / MICROSECONDS_PER_MILLISECOND;
@@ -70,6 +82,14 @@ unsigned long long getmicroseconds()
     return microseconds;
 }
 
+// Same as getmicroseconds(), but read from the precise clock: the coarse
+// one only moves on each kernel tick, which can be several milliseconds.
+// The current clock_tick is left alone so that it never runs backwards.
+unsigned long long getprecisemicroseconds()
+{
+    return clock_microseconds(CLOCK_MONOTONIC);
+}
+
 // Returns the number of milliseconds that have passed since SIPp
 // started. Also updates the current clock_tick.
 unsigned long getmilliseconds()
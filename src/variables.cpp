@@ -21,6 +21,7 @@
  *
  */
 
+#include <new>
 #include "sipp.hpp"
 
 /*
@@ -65,15 +66,24 @@ bool CCallVariable::isString()
     return (M_type == E_VT_STRING);
 }
 
-// WARNING : setMatchingValue does't allocate the memory for the matching value
-// but the destructor free the memory
-void CCallVariable::setMatchingValue(char* P_matchingVal)
+void CCallVariable::setMatchingValue(const char *P_matchingVal, size_t len)
 {
     M_type = E_VT_REGEXP;
-    if(M_matchingValue != NULL) {
-        delete [] M_matchingValue;
+    if (len < VAR_INLINE_SIZE) {
+        if (M_matchingSize) {
+            delete [] M_matchingValue;
+            M_matchingSize = 0;
+        }
+        M_matchingValue = M_matchingInline;
+    } else if (len >= M_matchingSize) {
+        if (M_matchingSize) {
+            delete [] M_matchingValue;
+        }
+        M_matchingSize = len + 1;
+        M_matchingValue = new char[M_matchingSize];
     }
-    M_matchingValue     = P_matchingVal;
+    memcpy(M_matchingValue, P_matchingVal, len);
+    M_matchingValue[len] = '\0';
     M_nbOfMatchingValue++;
 }
 
@@ -168,6 +178,7 @@ bool CCallVariable::getBool()
 CCallVariable::CCallVariable()
 {
     M_matchingValue     = NULL;
+    M_matchingSize = 0;
     M_stringValue     = NULL;
     M_nbOfMatchingValue = 0;
     M_type = E_VT_UNDEFINED;
@@ -175,17 +186,40 @@ CCallVariable::CCallVariable()
 
 CCallVariable::~CCallVariable()
 {
-    if(M_matchingValue != NULL) {
+    if (M_matchingSize) {
         delete [] M_matchingValue;
     }
     M_matchingValue = NULL;
     free(M_stringValue);
 }
 
+void CCallVariable::take(CCallVariable *other)
+{
+    M_type = other->M_type;
+    M_nbOfMatchingValue = other->M_nbOfMatchingValue;
+    M_double = other->M_double;
+    M_bool = other->M_bool;
+    M_stringValue = other->M_stringValue;
+    M_matchingSize = other->M_matchingSize;
+    if (other->M_matchingValue == other->M_matchingInline) {
+        memcpy(M_matchingInline, other->M_matchingInline, VAR_INLINE_SIZE);
+        M_matchingValue = M_matchingInline;
+    } else {
+        M_matchingValue = other->M_matchingValue;
+    }
+
+    other->M_type = E_VT_UNDEFINED;
+    other->M_matchingValue = NULL;
+    other->M_matchingSize = 0;
+    other->M_nbOfMatchingValue = 0;
+    other->M_stringValue = NULL;
+}
+
 #define LEVEL_BITS 8
 
-VariableTable::VariableTable(VariableTable *parent, int size)
+VariableTable::VariableTable(VariableTable *parent, int size, call_arena *arena)
 {
+    this->arena = arena;
     if (parent) {
         level = parent->level + 1;
         assert(level < (1 << LEVEL_BITS));
@@ -201,20 +235,19 @@ VariableTable::VariableTable(VariableTable *parent, int size)
         variableTable = NULL;
         return;
     }
-    variableTable = (CCallVariable **)malloc(size * sizeof(CCallVariable *));
-    if (!variableTable) {
-        ERROR("Could not allocate variable table!");
-    }
-    for (int i = 0; i < size; i++) {
-        variableTable[i] = new CCallVariable();
-        if (variableTable[i] == NULL) {
-            ERROR ("Call variable allocation failed");
+    if (arena) {
+        variableTable = (CCallVariable *)arena->alloc(size * sizeof(CCallVariable));
+        for (int i = 0; i < size; i++) {
+            new (&variableTable[i]) CCallVariable();
         }
+        return;
     }
+    variableTable = new CCallVariable[size];
 }
 
 VariableTable::VariableTable(AllocVariableTable *src)
 {
+    arena = NULL;
     count = 1;
     this->level = src->level;
     if (src->parent) {
@@ -231,17 +264,7 @@ VariableTable::VariableTable(AllocVariableTable *src)
         return;
     }
 
-    variableTable = (CCallVariable **)malloc(size * sizeof(CCallVariable *));
-    if (!variableTable) {
-        ERROR("Could not allocate variable table!");
-    }
-
-    for (int i = 0; i < size; i++) {
-        variableTable[i] = new CCallVariable();
-        if (variableTable[i] == NULL) {
-            ERROR ("Call variable allocation failed");
-        }
-    }
+    variableTable = new CCallVariable[size];
 }
 
 void VariableTable::expand(int size)
@@ -251,17 +274,13 @@ void VariableTable::expand(int size)
         return;
     }
 
-    variableTable = (CCallVariable **)realloc(variableTable, size * sizeof(CCallVariable *));
-    if (!variableTable) {
-        ERROR("Could not expand variable table!");
-    }
-
-    for (int i = this->size; i < size; i++) {
-        variableTable[i] = new CCallVariable();
-        if (variableTable[i] == NULL) {
-            ERROR ("Call variable allocation failed");
-        }
+    assert(!arena);
+    CCallVariable *expanded = new CCallVariable[size];
+    for (int i = 0; i < this->size; i++) {
+        expanded[i].take(&variableTable[i]);
     }
+    delete [] variableTable;
+    variableTable = expanded;
 
     this->size = size;
 }
@@ -271,10 +290,13 @@ VariableTable::~VariableTable()
     if (parent) {
         parent->putTable();
     }
-    for (int i = 0; i < size; i++) {
-        delete variableTable[i];
+    if (arena) {
+        for (int i = 0; i < size; i++) {
+            variableTable[i].~CCallVariable();
+        }
+        return;
     }
-    free(variableTable);
+    delete [] variableTable;
 }
 
 VariableTable *VariableTable::getTable()
@@ -286,7 +308,11 @@ VariableTable *VariableTable::getTable()
 void VariableTable::putTable()
 {
     if (--count == 0) {
-        delete this;
+        if (arena) {
+            this->~VariableTable();
+        } else {
+            delete this;
+        }
     }
 }
 
@@ -298,7 +324,7 @@ CCallVariable *VariableTable::getVar(int i)
         i = i >> LEVEL_BITS;
         assert(i > 0);
         assert(i <= size );
-        return variableTable[i - 1];
+        return &variableTable[i - 1];
     }
     assert(parent);
     return parent->getVar(i);